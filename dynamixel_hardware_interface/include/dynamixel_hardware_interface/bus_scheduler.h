@@ -0,0 +1,207 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef BUS_SCHEDULER_H__
+#define BUS_SCHEDULER_H__
+
+#include <stdint.h>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/future.hpp>
+
+#include <dynamixel_hardware_interface/dynamixel_io.h>
+
+namespace dynamixel_hardware_interface
+{
+
+struct BusLatency
+{
+    unsigned long count;
+    double mean_usec;
+    double max_usec;
+};
+
+// Owns all traffic on one serial port. Requests from every client are queued
+// by class and executed by a single thread in a fixed cycle: all pending
+// setpoints first, then feedback, then one housekeeping request, so a burst
+// of service calls can never delay a setpoint by more than one transaction.
+class BusScheduler
+{
+public:
+    enum Priority
+    {
+        SETPOINT = 0,
+        FEEDBACK,
+        HOUSEKEEPING,
+        NUM_PRIORITIES
+    };
+
+    BusScheduler();
+    ~BusScheduler();
+
+    void start();
+
+    // runs whatever is still queued, then joins the bus thread, requests made
+    // after that run right away on the caller's thread
+    void stop();
+
+    // the future holds the request's return value, or rethrows what it threw,
+    // shared_future because unique_future can not be returned by value pre C++11
+    template <class R>
+    boost::shared_future<R> submit(Priority priority, const boost::function<R ()>& request)
+    {
+        boost::shared_ptr<boost::packaged_task<R> > task(new boost::packaged_task<R>(request));
+        boost::shared_future<R> result(task->get_future());
+        if (!enqueue(priority, boost::bind(&BusScheduler::runTask<R>, task))) { runTask(task); }
+        return result;
+    }
+
+    // fire and forget, done (if set) is called from the bus thread
+    void post(Priority priority,
+              const boost::function<bool ()>& request,
+              const boost::function<void (bool)>& done = boost::function<void (bool)>());
+
+    // time requests of a class spent queued since the last reset
+    BusLatency getLatency(Priority priority, bool reset=false);
+
+    static const char* getPriorityName(Priority priority);
+
+private:
+    friend class BusCommit;
+
+    struct Request
+    {
+        boost::function<void ()> run;
+        double enqueue_time_usec;
+    };
+
+    boost::thread* bus_thread_;
+    boost::mutex mutex_;
+    boost::condition_variable request_ready_;
+    bool terminate_;
+    bool stopped_;                      // the bus thread has drained the queues and exited
+
+    std::deque<Request> queues_[NUM_PRIORITIES];
+
+    unsigned long latency_count_[NUM_PRIORITIES];
+    double latency_sum_usec_[NUM_PRIORITIES];
+    double latency_max_usec_[NUM_PRIORITIES];
+
+    // false, and run is dropped, once the bus thread is gone
+    bool enqueue(Priority priority, const boost::function<void ()>& run);
+    bool dequeue(Priority priority, Request& request);
+    bool pending();
+    void processRequests();
+
+    template <class R>
+    static void runTask(boost::shared_ptr<boost::packaged_task<R> > task) { (*task)(); }
+
+    static void runAndNotify(const boost::function<bool ()>& request, const boost::function<void (bool)>& done);
+};
+
+// One control tick's setpoints for several ports, sent together. Every
+// port's requests are queued before any of them is waited on and the bus
+// threads wait for each other before they write, so the commands of a tick go
+// out on all ports at once and the tick takes as long as its slowest port
+// instead of the sum of them. Requests without a scheduler run on the caller.
+//
+// A BusCommit keeps what it needs for a port between commits, so once it has
+// seen its ports and how many requests each gets, committing goals added with
+// addGoals() allocates nothing of its own. Requests added as functors still
+// allocate when they are too big for boost::function to hold in place, and
+// the scheduler's queue allocates a block now and then as it cycles.
+class BusCommit : boost::noncopyable
+{
+public:
+    BusCommit();
+    ~BusCommit();
+
+    // adding to a commit that was sent waits for it to finish first
+    void add(BusScheduler* scheduler, const boost::function<bool ()>& request);
+
+    // goals in encoder units for one port, they must stay valid until the commit is done
+    void addGoals(BusScheduler* scheduler, DynamixelIO* dxl_io, const DynamixelGoal* goals, size_t count);
+
+    // queues everything added since the last commit without waiting for the
+    // ports to write it, requests without a scheduler still run before it returns
+    void send();
+
+    // waits for what was sent, true if every request succeeded
+    bool wait();
+
+    // send() and wait()
+    bool commit();
+
+private:
+    struct Request
+    {
+        boost::function<bool ()> run;   // empty for goals
+        DynamixelIO* dxl_io;
+        const DynamixelGoal* goals;
+        size_t count;
+    };
+
+    struct Port
+    {
+        BusScheduler* scheduler;
+        std::vector<Request> requests;  // cleared between commits, the capacity stays
+        BusCommit* commit;
+        bool queued;                    // on the scheduler's bus thread rather than run by send()
+    };
+
+    std::vector<Port> ports_;           // the first used_ are part of the commit being put together
+    size_t used_;
+
+    boost::mutex mutex_;
+    boost::condition_variable changed_;
+    size_t arrived_;                    // bus threads at the start line
+    size_t scheduled_;                  // ports with a bus thread in this commit
+    size_t running_;                    // of them, ones that have not finished yet
+    bool success_;
+    bool sent_;                         // the ports are in use until wait()
+    bool sent_success_;                 // of the requests run by send() itself
+
+    // held while a commit queues its requests on all of its ports, so every
+    // port sees the commits in the same order and the bus threads of two
+    // commits can not end up waiting for each other
+    static boost::mutex submit_mutex_;
+
+    Port& findPort(BusScheduler* scheduler);
+    static bool runRequests(const std::vector<Request>& requests);
+    static void runPort(Port* port);
+};
+
+}
+
+#endif // BUS_SCHEDULER_H__
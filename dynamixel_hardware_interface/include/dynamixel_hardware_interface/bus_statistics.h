@@ -0,0 +1,135 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef BUS_STATISTICS_H__
+#define BUS_STATISTICS_H__
+
+#include <stdint.h>
+
+namespace dynamixel_hardware_interface
+{
+
+// Round trip times in microseconds, four buckets per power of two so that a
+// percentile read off the histogram is within a quarter of the real value.
+// The last bucket collects everything from about 1.8 seconds up.
+const int DXL_LATENCY_BUCKETS = 80;
+
+// one counter per bit of the status packet's error byte
+const int DXL_ERROR_BITS = 7;
+
+struct LatencyHistogram
+{
+    uint64_t buckets[DXL_LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t total_usec;
+    uint64_t max_usec;
+
+    static int bucketIndex(uint64_t usec);
+    static double bucketLowerBound(int index);
+
+    // plain, non-atomic update for histograms owned by a single thread
+    void record(uint64_t usec);
+    void clear();
+
+    double mean() const;
+
+    // upper edge of the bucket holding the sample at fraction, capped by the
+    // largest sample ever seen
+    double percentile(double fraction) const;
+};
+
+// Collects what happens to every request on one bus: per instruction and per
+// servo, how many were sent, how each response ended and how long it took.
+// The port lock makes sure there is only one writer, readers (diagnostics,
+// the statistics service) never take that lock, every counter is updated and
+// read atomically instead.
+class BusStatistics
+{
+public:
+    enum Outcome
+    {
+        RESPONSE = 0,
+        HEADER_TIMEOUT,         // not even the header arrived in time
+        PAYLOAD_TIMEOUT,        // header arrived, the rest did not
+        CHECKSUM_FAILURE,
+        BAD_HEADER,             // garbage where a header should be
+        NUM_OUTCOMES
+    };
+
+    enum InstructionClass
+    {
+        PING = 0,
+        READ,
+        WRITE,
+        SYNC_WRITE,
+        MULTI_READ,             // BULK_READ and SYNC_READ
+        OTHER,
+        NUM_INSTRUCTION_CLASSES
+    };
+
+    struct Counters
+    {
+        uint64_t requests;
+        uint64_t outcomes[NUM_OUTCOMES];
+        uint64_t error_bits[DXL_ERROR_BITS];
+        LatencyHistogram latency;
+
+        uint64_t failures() const;
+
+        // what happened between an earlier copy and this one, the maximum
+        // latency is only known for all time and becomes the top bucket's edge
+        void subtract(const Counters& earlier);
+    };
+
+    BusStatistics();
+
+    void countRequest(int servo_id, int instruction);
+    void countResponse(int servo_id, int instruction, Outcome outcome, uint64_t latency_usec, uint8_t error);
+
+    void getTotal(Counters& counters) const;
+    void getInstruction(InstructionClass instruction, Counters& counters) const;
+    void getMotor(int servo_id, Counters& counters) const;
+    void reset();
+
+    static InstructionClass classify(int instruction);
+    static const char* getInstructionName(InstructionClass instruction);
+    static const char* getOutcomeName(Outcome outcome);
+
+private:
+    Counters total_;
+    Counters instructions_[NUM_INSTRUCTION_CLASSES];
+    Counters motors_[256];
+
+    static void add(Counters& counters, Outcome outcome, uint64_t latency_usec, uint8_t error);
+    static void copy(const Counters& from, Counters& to);
+    static void clear(Counters& counters);
+};
+
+}
+
+#endif // BUS_STATISTICS_H__
@@ -96,6 +96,95 @@ typedef enum DynamixelControlEnum
 
 } DynamixelControl;
 
+// Protocol 2.0 control table of the X series and of MX servos running 2.0
+// firmware. On 2.0 ports DynamixelIO keeps talking in terms of the table
+// above and maps its registers onto these.
+typedef enum DynamixelXControlEnum
+{
+    DXL_X_MODEL_NUMBER = 0,
+    DXL_X_FIRMWARE_VERSION = 6,
+    DXL_X_ID = 7,
+    DXL_X_BAUD_RATE = 8,
+    DXL_X_RETURN_DELAY_TIME = 9,
+    DXL_X_DRIVE_MODE = 10,
+    DXL_X_OPERATING_MODE = 11,
+    DXL_X_TEMPERATURE_LIMIT = 31,
+    DXL_X_MAX_VOLTAGE_LIMIT = 32,
+    DXL_X_MIN_VOLTAGE_LIMIT = 34,
+    DXL_X_MAX_POSITION_LIMIT = 48,
+    DXL_X_MIN_POSITION_LIMIT = 52,
+    DXL_X_SHUTDOWN = 63,
+    DXL_X_TORQUE_ENABLE = 64,
+    DXL_X_LED = 65,
+    DXL_X_STATUS_RETURN_LEVEL = 68,
+    DXL_X_REGISTERED_INSTRUCTION = 69,
+    DXL_X_HARDWARE_ERROR_STATUS = 70,
+    DXL_X_PROFILE_VELOCITY = 112,
+    DXL_X_GOAL_POSITION = 116,
+    DXL_X_MOVING = 122,
+    DXL_X_PRESENT_LOAD = 126,
+    DXL_X_PRESENT_VELOCITY = 128,
+    DXL_X_PRESENT_POSITION = 132,
+    DXL_X_PRESENT_INPUT_VOLTAGE = 144,
+    DXL_X_PRESENT_TEMPERATURE = 146,
+
+} DynamixelXControl;
+
+// Wire protocol spoken on a port, servos on one bus all have to agree
+const int DXL_PROTOCOL_1 = 1;
+const int DXL_PROTOCOL_2 = 2;
+
+// Feedback registers polled together, fast ones (present position, speed and
+// load) change every cycle, slow ones (torque limit, voltage, temperature and
+// moving flag) over seconds
+const int DXL_FEEDBACK_FAST = 1;
+const int DXL_FEEDBACK_SLOW = 2;
+const int DXL_FEEDBACK_ALL = DXL_FEEDBACK_FAST | DXL_FEEDBACK_SLOW;
+
+// Bytes of the control table mirrored by DynamixelIO, covers EEPROM and RAM areas
+const int DXL_CONTROL_TABLE_SIZE = 64;
+
+// Compile-time description of a control table register. Signed registers
+// use sign-magnitude encoding, bit 10 holds the direction (1 = negative).
+template <int ADDRESS, int WIDTH, bool SIGNED = false>
+struct DynamixelRegister
+{
+    static const int address = ADDRESS;
+    static const int width = WIDTH;
+    static const bool is_signed = SIGNED;
+};
+
+typedef DynamixelRegister<DXL_MODEL_NUMBER_L, 2>            DxlModelNumber;
+typedef DynamixelRegister<DXL_FIRMWARE_VERSION, 1>          DxlFirmwareVersion;
+typedef DynamixelRegister<DXL_ID, 1>                        DxlId;
+typedef DynamixelRegister<DXL_BAUD_RATE, 1>                 DxlBaudRate;
+typedef DynamixelRegister<DXL_RETURN_DELAY_TIME, 1>         DxlReturnDelayTime;
+typedef DynamixelRegister<DXL_CW_ANGLE_LIMIT_L, 2>          DxlCWAngleLimit;
+typedef DynamixelRegister<DXL_CCW_ANGLE_LIMIT_L, 2>         DxlCCWAngleLimit;
+typedef DynamixelRegister<DXL_DRIVE_MODE, 1>                DxlDriveMode;
+typedef DynamixelRegister<DXL_LIMIT_TEMPERATURE, 1>         DxlLimitTemperature;
+typedef DynamixelRegister<DXL_DOWN_LIMIT_VOLTAGE, 1>        DxlDownLimitVoltage;
+typedef DynamixelRegister<DXL_UP_LIMIT_VOLTAGE, 1>          DxlUpLimitVoltage;
+typedef DynamixelRegister<DXL_MAX_TORQUE_L, 2>              DxlMaxTorque;
+typedef DynamixelRegister<DXL_RETURN_LEVEL, 1>              DxlReturnLevel;
+typedef DynamixelRegister<DXL_ALARM_LED, 1>                 DxlAlarmLed;
+typedef DynamixelRegister<DXL_ALARM_SHUTDOWN, 1>            DxlAlarmShutdown;
+typedef DynamixelRegister<DXL_TORQUE_ENABLE, 1>             DxlTorqueEnable;
+typedef DynamixelRegister<DXL_LED, 1>                       DxlLed;
+typedef DynamixelRegister<DXL_CW_COMPLIANCE_MARGIN, 1>      DxlCWComplianceMargin;
+typedef DynamixelRegister<DXL_CCW_COMPLIANCE_MARGIN, 1>     DxlCCWComplianceMargin;
+typedef DynamixelRegister<DXL_CW_COMPLIANCE_SLOPE, 1>       DxlCWComplianceSlope;
+typedef DynamixelRegister<DXL_CCW_COMPLIANCE_SLOPE, 1>      DxlCCWComplianceSlope;
+typedef DynamixelRegister<DXL_GOAL_POSITION_L, 2>           DxlGoalPosition;
+typedef DynamixelRegister<DXL_GOAL_SPEED_L, 2, true>        DxlGoalSpeed;
+typedef DynamixelRegister<DXL_TORQUE_LIMIT_L, 2>            DxlTorqueLimit;
+typedef DynamixelRegister<DXL_PRESENT_POSITION_L, 2>        DxlPresentPosition;
+typedef DynamixelRegister<DXL_PRESENT_SPEED_L, 2, true>     DxlPresentSpeed;
+typedef DynamixelRegister<DXL_PRESENT_LOAD_L, 2, true>      DxlPresentLoad;
+typedef DynamixelRegister<DXL_PRESENT_VOLTAGE, 1>           DxlPresentVoltage;
+typedef DynamixelRegister<DXL_PRESENT_TEMPERATURE, 1>       DxlPresentTemperature;
+typedef DynamixelRegister<DXL_MOVING, 1>                    DxlMoving;
+
 typedef enum DynamixelInstructionEnum
 {
     DXL_PING = 1,
@@ -104,7 +193,10 @@ typedef enum DynamixelInstructionEnum
     DXL_REG_WRITE = 4,
     DXL_ACTION = 5,
     DXL_RESET = 6,
+    DXL_STATUS = 85,            // protocol 2.0 only
+    DXL_SYNC_READ = 130,        // protocol 2.0 only
     DXL_SYNC_WRITE = 131,
+    DXL_BULK_READ = 146,
     DXL_BROADCAST = 254,
 
 } DynamixelInstruction;
@@ -145,13 +237,31 @@ inline std::string getMotorModelName(int model_number)
     else if (model_number == 64) { return "RX-64"; }
     else if (model_number == 107) { return "EX-106"; }
     else if (model_number == 29) { return "MX-28"; }
+    else if (model_number == 30) { return "MX-28(2.0)"; }
+    else if (model_number == 311) { return "MX-64(2.0)"; }
+    else if (model_number == 321) { return "MX-106(2.0)"; }
+    else if (model_number == 1020) { return "XM430-W350"; }
+    else if (model_number == 1030) { return "XM430-W210"; }
+    else if (model_number == 1060) { return "XL430-W250"; }
 
     return "";
 }
 
+// MX series firmware understands BULK_READ (0x92), AX/RX/EX/DX do not
+inline bool supportsBulkRead(int model_number)
+{
+    return (model_number == 29 ||     // MX-28
+            model_number == 310 ||    // MX-64
+            model_number == 320);     // MX-106
+}
+
 const double KGCM_TO_NM = 0.0980665;        // 1 kg-cm is that many N-m
 const double RPM_TO_RADSEC = 0.104719755;   // 1 RPM is that many rad/sec
 
+// speed unit of the table above as seen by callers on a protocol 2.0 port,
+// the servos themselves count in 0.229 rpm
+const double DXL_X_VELOCITY_RPM_PER_TICK = 0.114;
+
 inline double getMotorModelParams(int model_number, DynamixelParams param)
 {
     if (model_number == 113)
@@ -264,6 +374,68 @@ inline double getMotorModelParams(int model_number, DynamixelParams param)
             case VELOCITY_PER_VOLT:  { return (54.0 * RPM_TO_RADSEC) / 12.0; }
         }
     }
+    // Protocol 2.0 servos, goal and present speed are scaled by DynamixelIO
+    // so that the full 1023 range spans the 0.114 rpm units of the MX series
+    else if (model_number == 30)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 2.5 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
+    else if (model_number == 311)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 6.0 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
+    else if (model_number == 321)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 8.4 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
+    else if (model_number == 1020)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 4.1 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
+    else if (model_number == 1030)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 3.0 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
+    else if (model_number == 1060)
+    {
+        switch (param)
+        {
+            case ENCODER_RESOLUTION: { return 4096.0; }
+            case RANGE_DEGREES:      { return 360.0; }
+            case TORQUE_PER_VOLT:    { return 1.5 / 12.0; }
+            case VELOCITY_PER_VOLT:  { return (DXL_X_VELOCITY_RPM_PER_TICK * 1023 * RPM_TO_RADSEC) / 12.0; }
+        }
+    }
 
     return -1;
 }
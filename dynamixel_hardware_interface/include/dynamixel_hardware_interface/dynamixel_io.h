@@ -30,6 +30,7 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <time.h>
 
 #include <set>
 #include <map>
@@ -38,9 +39,14 @@
 
 #include <clam/gearbox/flexiport/port.h>
 
+#include <dynamixel_hardware_interface/bus_statistics.h>
+#include <dynamixel_hardware_interface/dynamixel_packet.h>
+
 namespace dynamixel_hardware_interface
 {
 
+struct Dynamixel2Packet;
+
 typedef struct DynamixelDataStruct
 {
     uint16_t model_number;
@@ -66,6 +72,8 @@ typedef struct DynamixelDataStruct
     uint8_t  ccw_compliance_slope;
     uint16_t target_position;
     int16_t  target_velocity;
+    uint8_t  voltage;           // present voltage and temperature at the time
+    uint8_t  temperature;       // the parameters were read
     
     double   shutdown_error_time;
     std::string error;
@@ -74,7 +82,9 @@ typedef struct DynamixelDataStruct
 
 typedef struct DynamixelStatusStruct
 {
-    double timestamp;
+    double timestamp;           // last time any of the registers below were read
+    double fast_timestamp;      // last time the DXL_FEEDBACK_FAST group was read
+    double slow_timestamp;      // last time the DXL_FEEDBACK_SLOW group was read
     
     uint16_t torque_limit;
     uint16_t position;
@@ -86,21 +96,49 @@ typedef struct DynamixelStatusStruct
 
 } DynamixelStatus;
 
+typedef struct DynamixelGoalStruct
+{
+    uint8_t  id;
+    uint16_t position;
+    int16_t  velocity;
+
+} DynamixelGoal;
+
+// Last known contents of a servo's control table. A byte is known once it has
+// been read from or written to the servo (or staged for writing), dirty bytes
+// are staged but have not been sent yet. Bit N of each mask is address N.
+typedef struct DynamixelShadowStruct
+{
+    uint8_t  table[DXL_CONTROL_TABLE_SIZE];
+    uint64_t known;
+    uint64_t dirty;
+
+} DynamixelShadow;
+
 
 class DynamixelIO
 {
 public:
-    DynamixelIO(std::string device, std::string baud);
+    // port_options are extra flexiport options that override the serial port
+    // defaults, e.g. "type=dxlsim servos=1-6:29" for a simulated bus
+    DynamixelIO(std::string device, std::string baud, int protocol=DXL_PROTOCOL_1,
+                std::string port_options="");
     ~DynamixelIO();
 
-    long long unsigned int read_error_count;
-    long long unsigned int read_count;
-    double last_reset_sec;
-    
     const DynamixelData* getCachedParameters(int servo_id);
+
+    // parameters as of the last ping(), discover() or getCachedParameters(),
+    // without asking the servo again
+    const DynamixelData* getKnownParameters(int servo_id) { return findCachedParameters(servo_id); }
     
     bool ping(int servo_id);
     bool resetOverloadError(int servo_id);
+
+    // Asks every one of servo_ids for its control table, waiting at most
+    // timeout_usec for each answer instead of the usual 50 ms, and appends
+    // the ones that answered to found. One read per servo both finds it and
+    // fills in its cached parameters, a found servo counts as pinged.
+    void discover(const std::vector<int>& servo_ids, int timeout_usec, std::vector<int>& found);
     
     // ****************************** GETTERS ******************************** //
     bool getModelNumber(int servo_id, uint16_t& model_number);
@@ -144,6 +182,23 @@ public:
     
     bool getFeedback(int servo_id, DynamixelStatus& status);
 
+    // Reads feedback for all servo_ids in as few bus transactions as possible,
+    // MX servos are polled with a single BULK_READ (SYNC_READ on protocol 2.0
+    // ports), others back-to-back.
+    // status and valid are resized to match servo_ids, returns true only
+    // if every servo replied.
+    bool getMultiFeedback(const std::vector<int>& servo_ids,
+                          std::vector<DynamixelStatus>& status,
+                          std::vector<bool>& valid);
+
+    // Same as getMultiFeedback, but only reads the DXL_FEEDBACK_* groups given
+    // for each servo, fields of groups not read keep their previous values.
+    // status has to be sized to match servo_ids by the caller.
+    bool getGroupFeedback(const std::vector<int>& servo_ids,
+                          const std::vector<int>& groups,
+                          std::vector<DynamixelStatus>& status,
+                          std::vector<bool>& valid);
+
     // ****************************** SETTERS ******************************** //
     bool setId(int servo_id, uint8_t id);
     bool setBaudRate(int servo_id, uint8_t baud_rate);
@@ -177,49 +232,195 @@ public:
     bool setTorqueLimit(int servo_id, uint16_t torque_limit);
     
     // ************************* SYNC_WRITE METHODS *************************** //
-    bool setMultiPosition(std::vector<std::vector<int> > value_pairs);
-    bool setMultiVelocity(std::vector<std::vector<int> > value_pairs);
-    bool setMultiPositionVelocity(std::vector<std::vector<int> > value_pairs);
-    bool setMultiComplianceMargins(std::vector<std::vector<int> > value_pairs);
-    bool setMultiComplianceSlopes(std::vector<std::vector<int> > value_pairs);
-    bool setMultiTorqueEnabled(std::vector<std::vector<int> > value_pairs);
-    bool setMultiTorqueLimit(std::vector<std::vector<int> > value_pairs);
-    bool setMultiValues(std::vector<std::map<std::string, int> > value_maps);
+    bool setMultiPosition(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiVelocity(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiPositionVelocity(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiComplianceMargins(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiComplianceSlopes(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiTorqueEnabled(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiTorqueLimit(const std::vector<std::vector<int> >& value_pairs);
+    bool setMultiValues(const std::vector<std::map<std::string, int> >& value_maps);
+
+    // typed variant for the control loop, encodes straight into a stack packet
+    bool setMultiPositionVelocity(const DynamixelGoal* goals, size_t count);
+
+    // ************************ STAGED WRITE METHODS ************************** //
+    // Staging only updates the control table shadow, registers whose value has
+    // actually changed go out with the next flush() packed into as few
+    // SYNC_WRITE packets as possible. The setMulti* methods stage and flush.
+    template <class REG>
+    void stage(int servo_id, int value)
+    {
+        uint8_t bytes[REG::width];
+        encodeRegister<REG>(value, bytes);
+        stageBytes(servo_id, REG::address, bytes, REG::width);
+    }
+
+    bool flush();
+
+    // Servos without BULK_READ are normally asked one at a time. With
+    // pipelining enabled (the default) several READs go out back to back,
+    // as many as fit into the servos' return delay, and their replies are
+    // picked out of one stream.
+    void setPipelinedReads(bool enabled) { pipelined_reads_ = enabled; }
+
+    int getProtocol() const { return protocol_; }
+
+    // latency and failures of every transaction on this port, safe to read
+    // from any thread while the bus is busy
+    BusStatistics& getStatistics() { return stats_; }
     
 protected:
-    std::map<int, DynamixelData*> cache_;
+    DynamixelData cache_[256];
+    DynamixelShadow shadow_[256];
     std::set<int> connected_motors_;
 
     inline DynamixelData* findCachedParameters(int servo_id)
     {
-        // this will either return an existing cache for servo_id or create new empty cahce and return that
-        return cache_.insert(std::make_pair<int, DynamixelData*>(servo_id, new DynamixelData())).first->second;
+        return &cache_[servo_id & 0xFF];
     }
     
+    void stageBytes(int servo_id, int address, const uint8_t* bytes, int size);
+    void updateShadow(int servo_id, int address, const uint8_t* bytes, int size);
+    void invalidateShadow(int servo_id, int address, int size);
+    void forgetShadow(const uint8_t* servo_ids, int count, uint64_t mask);
+    void decodeShadow(const DynamixelShadow& shadow, DynamixelData* data);
+
     bool updateCachedParameters(int servo_id, DynamixelData* data);
-    void checkForErrors(int servo_id, uint8_t error_code, std::string command_failed);
+    void checkForErrors(int servo_id, uint8_t error_code, const char* command_failed);
+    bool parseFeedback(const uint8_t* params, int group, DynamixelStatus& status);
+
+    // groups is one DXL_FEEDBACK_* entry per servo, NULL reads everything
+    bool readFeedback(const std::vector<int>& servo_ids,
+                      const int* groups,
+                      std::vector<DynamixelStatus>& status,
+                      std::vector<bool>& valid);
+
+    bool read(int servo_id,
+              int address,
+              int size,
+              DynamixelPacket& response);
 
     bool read(int servo_id,
               int address,
               int size,
               std::vector<uint8_t>& response);
 
+    bool write(int servo_id,
+               int address,
+               const uint8_t* data,
+               size_t count,
+               DynamixelPacket& response);
+
     bool write(int servo_id,
                int address,
                const std::vector<uint8_t>& data,
                std::vector<uint8_t>& response);
 
+    // fills in length and checksum of a packet started with beginSyncWrite and sends it
+    bool syncWrite(DynamixelPacket& packet);
+
     bool syncWrite(int address,
                    const std::vector<std::vector<uint8_t> >& data);
+
+    // data receives size bytes per servo, error_codes and valid one entry per servo
+    bool readMulti(const int* servo_ids,
+                   size_t count,
+                   int address,
+                   int size,
+                   uint8_t* data,
+                   uint8_t* error_codes,
+                   bool* valid);
+
+    bool bulkRead(const int* servo_ids,
+                  size_t count,
+                  int address,
+                  int size,
+                  uint8_t* data,
+                  uint8_t* error_codes,
+                  bool* valid);
+
+    // how many of servo_ids can be read in one pipelined burst, 1 means no pipelining
+    size_t pipelineDepth(const int* servo_ids, size_t count, int size);
+
+    bool readPipelined(const int* servo_ids,
+                       size_t count,
+                       int address,
+                       int size,
+                       uint8_t* data,
+                       uint8_t* error_codes,
+                       bool* valid);
+
+    // copies readMulti/bulkRead results into the shadow
+    void mirrorMulti(const int* servo_ids,
+                     size_t count,
+                     int address,
+                     int size,
+                     const uint8_t* data,
+                     const bool* valid);
+
+    // Protocol 2.0 counterparts of the above, see dynamixel_io_protocol2.cpp.
+    // Callers keep using addresses and values of the 1.0 control table, they
+    // are translated to and from the X series table on the way.
+    bool ping2(int servo_id, DynamixelPacket& response);
+
+    bool read2(int servo_id,
+               int address,
+               int size,
+               DynamixelPacket& response);
+
+    bool write2(int servo_id,
+                int address,
+                const uint8_t* data,
+                size_t count,
+                DynamixelPacket& response);
+
+    // takes a 1.0 SYNC_WRITE packet as built by beginSyncWrite, unfinished
+    bool syncWrite2(const DynamixelPacket& packet);
+
+    bool syncRead2(const int* servo_ids,
+                   size_t count,
+                   int address,
+                   int size,
+                   uint8_t* data,
+                   uint8_t* error_codes,
+                   bool* valid);
     
 private:
     flexiport::Port* port_;
     pthread_mutex_t serial_mutex_;
+    pthread_mutex_t shadow_mutex_;
+    int baud_rate_;
+    bool pipelined_reads_;
+    int protocol_;
+
+    BusStatistics stats_;
+
+    // the transaction in progress, only touched with serial_mutex_ held
+    int pending_id_;
+    int pending_instruction_;
+    struct timespec request_time_;
+    BusStatistics::Outcome last_outcome_;
+
+    // how long a servo gets to answer a request
+    flexiport::Timeout response_timeout_;
     
-    bool waitForBytes(ssize_t n_bytes, uint16_t timeout_ms);
-    
+    // stamps the start of a request, call once per servo that is going to answer
+    void beginTransaction(int servo_id, int instruction);
+
+    // stamps a request sent again to a servo that never got to answer the
+    // first one, it was already counted
+    void retryTransaction(int servo_id, int instruction);
+
+    // servo the next response of a multi servo transaction should come from
+    void expectResponse(int servo_id) { pending_id_ = servo_id; }
+
+    void recordResponse(BusStatistics::Outcome outcome, int servo_id, uint8_t error=0);
+
     bool writePacket(const void* const buffer, size_t count);
-    bool readResponse(std::vector<uint8_t>& response);
+    bool readResponse(DynamixelPacket& response);
+    bool readNextResponse(DynamixelPacket& response, int param_count, const struct timespec& deadline);
+    bool readResponse2(Dynamixel2Packet& status);
 };
 
 }
@@ -0,0 +1,158 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DYNAMIXEL_PACKET_H__
+#define DYNAMIXEL_PACKET_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <dynamixel_hardware_interface/dynamixel_const.h>
+
+namespace dynamixel_hardware_interface
+{
+
+// FF FF ID LENGTH followed by at most 255 bytes (instruction/error, params, checksum)
+const size_t DXL_MAX_PACKET_SIZE = 4 + 255;
+
+// Largest number of servos that can share one bus (IDs 0 through 253)
+const size_t DXL_MAX_SERVOS = 254;
+
+// FF FF ID LENGTH READ_DATA ADDRESS SIZE CHECKSUM
+const size_t DXL_READ_REQUEST_SIZE = 8;
+
+// Most READ requests in flight at once, and the margin left between the end
+// of the last request and the start of the first reply
+const size_t DXL_MAX_PIPELINE_DEPTH = 8;
+const double DXL_PIPELINE_GUARD_USEC = 40.0;
+
+// Check Sum = ~ (ID + LENGTH + INSTRUCTION + PARAM_1 + ... + PARAM_N)
+// If the calculated value is > 255, the lower byte is the check sum.
+inline uint8_t computeChecksum(const uint8_t* packet, size_t size)
+{
+    uint32_t sum = 0;
+
+    for (size_t i = 2; i < size - 1; ++i)
+    {
+        sum += packet[i];
+    }
+
+    return 0xFF - (sum % 256);
+}
+
+template <class REG>
+inline void encodeRegister(int value, uint8_t* dst)
+{
+    if (REG::is_signed && value < 0) { value = (-value & 0x3FF) | (1 << 10); }
+
+    dst[0] = value % 256;                       // lo_byte
+    if (REG::width == 2) { dst[1] = value >> 8; }  // hi_byte
+}
+
+template <class REG>
+inline int decodeRegister(const uint8_t* src)
+{
+    int value = (REG::width == 2) ? src[0] + (src[1] << 8) : src[0];
+
+    if (REG::is_signed)
+    {
+        int direction = (value & (1 << 10)) == 0 ? 1 : -1;
+        value = direction * (value & 0x3FF);
+    }
+
+    return value;
+}
+
+// Register value at ADDRESS inside the parameters of a READ_DATA reply that started at START
+template <class REG, int START>
+inline int decodeRegisterAt(const uint8_t* params)
+{
+    return decodeRegister<REG>(params + REG::address - START);
+}
+
+// Fixed size frame used both for building instruction packets and for
+// receiving status packets, lives on the stack so that encoding and
+// decoding never touches the heap.
+struct DynamixelPacket
+{
+    uint8_t data[DXL_MAX_PACKET_SIZE];
+    size_t size;
+
+    DynamixelPacket() : size(0) {}
+
+    // packet: FF  FF  ID LENGTH INSTRUCTION PARAM_1 ... CHECKSUM
+    void begin(int servo_id, int instruction)
+    {
+        data[0] = 0xFF;
+        data[1] = 0xFF;
+        data[2] = servo_id;
+        data[3] = 0;
+        data[4] = instruction;
+        size = 5;
+    }
+
+    // packet: FF  FF  FE LENGTH SYNC_WRITE ADDRESS DATA_LENGTH (ID DATA_1 ... DATA_N) ... CHECKSUM
+    void beginSyncWrite(int address, int data_length)
+    {
+        begin(DXL_BROADCAST, DXL_SYNC_WRITE);
+        append(address);
+        append(data_length);
+    }
+
+    // number of parameter bytes that can still be appended
+    size_t capacity() const { return DXL_MAX_PACKET_SIZE - 1 - size; }
+
+    void append(uint8_t byte) { data[size++] = byte; }
+
+    template <class REG>
+    void appendRegister(int value)
+    {
+        encodeRegister<REG>(value, data + size);
+        size += REG::width;
+    }
+
+    // fill in the length and checksum bytes
+    void finish()
+    {
+        data[3] = size - 3;
+        data[size] = computeChecksum(data, size + 1);
+        ++size;
+    }
+
+    bool checksumValid() const { return size >= 6 && computeChecksum(data, size) == data[size-1]; }
+
+    uint8_t id() const { return data[2]; }
+    uint8_t error() const { return data[4]; }
+    const uint8_t* params() const { return data + 5; }
+    size_t paramCount() const { return size - 6; }
+
+    uint8_t operator[](size_t i) const { return data[i]; }
+};
+
+}
+
+#endif  // DYNAMIXEL_PACKET_H__
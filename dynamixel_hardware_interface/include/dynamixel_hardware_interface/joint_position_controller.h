@@ -55,8 +55,9 @@ public:
                              dynamixel_hardware_interface::TorqueEnable::Request& res);
     
     std::vector<std::vector<int> > getRawMotorCommands(double position, double velocity);
+    void getRawMotorGoals(double position, double velocity, dynamixel_hardware_interface::DynamixelGoal* goals);
     
-    void processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg);
+    void processMotorState(const dynamixel_hardware_interface::MotorState& state);
     void processCommand(const std_msgs::Float64ConstPtr& msg);
 
     bool setVelocity(double velocity);
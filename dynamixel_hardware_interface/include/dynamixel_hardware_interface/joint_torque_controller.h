@@ -56,7 +56,7 @@ public:
     
     std::vector<std::vector<int> > getRawMotorCommands(double position, double velocity);
     
-    void processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg);
+    void processMotorState(const dynamixel_hardware_interface::MotorState& state);
     void processCommand(const std_msgs::Float64ConstPtr& msg);
     
     bool setVelocity(double velocity);
@@ -1,13 +1,16 @@
 #ifndef DYNAMIXEL_HARDWARE_INTERFACE_JOINT_TRAJECTORY_ACTION_CONTROLLER_H
 #define DYNAMIXEL_HARDWARE_INTERFACE_JOINT_TRAJECTORY_ACTION_CONTROLLER_H
 
+#include <map>
 #include <vector>
 #include <string>
 
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <dynamixel_hardware_interface/bus_statistics.h>
 #include <dynamixel_hardware_interface/single_joint_controller.h>
+#include <dynamixel_hardware_interface/trajectory_trace.h>
 #include <dynamixel_hardware_interface/multi_joint_controller.h>
 
 #include <ros/ros.h>
@@ -24,6 +27,69 @@ struct Segment
   double duration;
   std::vector<double> positions;
   std::vector<double> velocities;
+  std::vector<double> accelerations;  // empty unless every joint has one
+};
+
+// Position of one joint over one streamed segment, p(t) = c[0] + c[1] t + ... + c[5] t^5 for t
+// from 0 to the segment's duration. A cubic leaves c[4] and c[5] at 0.
+struct Spline
+{
+  double c[6];
+};
+
+// A trajectory worked out for the bus before it starts, the goal of every motor for every
+// segment in encoder units, laid out per port. Executing a segment hands each port a slice
+// of its goals, with no lookups or conversions in between. A streamed trajectory has a spline
+// per joint for every segment instead, and each port the joints on it and room for two ticks'
+// goals, one filled while the bus may still be writing the other.
+//
+// Plans are posted to the executor thread through a lock-free list and take over from the one
+// it is executing at their start time, so a new trajectory is spliced into the motion instead
+// of stopping it first, and one that starts later waits until then. All of a plan's times are
+// CLOCK_MONOTONIC seconds, the trajectory's ROS times are converted when it is compiled.
+struct TrajectoryPlan
+{
+  struct Port
+  {
+    dynamixel_hardware_interface::BusScheduler* bus_scheduler;
+    dynamixel_hardware_interface::DynamixelIO* dxl_io;
+    size_t motor_count;
+    std::vector<dynamixel_hardware_interface::DynamixelGoal> goals;   // motor_count goals per segment, in order,
+                                                                      // or per tick when streamed
+    std::vector<size_t> joints;         // streamed, index of each joint on the port
+    std::vector<size_t> joint_motors;   // and how many of the goals are its motors'
+  };
+
+  TrajectoryPlan();
+
+  std::vector<Port> ports;
+  std::vector<int> waypoints;         // trajectory point each segment moves to
+  std::vector<double> end_times;      // when each segment is due to be finished
+
+  bool streamed;
+  bool quintic;
+  std::vector<Segment> segments;                // segments with a duration
+  std::vector<std::vector<Spline> > splines;    // one per joint for each of them
+
+  double start_time;                  // when it takes over from the plan executing before it
+  double end_time;
+
+  // executor's progress through it
+  size_t segment;
+  bool sent;                          // goals of the current segment have been sent
+  bool back_half;                     // streamed, the next tick fills the second half of the goals
+  bool settling;                      // done moving, waiting out the goal time constraint
+  double settle_time;
+
+  // handoff and outcome
+  TrajectoryPlan* next;               // link in the list of posted plans
+  volatile bool cancel;               // stop where it is, the executor holds the joints
+  volatile bool finished;
+  int error_code;
+  std::string error_msg;
+  bool preempted;
+  int refs;                           // the executor, the goal callback waiting on an action goal and
+                                      // the ports while they write goals sent from it
 };
 
 class JointTrajectoryActionController : public MultiJointController
@@ -41,9 +107,20 @@ public:
   void processFollowTrajectory(const control_msgs::FollowJointTrajectoryGoalConstPtr& goal);
   void updateState();
   void processTrajectory(const trajectory_msgs::JointTrajectory& traj, bool is_action);
+  void executeTrajectories();
 
 private:
-  void getUniqueErrorLogPath(std::string &log_path);
+  bool compileTrajectory(const std::vector<Segment>& trajectory, TrajectoryPlan& plan, std::string& error_msg);
+  void postPlan(TrajectoryPlan* plan);
+  bool beginPlan(TrajectoryPlan* plan, const TrajectoryPlan* previous, double now, std::string& error_msg);
+  bool tickPlan(TrajectoryPlan* plan, double now);
+  bool streamSetpoints(TrajectoryPlan* plan, double now);
+  bool checkPathConstraints(TrajectoryPlan* plan, int point);
+  bool checkSplineVelocities(const std::vector<Spline>& splines, double duration, int point, std::string& error_msg);
+  void holdSentPlan(TrajectoryPlan* plan);
+  void finishPlan(TrajectoryPlan* plan, int error_code, const std::string& error_msg, bool preempted = false);
+  void publishExecutorDiagnostics();
+  void sendHoldCommands();
 
   int update_rate_;
   int state_update_rate_;
@@ -52,6 +129,8 @@ private:
   double goal_time_constraint_;
   double stopped_velocity_tolerance_;
   double min_velocity_;
+  bool stream_setpoints_;   // fit splines to a trajectory and stream setpoints instead of sending waypoints
+  double stream_rate_;      // setpoints per second when streaming
   std::vector<double> goal_constraints_;
   std::vector<double> trajectory_constraints_;
 
@@ -59,11 +138,39 @@ private:
 
   ros::Subscriber command_sub_;
   ros::Publisher state_pub_;
+  ros::Publisher diagnostics_pub_;
 
   typedef actionlib::SimpleActionServer<control_msgs::FollowJointTrajectoryAction> FJTAS;
   boost::scoped_ptr<FJTAS> action_server_;
 
+  // plans posted since the executor last looked, newest first
+  TrajectoryPlan* volatile posted_plans_;
+  volatile bool executing_;
+
+  // plan the goals last sent are read from, the executor does not wait for the ports to write them
+  TrajectoryPlan* sent_plan_;
+
+  int executor_priority_;             // SCHED_FIFO priority of the executor thread, 0 to leave it alone
+  int executor_cpu_;                  // CPU to pin it to, -1 for any
+
+  boost::mutex executor_stats_mutex_;
+  dynamixel_hardware_interface::LatencyHistogram wakeup_jitter_;    // how late after its deadline a tick started
+  dynamixel_hardware_interface::LatencyHistogram tick_time_;        // how long one tick took
+  uint64_t overruns_;                 // periods skipped because a tick ran long
+
+  // what each joint was last sent while streaming, carried over when a streamed plan is spliced
+  std::vector<double> commanded_;
+
+  // every tick's desired and actual joint positions while a plan is executing, if trace_file_ is set
+  std::string trace_file_;
+  int trace_capacity_;
+  dynamixel_hardware_interface::TrajectoryTrace trace_;
+  std::vector<const dynamixel_hardware_interface::JointState*> trace_states_;
+  std::vector<double> trace_desired_;
+  std::vector<double> trace_actual_;
+
   boost::thread* feedback_thread_;
+  boost::thread* executor_thread_;
   boost::mutex terminate_mutex_;
   bool terminate_;
 
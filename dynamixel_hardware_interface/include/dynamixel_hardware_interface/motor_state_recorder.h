@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MOTOR_STATE_RECORDER_H__
+#define MOTOR_STATE_RECORDER_H__
+
+#include <stdint.h>
+#include <string>
+
+#include <dynamixel_hardware_interface/motor_state_table.h>
+
+namespace dynamixel_hardware_interface
+{
+
+// One motor's state after one feedback cycle, as it is stored in a
+// recording. Records are written as they are in memory, so a recording can
+// only be read back by a build with the same MotorStateSample layout, the
+// file header carries the record size to catch that.
+struct MotorStateRecord
+{
+    uint64_t stamp;     // CLOCK_MONOTONIC nanoseconds the cycle started at
+    uint32_t cycle;     // feedback cycle, every motor of a cycle has the same one
+    int32_t motor_id;
+    MotorStateSample sample;
+};
+
+// Appends records to a ring file that is mapped into memory, so recording a
+// cycle is a copy per motor and never waits on the disk, the kernel writes
+// the pages back on its own. The file is created at its full size up front,
+// once the ring is full the oldest records are overwritten.
+//
+// Only one thread may write. A MotorStateRecording can be opened on the file
+// while it is being written, it sees the records counted at the time, the
+// oldest of which may get overwritten while it reads them.
+class MotorStateRecorder
+{
+public:
+    MotorStateRecorder();
+    ~MotorStateRecorder();
+
+    // creates (or truncates) path to hold capacity records
+    bool open(const std::string& path, size_t capacity);
+    void close();
+    bool isOpen() const;
+
+    void append(uint64_t stamp, uint32_t cycle, int motor_id, const MotorStateSample& sample);
+
+    // records appended since the file was created, including overwritten ones
+    uint64_t getCount() const;
+
+private:
+    int fd_;
+    size_t length_;
+    void* map_;
+    volatile uint64_t* count_;
+    uint64_t capacity_;
+    MotorStateRecord* records_;
+};
+
+// Read side of a file written by MotorStateRecorder, records are numbered
+// from the oldest one still in the ring.
+class MotorStateRecording
+{
+public:
+    MotorStateRecording();
+    ~MotorStateRecording();
+
+    bool open(const std::string& path);
+    void close();
+
+    size_t size() const;
+    const MotorStateRecord& operator[](size_t index) const;
+
+private:
+    int fd_;
+    size_t length_;
+    const void* map_;
+    const MotorStateRecord* records_;
+    uint64_t capacity_;
+    uint64_t first_;
+    size_t size_;
+};
+
+}
+
+#endif  // MOTOR_STATE_RECORDER_H__
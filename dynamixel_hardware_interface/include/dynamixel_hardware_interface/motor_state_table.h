@@ -0,0 +1,149 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef MOTOR_STATE_TABLE_H__
+#define MOTOR_STATE_TABLE_H__
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/MotorState.h>
+#include <dynamixel_hardware_interface/MotorStateList.h>
+
+namespace dynamixel_hardware_interface
+{
+
+// What the last feedback cycle found out about one motor, plain data so that
+// it can be copied in and out of a slot without any allocation.
+struct MotorStateSample
+{
+    DynamixelStatus status;
+    int target_position;
+    int target_velocity;
+    bool alive;
+
+    // number of the feedback cycle that wrote it, 0 if the slot was never written
+    uint32_t cycle;
+};
+
+// fills in every field of state, which is what it is published as
+void copyMotorState(int motor_id, const MotorStateSample& sample, MotorState& state);
+
+// Latest state of every motor on a port, indexed by motor id. SerialProxy is
+// the only writer, controllers in the same process read the slots directly
+// instead of going through the motor_states topic.
+//
+// Every slot is a seqlock: the writer bumps the sequence to odd, writes and
+// bumps it to even again, a reader copies the slot and retries if the
+// sequence was odd or moved while it was copying. Readers never block the
+// writer and never take a lock.
+class MotorStateTable
+{
+public:
+    typedef boost::function<void ()> Listener;
+
+    MotorStateTable();
+
+    // writer side, update the slots of a cycle and then commit() it, which
+    // runs the listeners on the writer's thread
+    void update(int motor_id, const MotorStateSample& sample);
+    void commit();
+
+    // copies the latest sample of motor_id, false if it was never written
+    bool read(int motor_id, MotorStateSample& sample) const;
+    bool read(int motor_id, MotorState& state) const;
+
+    uint32_t getCycle() const;
+
+    // listeners run after every committed cycle until removed, removeListener()
+    // does not return while the listener is running. They hold up the writer's
+    // loop, so they should do no more than hand the cycle over to a thread of
+    // their own
+    int addListener(const Listener& listener);
+    void removeListener(int handle);
+
+private:
+    struct Slot
+    {
+        volatile uint32_t sequence;
+        MotorStateSample sample;
+    };
+
+    Slot slots_[256];
+    volatile uint32_t cycle_;
+
+    boost::mutex listeners_mutex_;
+    std::map<int, Listener> listeners_;
+    int next_listener_;
+};
+
+// Preallocated MotorStateList messages for a publisher that sends a new one
+// every cycle. A buffer is only handed out again once the pool holds the only
+// reference to it, which means the publisher, in-process subscribers and
+// readers of latest() are all done with it, so no one ever sees a message
+// change under them and steady state publishing allocates nothing.
+//
+// The latest message, the one a subscriber may still be working on and the
+// one being filled make three buffers. Should all of them be held the pool
+// grows by one instead of waiting.
+class MotorStatePool
+{
+public:
+    explicit MotorStatePool(size_t buffer_count=3);
+
+    // (re)allocates every buffer for motor_count motors, must not race with
+    // any of the calls below
+    void resize(size_t motor_count);
+
+    // writer side, a message with motor_states sized that no one else
+    // references, fill it in and publish() it
+    MotorStateListPtr acquire();
+    void publish(const MotorStateListPtr& message);
+
+    // reader side, the last published message, NULL before the first one
+    MotorStateListConstPtr latest() const;
+
+    size_t getBufferCount() const;
+
+private:
+    std::vector<MotorStateListPtr> buffers_;
+    size_t next_buffer_;
+    size_t motor_count_;
+
+    mutable boost::mutex latest_mutex_;
+    MotorStateListPtr latest_;
+};
+
+}
+
+#endif  // MOTOR_STATE_TABLE_H__
@@ -33,6 +33,9 @@
 #include <string>
 #include <cmath>
 
+#include <boost/bind.hpp>
+
+#include <dynamixel_hardware_interface/bus_scheduler.h>
 #include <dynamixel_hardware_interface/dynamixel_io.h>
 #include <dynamixel_hardware_interface/single_joint_controller.h>
 #include <dynamixel_hardware_interface/JointState.h>
@@ -84,6 +87,7 @@ public:
 
       port_to_joints_[port_namespace].push_back(joint_name);
       port_to_io_[port_namespace] = deps_[i]->getPort();
+      port_to_scheduler_[port_namespace] = deps_[i]->getBusScheduler();
 
       ROS_DEBUG("Adding joint %s to controller %s on port %s", joint_name.c_str(), name.c_str(), port_namespace.c_str());
     }
@@ -93,13 +97,17 @@ public:
 
   bool setAllComplianceMarginSlope( int compliance_margin, int compliance_slope )
   {
+    bool success = true;
+
     // Loop through every joint
     for( std::vector<std::string>::const_iterator joint_it = joint_names_.begin();
          joint_it < joint_names_.end(); ++joint_it )
     {
-      joint_to_controller_[ *joint_it ]->setComplianceMargin( compliance_margin );
-      joint_to_controller_[ *joint_it ]->setComplianceSlope( compliance_slope );
+      success &= joint_to_controller_[ *joint_it ]->setComplianceMargin( compliance_margin );
+      success &= joint_to_controller_[ *joint_it ]->setComplianceSlope( compliance_slope );
     }
+
+    return success;
   }
 
   virtual void start() = 0;
@@ -122,8 +130,72 @@ protected:
   std::map<std::string, boost::shared_ptr<controller::SingleJointController> > joint_to_controller_;
   std::map<std::string, std::vector<std::string> > port_to_joints_;
   std::map<std::string, dynamixel_hardware_interface::DynamixelIO*> port_to_io_;
+  std::map<std::string, dynamixel_hardware_interface::BusScheduler*> port_to_scheduler_;
   std::map<std::string, const dynamixel_hardware_interface::JointState*> joint_states_;
 
+  // sends position/velocity setpoints to every motor in commands on the given port
+  bool sendMotorCommands(const std::string& port_namespace, const std::vector<std::vector<int> >& commands)
+  {
+    dynamixel_hardware_interface::BusScheduler* bus_scheduler = port_to_scheduler_[port_namespace];
+    boost::function<bool ()> request = makeMotorCommandRequest(port_namespace, commands);
+
+    if (bus_scheduler == NULL) { return request(); }
+    return bus_scheduler->submit(dynamixel_hardware_interface::BusScheduler::SETPOINT, request).get();
+  }
+
+  // same for several ports at once, they are all written to in parallel
+  bool sendMotorCommands(const std::map<std::string, std::vector<std::vector<int> > >& port_commands)
+  {
+    std::map<std::string, std::vector<std::vector<int> > >::const_iterator it;
+
+    for (it = port_commands.begin(); it != port_commands.end(); ++it)
+    {
+      bus_commit_.add(port_to_scheduler_[it->first], makeMotorCommandRequest(it->first, it->second));
+    }
+
+    return bus_commit_.commit();
+  }
+
+  // queues goals that are already in encoder units for one port, nothing is looked up or
+  // converted, commitMotorGoals() or sendMotorGoals() then writes everything queued to all
+  // ports in parallel. goals must stay valid until they are written. Once every port has
+  // been committed to, this path allocates nothing but the odd block of the bus schedulers' queues
+  void queueMotorGoals(dynamixel_hardware_interface::BusScheduler* bus_scheduler,
+                       dynamixel_hardware_interface::DynamixelIO* dxl_io,
+                       const dynamixel_hardware_interface::DynamixelGoal* goals, size_t count)
+  {
+    bus_commit_.addGoals(bus_scheduler, dxl_io, goals, count);
+  }
+
+  bool commitMotorGoals()
+  {
+    return bus_commit_.commit();
+  }
+
+  // same without waiting for the ports to write the goals. They are written by the time
+  // the next goals or commands are queued or sent, or waitMotorGoals() returns
+  void sendMotorGoals()
+  {
+    bus_commit_.send();
+  }
+
+  bool waitMotorGoals()
+  {
+    return bus_commit_.wait();
+  }
+
+private:
+  dynamixel_hardware_interface::BusCommit bus_commit_;
+
+  boost::function<bool ()> makeMotorCommandRequest(const std::string& port_namespace,
+                                                   const std::vector<std::vector<int> >& commands)
+  {
+    typedef bool (dynamixel_hardware_interface::DynamixelIO::*SetMultiFn)(const std::vector<std::vector<int> >&);
+
+    return boost::bind(static_cast<SetMultiFn>(&dynamixel_hardware_interface::DynamixelIO::setMultiPositionVelocity),
+                       port_to_io_[port_namespace], commands);
+  }
+
 };
 
 }
@@ -0,0 +1,54 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef REALTIME_THREAD_H__
+#define REALTIME_THREAD_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+
+namespace dynamixel_hardware_interface
+{
+
+const int64_t NSEC_PER_SEC = 1000000000LL;
+
+void addNsec(struct timespec& ts, int64_t nsec);
+int64_t diffNsec(const struct timespec& later, const struct timespec& earlier);
+
+// Moves deadline on to the next period of a loop that is done with this one
+// at end, and returns how many periods it missed on the way.
+uint64_t advanceDeadline(struct timespec& deadline, int64_t period_nsec, const struct timespec& end);
+
+// Runs the calling thread at SCHED_FIFO priority, if above 0, and pins it to
+// cpu, if not -1. Failures are logged as owner's thread_name thread, false is
+// returned if there were any.
+bool applyRealtimeSettings(const std::string& owner, const char* thread_name, int priority, int cpu);
+
+}
+
+#endif  // REALTIME_THREAD_H__
@@ -34,9 +34,15 @@
 #include <map>
 
 #include <boost/thread.hpp>
+#include <XmlRpcValue.h>
 
+#include <dynamixel_hardware_interface/bus_scheduler.h>
+#include <dynamixel_hardware_interface/bus_statistics.h>
 #include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/motor_state_recorder.h>
+#include <dynamixel_hardware_interface/motor_state_table.h>
 #include <dynamixel_hardware_interface/MotorStateList.h>
+#include <dynamixel_hardware_interface/GetBusStatistics.h>
 
 #include <ros/ros.h>
 #include <diagnostic_updater/update_functions.h>
@@ -55,13 +61,32 @@ public:
                 double update_rate=10,
                 double diagnostics_rate=1,
                 int error_level_temp=65,
-                int warn_level_temp=60);
+                int warn_level_temp=60,
+                int protocol=DXL_PROTOCOL_1,
+                std::string port_options="",
+                int realtime_priority=0,
+                int cpu_affinity=-1,
+                double slow_update_rate=1,
+                int diagnostics_threshold=0,
+                std::string topology_cache="",
+                double scan_timeout=0.01,
+                std::string record_file="",
+                int record_capacity=100000,
+                std::string replay_file="");
 
     ~SerialProxy();
 
     bool connect();
     void disconnect();
-    
+
+    // every request to the port after connect() should go through here
+    BusScheduler* getBusScheduler();
+
+    // latest feedback for controllers in this process, the motor_states
+    // topic carries the same data for everyone else
+    MotorStateTable* getMotorStateTable();
+
+    // NULL when replaying a recording, there is no bus to talk to then
     DynamixelIO* getSerialPort();
 
 private:
@@ -76,11 +101,25 @@ private:
     double diagnostics_rate_;
     int error_level_temp_;
     int warn_level_temp_;
-
-    MotorStateListPtr current_state_;
+    int protocol_;
+    std::string port_options_;
+    int realtime_priority_;     // SCHED_FIFO priority of the feedback and bus threads, 0 leaves them alone
+    int cpu_affinity_;          // CPU to pin them to, -1 for any
+    double slow_update_rate_;   // how often each servo's DXL_FEEDBACK_SLOW registers are read, 0 for every cycle
+    int diagnostics_threshold_; // encoder units position, velocity and load have to move before diagnostics show it
+    std::string topology_cache_;    // file remembering the motors found last time, empty for none
+    double scan_timeout_;           // seconds an unused ID is given to answer while scanning
+    std::string record_file_;       // ring file every cycle's motor states are recorded to, empty for none
+    int record_capacity_;           // motor states the ring file holds
+    std::string replay_file_;       // recording to publish motor states from instead of polling the bus
+
+    MotorStatePool state_pool_;
+    MotorStateRecorder recorder_;
+    MotorStateRecording replay_;
 
     ros::Publisher motor_states_pub_;
     ros::Publisher diagnostics_pub_;
+    ros::ServiceServer bus_statistics_srv_;
 
     boost::thread* feedback_thread_;
     boost::thread* diagnostics_thread_;
@@ -89,14 +128,30 @@ private:
     bool terminate_feedback_;
     bool terminate_diagnostics_;
 
+    // feedback loop timing since the last diagnostics message, in microseconds
+    boost::mutex loop_stats_mutex_;
+    LatencyHistogram wakeup_jitter_;    // how late after its deadline the loop woke up
+    LatencyHistogram cycle_time_;       // how long one cycle took
+    uint64_t overruns_;                 // periods skipped because a cycle ran long
+
     DynamixelIO* dxl_io_;
+    BusScheduler bus_scheduler_;
+    MotorStateTable state_table_;
     std::vector<int> motors_;
     std::map<int, const DynamixelData*> motor_static_info_;
 
-    void fillMotorParameters(const DynamixelData* motor_data);
+    void fillMotorParameters(const DynamixelData* motor_data, XmlRpc::XmlRpcValue& params);
+    bool readTopologyCache(std::map<int, int>& models);
+    void writeTopologyCache();
     bool findMotors();
+    bool applyThreadSettings(const char* thread_name);
+    bool probeMotor(int motor_id);
+    bool startReplay();
     void updateMotorStates();
+    void replayMotorStates();
+    void publishMotorStates(const std::vector<MotorStateSample>& samples);
     void publishDiagnosticInformation();
+    bool processGetBusStatistics(GetBusStatistics::Request& req, GetBusStatistics::Response& res);
     
     diagnostic_updater::FrequencyStatus freq_status_;
 };
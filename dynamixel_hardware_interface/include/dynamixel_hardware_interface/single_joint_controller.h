@@ -33,8 +33,14 @@
 #include <string>
 #include <cmath>
 
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <dynamixel_hardware_interface/bus_scheduler.h>
 #include <dynamixel_hardware_interface/dynamixel_const.h>
 #include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/motor_state_table.h>
 #include <dynamixel_hardware_interface/JointState.h>
 #include <dynamixel_hardware_interface/MotorStateList.h>
 #include <dynamixel_hardware_interface/SetVelocity.h>
@@ -53,7 +59,9 @@ namespace controller
 class SingleJointController
 {
 public:
-  SingleJointController() {};
+  SingleJointController()
+    : bus_scheduler_(NULL), state_table_(NULL), state_listener_(-1),
+      state_thread_(NULL), state_pending_(false), state_stopping_(false) {};
 
   virtual ~SingleJointController() {};
 
@@ -155,7 +163,9 @@ public:
       }
 
       motor_ids_[i] = motor_id;
-      motor_data_[i] = dxl_io_->getCachedParameters(motor_id);
+      boost::function<const dynamixel_hardware_interface::DynamixelData* ()> get_data =
+        boost::bind(&dynamixel_hardware_interface::DynamixelIO::getCachedParameters, dxl_io_, motor_id);
+      motor_data_[i] = bus_scheduler_ ? bus_scheduler_->submit(BusScheduler::HOUSEKEEPING, get_data).get() : get_data();
       if (motor_data_[i] == NULL) { return false; }
 
       // first motor in the list is the master motor from which we take
@@ -243,13 +253,17 @@ public:
 
       // set compliance margins and slopes for all motors controlling this joint to values
       // provided in the configuration or values from the master motor
-      if (!dxl_io_->setComplianceMargins(motor_id, compliance_margin_, compliance_margin_))
+      if (!runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setComplianceMargins, dxl_io_,
+                                motor_id, compliance_margin_, compliance_margin_)))
       {
         ROS_ERROR("%s: unable to set complaince margins for motor %d", name_.c_str(), motor_id);
         return false;
       }
 
-      if (!dxl_io_->setComplianceSlopes(motor_id, compliance_slope_, compliance_slope_))
+      if (!runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setComplianceSlopes, dxl_io_,
+                                motor_id, compliance_slope_, compliance_slope_)))
       {
         ROS_ERROR("%s: unable to set complaince slopes for motor %d", name_.c_str(), motor_id);
         return false;
@@ -262,6 +276,17 @@ public:
   const dynamixel_hardware_interface::JointState& getJointState() { return joint_state_; }
   dynamixel_hardware_interface::DynamixelIO* getPort() { return dxl_io_; }
 
+  // set by the controller manager before initialize(), once set all bus
+  // access of the controller goes through the port's scheduler
+  void setBusScheduler(dynamixel_hardware_interface::BusScheduler* bus_scheduler) { bus_scheduler_ = bus_scheduler; }
+  dynamixel_hardware_interface::BusScheduler* getBusScheduler() { return bus_scheduler_; }
+
+  // set by the controller manager before start(), the controller then reads
+  // its master motor's slot after every feedback cycle instead of subscribing
+  // to motor_states. It does so on a thread of its own, the feedback thread
+  // only wakes it up
+  void setMotorStateTable(dynamixel_hardware_interface::MotorStateTable* state_table) { state_table_ = state_table; }
+
   std::string getName() { return name_; }
   std::string getJointName() { return joint_; }
   std::string getPortNamespace() { return port_namespace_; }
@@ -270,7 +295,18 @@ public:
 
   virtual void start()
   {
-    motor_states_sub_ = nh_.subscribe("motor_states/" + port_namespace_, 50, &SingleJointController::processMotorStates, this);
+    if (state_table_)
+    {
+      state_pending_ = false;
+      state_stopping_ = false;
+      state_thread_ = new boost::thread(boost::bind(&SingleJointController::processStateTable, this));
+      state_listener_ = state_table_->addListener(boost::bind(&SingleJointController::signalStateTable, this));
+    }
+    else
+    {
+      motor_states_sub_ = nh_.subscribe("motor_states/" + port_namespace_, 50, &SingleJointController::processMotorStates, this);
+    }
+
     joint_command_sub_ = c_nh_.subscribe("command", 50, &SingleJointController::processCommand, this);
     joint_state_pub_ = c_nh_.advertise<dynamixel_hardware_interface::JointState>("state", 50);
     joint_velocity_srv_ = c_nh_.advertiseService("set_velocity", &SingleJointController::processSetVelocity, this);
@@ -283,6 +319,25 @@ public:
 
   virtual void stop()
   {
+    if (state_listener_ >= 0)
+    {
+      state_table_->removeListener(state_listener_);
+      state_listener_ = -1;
+    }
+
+    if (state_thread_)
+    {
+      {
+        boost::mutex::scoped_lock lock(state_mutex_);
+        state_stopping_ = true;
+        state_changed_.notify_one();
+      }
+
+      state_thread_->join();
+      delete state_thread_;
+      state_thread_ = NULL;
+    }
+
     motor_states_sub_.shutdown();
     joint_command_sub_.shutdown();
     joint_state_pub_.shutdown();
@@ -315,7 +370,8 @@ public:
       mcv.push_back(pair);
     }
 
-    return dxl_io_->setMultiTorqueEnabled(mcv);
+    return runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiTorqueEnabled, dxl_io_, mcv));
   }
 
   bool processResetOverloadError(std_srvs::Empty::Request& req,
@@ -330,7 +386,8 @@ public:
 
     for (size_t i = 0; i < motor_ids_.size(); ++i)
     {
-      result &= dxl_io_->resetOverloadError(motor_ids_[i]);
+      result &= runOnBus(BusScheduler::HOUSEKEEPING,
+                         boost::bind(&dynamixel_hardware_interface::DynamixelIO::resetOverloadError, dxl_io_, motor_ids_[i]));
     }
 
     return result;
@@ -368,7 +425,8 @@ public:
       mcv.push_back(pair);
     }
 
-    return dxl_io_->setMultiTorqueLimit(mcv);
+    return runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiTorqueLimit, dxl_io_, mcv));
   }
 
 
@@ -394,7 +452,8 @@ public:
       mcv.push_back(pair);
     }
 
-    return dxl_io_->setMultiComplianceMargins(mcv);
+    return runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiComplianceMargins, dxl_io_, mcv));
   }
 
   bool processSetComplianceSlope(dynamixel_hardware_interface::SetComplianceSlope::Request& req,
@@ -419,11 +478,12 @@ public:
       mcv.push_back(pair);
     }
 
-    return dxl_io_->setMultiComplianceSlopes(mcv);
+    return runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiComplianceSlopes, dxl_io_, mcv));
   }
 
   // Monitor state and determine if servos stop responding. if so, show error message and when they come back up re-initialize them
-  void checkPowerFailure(dynamixel_hardware_interface::MotorState &state)
+  void checkPowerFailure(const dynamixel_hardware_interface::MotorState &state)
   {
     if( dead_time_ > TIME_DECLARE_MOTOR_DEAD && state.alive )
     {
@@ -441,7 +501,72 @@ public:
 
   virtual std::vector<std::vector<int> > getRawMotorCommands(double position, double velocity) = 0;
 
-  virtual void processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg) = 0;
+  // the same as goals, one per motor, for the trajectory executor to call on every streamed
+  // setpoint. Controllers that can fill them in without allocating override it
+  virtual void getRawMotorGoals(double position, double velocity, dynamixel_hardware_interface::DynamixelGoal* goals)
+  {
+    std::vector<std::vector<int> > commands = getRawMotorCommands(position, velocity);
+
+    for (size_t i = 0; i < commands.size(); ++i)
+    {
+      goals[i].id = commands[i][0];
+      goals[i].position = commands[i][1];
+      goals[i].velocity = commands[i][2];
+    }
+  }
+
+  void processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg)
+  {
+    int master_id = motor_ids_[0];
+
+    for (size_t i = 0; i < msg->motor_states.size(); ++i)
+    {
+      if (master_id == msg->motor_states[i].id)
+      {
+        processMotorState(msg->motor_states[i]);
+        return;
+      }
+    }
+
+    ROS_ERROR("%s: motor %d not found in motor states message", name_.c_str(), master_id);
+  }
+
+  // runs on the feedback thread after every cycle, which must not wait for
+  // the joint state to be published or for anything the controller sends
+  void signalStateTable()
+  {
+    boost::mutex::scoped_lock lock(state_mutex_);
+    state_pending_ = true;
+    state_changed_.notify_one();
+  }
+
+  // the controller's own thread, it processes the latest cycle whenever
+  // there is a new one, those that came while it was busy are skipped
+  void processStateTable()
+  {
+    dynamixel_hardware_interface::MotorState state;
+
+    while (true)
+    {
+      {
+        boost::mutex::scoped_lock lock(state_mutex_);
+        while (!state_pending_ && !state_stopping_) { state_changed_.wait(lock); }
+        if (state_stopping_) { return; }
+        state_pending_ = false;
+      }
+
+      if (!state_table_->read(motor_ids_[0], state))
+      {
+        ROS_ERROR("%s: motor %d not found in motor state table", name_.c_str(), motor_ids_[0]);
+        continue;
+      }
+
+      processMotorState(state);
+    }
+  }
+
+  // called with the master motor's state after every feedback cycle
+  virtual void processMotorState(const dynamixel_hardware_interface::MotorState& state) = 0;
   virtual void processCommand(const std_msgs::Float64ConstPtr& msg) = 0;
 
   virtual bool setVelocity(double velocity) = 0;
@@ -449,12 +574,23 @@ public:
                                   dynamixel_hardware_interface::SetVelocity::Request& res) = 0;
 
 protected:
+  typedef dynamixel_hardware_interface::BusScheduler BusScheduler;
+
   ros::NodeHandle nh_;
   ros::NodeHandle c_nh_;
 
   std::string name_;
   std::string port_namespace_;
   dynamixel_hardware_interface::DynamixelIO* dxl_io_;
+  dynamixel_hardware_interface::BusScheduler* bus_scheduler_;
+  dynamixel_hardware_interface::MotorStateTable* state_table_;
+  int state_listener_;
+
+  boost::thread* state_thread_;
+  boost::mutex state_mutex_;
+  boost::condition_variable state_changed_;
+  bool state_pending_;                // a cycle was committed since the thread last looked
+  bool state_stopping_;
 
   std::string joint_;
   dynamixel_hardware_interface::JointState joint_state_;
@@ -510,6 +646,13 @@ protected:
     return angle_in_radians * radians_per_encoder_tick_;
   }
 
+  // queues the request behind the port's higher priority traffic and waits for it
+  bool runOnBus(BusScheduler::Priority priority, const boost::function<bool ()>& request)
+  {
+    if (bus_scheduler_ == NULL) { return request(); }
+    return bus_scheduler_->submit(priority, request).get();
+  }
+
 private:
   SingleJointController(const SingleJointController &c);
   SingleJointController& operator =(const SingleJointController &c);
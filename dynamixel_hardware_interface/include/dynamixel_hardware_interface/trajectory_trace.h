@@ -0,0 +1,98 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TRAJECTORY_TRACE_H__
+#define TRAJECTORY_TRACE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+namespace dynamixel_hardware_interface
+{
+
+// Start of every trace record, followed by the desired position, actual
+// position and position error of each joint, in that order, as doubles.
+struct TraceRecordHeader
+{
+    uint64_t stamp;     // CLOCK_MONOTONIC nanoseconds of the control tick
+    uint64_t sequence;  // counts every push, a gap means records were dropped
+};
+
+// Binary trace of how closely a controller's joints follow their trajectory.
+// The control loop pushes one fixed-size record per tick into a ring that is
+// allocated when the trace is opened, a copy of a few doubles that never
+// waits on anything, a thread of the trace's own writes the ring out to the
+// file. When the writer falls behind and the ring fills up new records are
+// dropped, the control loop is never held up.
+//
+// Only one thread may push. scripts/trace_to_csv.py converts a trace to CSV.
+class TrajectoryTrace
+{
+public:
+    TrajectoryTrace();
+    ~TrajectoryTrace();
+
+    // creates (or truncates) path and starts the writer, the ring holds capacity records
+    bool open(const std::string& path, const std::vector<std::string>& joint_names, size_t capacity);
+
+    // writes out what is left in the ring and stops the writer
+    void close();
+    bool isOpen() const;
+
+    // false if the ring was full and the record was dropped
+    bool push(uint64_t stamp, const double* desired, const double* actual);
+
+    // records dropped since the trace was opened
+    uint64_t getDropped() const;
+
+private:
+    void writeRecords();
+    void drain();
+
+    int fd_;
+    std::string path_;
+    size_t joint_count_;
+    size_t record_size_;
+    size_t capacity_;
+    std::vector<char> ring_;
+
+    volatile uint64_t head_;    // records pushed, only the control loop moves it
+    volatile uint64_t tail_;    // records written, only the writer moves it
+    uint64_t sequence_;
+    volatile uint64_t dropped_;
+    bool failed_;               // a write failed, the rest of the trace is discarded
+
+    volatile bool stopping_;
+    boost::thread* writer_thread_;
+};
+
+}
+
+#endif  // TRAJECTORY_TRACE_H__
@@ -490,6 +490,8 @@ BOOST_PYTHON_MODULE(dynamixel_io)
     
     class_<DynamixelStatus> ("DynamixelStatus")
         .def_readwrite("timestamp", &DynamixelStatus::timestamp)
+        .def_readwrite("fast_timestamp", &DynamixelStatus::fast_timestamp)
+        .def_readwrite("slow_timestamp", &DynamixelStatus::slow_timestamp)
         .def_readwrite("torque_limit", &DynamixelStatus::torque_limit)
         .def_readwrite("position", &DynamixelStatus::position)
         .def_readwrite("velocity", &DynamixelStatus::velocity)
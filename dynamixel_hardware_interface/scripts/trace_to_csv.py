@@ -0,0 +1,133 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Software License Agreement (BSD License)
+#
+# Copyright (c) 2010-2011, Antons Rebguns.
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions
+# are met:
+#
+#  * Redistributions of source code must retain the above copyright
+#    notice, this list of conditions and the following disclaimer.
+#  * Redistributions in binary form must reproduce the above
+#    copyright notice, this list of conditions and the following
+#    disclaimer in the documentation and/or other materials provided
+#    with the distribution.
+#  * Neither the name of University of Arizona nor the names of its
+#    contributors may be used to endorse or promote products derived
+#    from this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+# "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+# LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+# FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+# COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+# INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+# LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+# CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+# LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+# ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+
+
+__author__ = 'Antons Rebguns'
+__copyright__ = 'Copyright (c) 2010-2011 Antons Rebguns'
+
+__license__ = 'BSD'
+__maintainer__ = 'Antons Rebguns'
+__email__ = 'anton@email.arizona.edu'
+
+
+import struct
+import sys
+from optparse import OptionParser
+
+TRACE_MAGIC = 'DXLTRACE'
+TRACE_VERSION = 1
+
+# magic, version, joint count, record size, size of the joint names
+HEADER = struct.Struct('<8sIIII')
+
+
+def convert(trace, out, relative):
+    ''' Writes every record of a trajectory trace as a CSV line, returns the
+        number of records written and the number the controller dropped.
+    '''
+    header = trace.read(HEADER.size)
+    if len(header) < HEADER.size:
+        raise ValueError('file is too short to be a trajectory trace')
+
+    magic, version, joint_count, record_size, names_size = HEADER.unpack(header)
+    if magic.decode('ascii', 'replace') != TRACE_MAGIC:
+        raise ValueError('not a trajectory trace')
+    if version != TRACE_VERSION:
+        raise ValueError('trace version %d, expecting %d' % (version, TRACE_VERSION))
+
+    # stamp in CLOCK_MONOTONIC nanoseconds, sequence, then desired, actual and error of each joint
+    record = struct.Struct('<QQ%dd' % (3 * joint_count))
+    if record.size != record_size:
+        raise ValueError('records are %d bytes, expecting %d' % (record_size, record.size))
+
+    names = trace.read(names_size).decode('utf-8').split('\0')[:joint_count]
+
+    columns = ['time', 'sequence']
+    for name in names:
+        columns += [name + '_desired', name + '_actual', name + '_error']
+    out.write(','.join(columns) + '\n')
+
+    written = 0
+    dropped = 0
+    first_stamp = None
+    last_sequence = None
+
+    while True:
+        data = trace.read(record_size)
+        if len(data) < record_size:
+            break   # end of the trace, or a record still being written
+
+        values = record.unpack(data)
+        stamp, sequence = values[0], values[1]
+
+        if first_stamp is None:
+            first_stamp = stamp if relative else 0
+        if last_sequence is not None:
+            dropped += sequence - last_sequence - 1
+        last_sequence = sequence
+
+        line = ['%.9f' % ((stamp - first_stamp) / 1e9), str(sequence)]
+        line += ['%.6f' % v for v in values[2:]]
+        out.write(','.join(line) + '\n')
+        written += 1
+
+    return written, dropped
+
+
+if __name__ == '__main__':
+    parser = OptionParser(usage='Usage: %prog [options] TRACE [CSV]',
+                          description='Converts a joint trajectory controller trace to CSV, one line per control tick.')
+    parser.add_option('-a', '--absolute', action='store_true', default=False,
+                      help='print CLOCK_MONOTONIC times instead of seconds since the first record')
+
+    (options, args) = parser.parse_args(sys.argv)
+
+    if len(args) < 2 or len(args) > 3:
+        parser.print_help()
+        exit(1)
+
+    trace = open(args[1], 'rb')
+    out = open(args[2], 'w') if len(args) == 3 else sys.stdout
+
+    try:
+        written, dropped = convert(trace, out, not options.absolute)
+    except ValueError as e:
+        sys.stderr.write('%s: %s\n' % (args[1], e))
+        exit(1)
+
+    sys.stderr.write('%d records' % written)
+    if dropped:
+        sys.stderr.write(', %d dropped by the controller' % dropped)
+    sys.stderr.write('\n')
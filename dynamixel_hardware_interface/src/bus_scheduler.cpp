@@ -0,0 +1,405 @@
+// Author: Antons Rebguns
+
+#include <time.h>
+
+#include <algorithm>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <clam/gearbox/flexiport/flexiport.h>
+
+#include <dynamixel_hardware_interface/bus_scheduler.h>
+
+#include <ros/ros.h>
+
+namespace dynamixel_hardware_interface
+{
+
+namespace
+{
+
+double nowUsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1.0e6 + ts.tv_nsec / 1.0e3;
+}
+
+}
+
+BusScheduler::BusScheduler()
+  :bus_thread_(NULL),
+   terminate_(false),
+   stopped_(false)
+{
+  for (int i = 0; i < NUM_PRIORITIES; ++i)
+  {
+    latency_count_[i] = 0;
+    latency_sum_usec_[i] = 0.0;
+    latency_max_usec_[i] = 0.0;
+  }
+}
+
+BusScheduler::~BusScheduler()
+{
+  stop();
+}
+
+void BusScheduler::start()
+{
+  if (bus_thread_) { return; }
+
+  terminate_ = false;
+  stopped_ = false;
+  bus_thread_ = new boost::thread(boost::bind(&BusScheduler::processRequests, this));
+}
+
+void BusScheduler::stop()
+{
+  if (!bus_thread_) { return; }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    terminate_ = true;
+  }
+
+  request_ready_.notify_one();
+  bus_thread_->join();
+
+  delete bus_thread_;
+  bus_thread_ = NULL;
+}
+
+void BusScheduler::post(Priority priority,
+                        const boost::function<bool ()>& request,
+                        const boost::function<void (bool)>& done)
+{
+  if (!enqueue(priority, boost::bind(&BusScheduler::runAndNotify, request, done)))
+  {
+    runAndNotify(request, done);
+  }
+}
+
+BusLatency BusScheduler::getLatency(Priority priority, bool reset)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+
+  BusLatency latency;
+  latency.count = latency_count_[priority];
+  latency.mean_usec = latency.count ? latency_sum_usec_[priority] / latency.count : 0.0;
+  latency.max_usec = latency_max_usec_[priority];
+
+  if (reset)
+  {
+    latency_count_[priority] = 0;
+    latency_sum_usec_[priority] = 0.0;
+    latency_max_usec_[priority] = 0.0;
+  }
+
+  return latency;
+}
+
+const char* BusScheduler::getPriorityName(Priority priority)
+{
+  switch (priority)
+  {
+    case SETPOINT:
+      return "Setpoint";
+    case FEEDBACK:
+      return "Feedback";
+    case HOUSEKEEPING:
+      return "Housekeeping";
+    default:
+      return "Unknown";
+  }
+}
+
+bool BusScheduler::enqueue(Priority priority, const boost::function<void ()>& run)
+{
+  Request request;
+  request.run = run;
+  request.enqueue_time_usec = nowUsec();
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // nothing would ever take it off the queue
+    if (stopped_) { return false; }
+
+    queues_[priority].push_back(request);
+  }
+
+  request_ready_.notify_one();
+  return true;
+}
+
+bool BusScheduler::dequeue(Priority priority, Request& request)
+{
+  double now_usec = nowUsec();
+  boost::mutex::scoped_lock lock(mutex_);
+
+  if (queues_[priority].empty()) { return false; }
+
+  request = queues_[priority].front();
+  queues_[priority].pop_front();
+
+  double waited_usec = now_usec - request.enqueue_time_usec;
+  latency_count_[priority] += 1;
+  latency_sum_usec_[priority] += waited_usec;
+  latency_max_usec_[priority] = std::max(latency_max_usec_[priority], waited_usec);
+
+  return true;
+}
+
+bool BusScheduler::pending()
+{
+  for (int i = 0; i < NUM_PRIORITIES; ++i)
+  {
+    if (!queues_[i].empty()) { return true; }
+  }
+
+  return false;
+}
+
+void BusScheduler::processRequests()
+{
+  Request request;
+
+  while (true)
+  {
+    size_t budget[NUM_PRIORITIES];
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!terminate_ && !pending()) { request_ready_.wait(lock); }
+      if (terminate_ && !pending())
+      {
+        stopped_ = true;
+        break;
+      }
+
+      // a class only gets what was queued when the pass started, so a client
+      // resubmitting in a tight loop can not starve the classes after it
+      budget[SETPOINT] = queues_[SETPOINT].size();
+      budget[FEEDBACK] = queues_[FEEDBACK].size();
+      budget[HOUSEKEEPING] = std::min<size_t>(1, queues_[HOUSEKEEPING].size());
+    }
+
+    for (int p = 0; p < NUM_PRIORITIES; ++p)
+    {
+      for (size_t i = 0; i < budget[p] && dequeue((Priority) p, request); ++i)
+      {
+        request.run();
+
+        // setpoints that arrived meanwhile go ahead of the rest of the pass
+        while (p != SETPOINT && dequeue(SETPOINT, request)) { request.run(); }
+      }
+    }
+  }
+}
+
+void BusScheduler::runAndNotify(const boost::function<bool ()>& request, const boost::function<void (bool)>& done)
+{
+  bool success = false;
+
+  try
+  {
+    success = request();
+  }
+  catch (flexiport::PortException pex)
+  {
+    ROS_ERROR("%s", pex.what());
+  }
+
+  if (done) { done(success); }
+}
+
+boost::mutex BusCommit::submit_mutex_;
+
+BusCommit::BusCommit()
+  : used_(0),
+    arrived_(0),
+    scheduled_(0),
+    running_(0),
+    success_(true),
+    sent_(false),
+    sent_success_(true)
+{
+}
+
+BusCommit::~BusCommit()
+{
+  wait();
+}
+
+void BusCommit::add(BusScheduler* scheduler, const boost::function<bool ()>& request)
+{
+  if (sent_) { wait(); }
+
+  Request r;
+  r.run = request;
+  r.dxl_io = NULL;
+  r.goals = NULL;
+  r.count = 0;
+
+  findPort(scheduler).requests.push_back(r);
+}
+
+void BusCommit::addGoals(BusScheduler* scheduler, DynamixelIO* dxl_io, const DynamixelGoal* goals, size_t count)
+{
+  if (sent_) { wait(); }
+
+  Request r;
+  r.dxl_io = dxl_io;
+  r.goals = goals;
+  r.count = count;
+
+  findPort(scheduler).requests.push_back(r);
+}
+
+void BusCommit::send()
+{
+  // nothing was added since the last send, which may still be on its way
+  if (sent_) { wait(); }
+
+  size_t scheduled = 0;
+
+  // the gate stays shut until it is known how many bus threads will turn up,
+  // a stopped scheduler refuses its port and send() runs it instead
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    arrived_ = 0;
+    scheduled_ = (size_t) -1;
+    running_ = 0;
+    success_ = true;
+  }
+
+  // the bound functor is a function pointer and a pointer, small enough for
+  // boost::function to hold without allocating
+  {
+    boost::mutex::scoped_lock submit_lock(submit_mutex_);
+
+    for (size_t i = 0; i < used_; ++i)
+    {
+      Port& port = ports_[i];
+      port.queued = port.scheduler &&
+                    port.scheduler->enqueue(BusScheduler::SETPOINT, boost::bind(&BusCommit::runPort, &port));
+      if (port.queued) { ++scheduled; }
+    }
+  }
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    scheduled_ = scheduled;
+    running_ = scheduled;
+    if (arrived_ == scheduled_) { changed_.notify_all(); }
+  }
+
+  sent_success_ = true;
+
+  for (size_t i = 0; i < used_; ++i)
+  {
+    if (!ports_[i].queued) { sent_success_ &= runRequests(ports_[i].requests); }
+  }
+
+  sent_ = true;
+}
+
+bool BusCommit::wait()
+{
+  if (!sent_) { return true; }
+
+  bool success = sent_success_;
+
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (running_ > 0) { changed_.wait(lock); }
+    success &= success_;
+  }
+
+  used_ = 0;
+  sent_ = false;
+  return success;
+}
+
+bool BusCommit::commit()
+{
+  send();
+  return wait();
+}
+
+BusCommit::Port& BusCommit::findPort(BusScheduler* scheduler)
+{
+  // a port's requests run back to back on its bus thread, which can only
+  // wait for the others once
+  for (size_t i = 0; i < used_; ++i)
+  {
+    if (ports_[i].scheduler == scheduler) { return ports_[i]; }
+  }
+
+  if (used_ == ports_.size())
+  {
+    ports_.resize(used_ + 1);
+  }
+
+  Port& port = ports_[used_++];
+  port.scheduler = scheduler;
+  port.requests.clear();
+  port.commit = this;
+  port.queued = false;
+  return port;
+}
+
+bool BusCommit::runRequests(const std::vector<Request>& requests)
+{
+  bool success = true;
+
+  for (size_t i = 0; i < requests.size(); ++i)
+  {
+    const Request& r = requests[i];
+
+    try
+    {
+      success &= r.run ? r.run() : r.dxl_io->setMultiPositionVelocity(r.goals, r.count);
+    }
+    catch (flexiport::PortException pex)
+    {
+      ROS_ERROR("%s", pex.what());
+      success = false;
+    }
+    catch (std::exception& e)
+    {
+      // the other ports are waiting for this one to finish
+      ROS_ERROR("%s", e.what());
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+void BusCommit::runPort(Port* port)
+{
+  BusCommit* commit = port->commit;
+
+  // whichever bus gets here first waits for the others to finish what they
+  // were in the middle of
+  {
+    boost::mutex::scoped_lock lock(commit->mutex_);
+    if (++commit->arrived_ == commit->scheduled_) { commit->changed_.notify_all(); }
+    while (commit->arrived_ < commit->scheduled_) { commit->changed_.wait(lock); }
+  }
+
+  bool success = runRequests(port->requests);
+
+  boost::mutex::scoped_lock lock(commit->mutex_);
+  commit->success_ &= success;
+  if (--commit->running_ == 0) { commit->changed_.notify_all(); }
+}
+
+}
@@ -0,0 +1,267 @@
+// Author: Antons Rebguns
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <dynamixel_hardware_interface/bus_statistics.h>
+#include <dynamixel_hardware_interface/dynamixel_const.h>
+
+namespace dynamixel_hardware_interface
+{
+
+namespace
+{
+
+// 64 bit loads and stores are not atomic on every target we run on, the
+// builtins are
+inline void atomicAdd(uint64_t& counter, uint64_t value)
+{
+  __sync_fetch_and_add(&counter, value);
+}
+
+inline uint64_t atomicLoad(const uint64_t& counter)
+{
+  return __sync_fetch_and_add(const_cast<uint64_t*>(&counter), 0);
+}
+
+inline void atomicClear(uint64_t& counter)
+{
+  __sync_fetch_and_and(&counter, 0);
+}
+
+inline void atomicMax(uint64_t& counter, uint64_t value)
+{
+  uint64_t current = atomicLoad(counter);
+
+  while (value > current && !__sync_bool_compare_and_swap(&counter, current, value))
+  {
+    current = atomicLoad(counter);
+  }
+}
+
+}
+
+int LatencyHistogram::bucketIndex(uint64_t usec)
+{
+  if (usec < 4) { return usec; }
+
+  // position of the highest bit picks the power of two, the two bits below
+  // it the quarter within
+  int msb = 63 - __builtin_clzll(usec);
+  int index = 4 * (msb - 1) + ((usec >> (msb - 2)) & 3);
+
+  return std::min(index, DXL_LATENCY_BUCKETS - 1);
+}
+
+double LatencyHistogram::bucketLowerBound(int index)
+{
+  if (index < 4) { return index; }
+
+  int msb = index / 4 + 1;
+  return (double) ((4 + index % 4) << (msb - 2));
+}
+
+void LatencyHistogram::record(uint64_t usec)
+{
+  ++buckets[bucketIndex(usec)];
+  ++count;
+  total_usec += usec;
+  max_usec = std::max(max_usec, usec);
+}
+
+void LatencyHistogram::clear()
+{
+  memset(this, 0, sizeof(*this));
+}
+
+double LatencyHistogram::mean() const
+{
+  return count > 0 ? total_usec / (double) count : 0.0;
+}
+
+double LatencyHistogram::percentile(double fraction) const
+{
+  if (count == 0) { return 0.0; }
+
+  uint64_t rank = std::max<uint64_t>(1, (uint64_t) ceil(fraction * count));
+  uint64_t seen = 0;
+
+  for (int i = 0; i < DXL_LATENCY_BUCKETS; ++i)
+  {
+    seen += buckets[i];
+
+    if (seen >= rank)
+    {
+      double upper = (i + 1 < DXL_LATENCY_BUCKETS) ? bucketLowerBound(i + 1) : max_usec;
+      return std::min(upper, (double) max_usec);
+    }
+  }
+
+  return max_usec;
+}
+
+uint64_t BusStatistics::Counters::failures() const
+{
+  uint64_t sum = 0;
+
+  for (int i = 0; i < NUM_OUTCOMES; ++i)
+  {
+    if (i != RESPONSE) { sum += outcomes[i]; }
+  }
+
+  return sum;
+}
+
+void BusStatistics::Counters::subtract(const Counters& earlier)
+{
+  requests -= earlier.requests;
+  for (int i = 0; i < NUM_OUTCOMES; ++i) { outcomes[i] -= earlier.outcomes[i]; }
+  for (int i = 0; i < DXL_ERROR_BITS; ++i) { error_bits[i] -= earlier.error_bits[i]; }
+
+  latency.count -= earlier.latency.count;
+  latency.total_usec -= earlier.latency.total_usec;
+
+  double top = 0.0;
+
+  for (int i = 0; i < DXL_LATENCY_BUCKETS; ++i)
+  {
+    latency.buckets[i] -= earlier.latency.buckets[i];
+
+    if (latency.buckets[i] > 0)
+    {
+      top = (i + 1 < DXL_LATENCY_BUCKETS) ? LatencyHistogram::bucketLowerBound(i + 1) : latency.max_usec;
+    }
+  }
+
+  latency.max_usec = std::min<uint64_t>(latency.max_usec, top);
+}
+
+BusStatistics::BusStatistics()
+{
+  memset(&total_, 0, sizeof(total_));
+  memset(instructions_, 0, sizeof(instructions_));
+  memset(motors_, 0, sizeof(motors_));
+}
+
+void BusStatistics::countRequest(int servo_id, int instruction)
+{
+  atomicAdd(total_.requests, 1);
+  atomicAdd(instructions_[classify(instruction)].requests, 1);
+
+  if (servo_id != DXL_BROADCAST) { atomicAdd(motors_[servo_id & 0xFF].requests, 1); }
+}
+
+void BusStatistics::countResponse(int servo_id, int instruction, Outcome outcome, uint64_t latency_usec, uint8_t error)
+{
+  add(total_, outcome, latency_usec, error);
+  add(instructions_[classify(instruction)], outcome, latency_usec, error);
+  add(motors_[servo_id & 0xFF], outcome, latency_usec, error);
+}
+
+void BusStatistics::getTotal(Counters& counters) const
+{
+  copy(total_, counters);
+}
+
+void BusStatistics::getInstruction(InstructionClass instruction, Counters& counters) const
+{
+  copy(instructions_[instruction], counters);
+}
+
+void BusStatistics::getMotor(int servo_id, Counters& counters) const
+{
+  copy(motors_[servo_id & 0xFF], counters);
+}
+
+void BusStatistics::reset()
+{
+  clear(total_);
+  for (int i = 0; i < NUM_INSTRUCTION_CLASSES; ++i) { clear(instructions_[i]); }
+  for (int i = 0; i < 256; ++i) { clear(motors_[i]); }
+}
+
+BusStatistics::InstructionClass BusStatistics::classify(int instruction)
+{
+  switch (instruction)
+  {
+    case DXL_PING:       return PING;
+    case DXL_READ_DATA:  return READ;
+    case DXL_WRITE_DATA: return WRITE;
+    case DXL_SYNC_WRITE: return SYNC_WRITE;
+    case DXL_BULK_READ:
+    case DXL_SYNC_READ:  return MULTI_READ;
+    default:             return OTHER;
+  }
+}
+
+const char* BusStatistics::getInstructionName(InstructionClass instruction)
+{
+  switch (instruction)
+  {
+    case PING:       return "Ping";
+    case READ:       return "Read";
+    case WRITE:      return "Write";
+    case SYNC_WRITE: return "Sync Write";
+    case MULTI_READ: return "Multi Read";
+    default:         return "Other";
+  }
+}
+
+const char* BusStatistics::getOutcomeName(Outcome outcome)
+{
+  switch (outcome)
+  {
+    case RESPONSE:         return "Responses";
+    case HEADER_TIMEOUT:   return "Header Timeouts";
+    case PAYLOAD_TIMEOUT:  return "Payload Timeouts";
+    case CHECKSUM_FAILURE: return "Checksum Failures";
+    case BAD_HEADER:       return "Bad Headers";
+    default:               return "Unknown";
+  }
+}
+
+void BusStatistics::add(Counters& counters, Outcome outcome, uint64_t latency_usec, uint8_t error)
+{
+  atomicAdd(counters.outcomes[outcome], 1);
+
+  // a timeout's latency is just the timeout
+  if (outcome != RESPONSE) { return; }
+
+  for (int i = 0; i < DXL_ERROR_BITS; ++i)
+  {
+    if (error & (1 << i)) { atomicAdd(counters.error_bits[i], 1); }
+  }
+
+  LatencyHistogram& latency = counters.latency;
+  atomicAdd(latency.buckets[LatencyHistogram::bucketIndex(latency_usec)], 1);
+  atomicAdd(latency.count, 1);
+  atomicAdd(latency.total_usec, latency_usec);
+  atomicMax(latency.max_usec, latency_usec);
+}
+
+void BusStatistics::copy(const Counters& from, Counters& to)
+{
+  to.requests = atomicLoad(from.requests);
+  for (int i = 0; i < NUM_OUTCOMES; ++i) { to.outcomes[i] = atomicLoad(from.outcomes[i]); }
+  for (int i = 0; i < DXL_ERROR_BITS; ++i) { to.error_bits[i] = atomicLoad(from.error_bits[i]); }
+  for (int i = 0; i < DXL_LATENCY_BUCKETS; ++i) { to.latency.buckets[i] = atomicLoad(from.latency.buckets[i]); }
+  to.latency.count = atomicLoad(from.latency.count);
+  to.latency.total_usec = atomicLoad(from.latency.total_usec);
+  to.latency.max_usec = atomicLoad(from.latency.max_usec);
+}
+
+void BusStatistics::clear(Counters& counters)
+{
+  atomicClear(counters.requests);
+  for (int i = 0; i < NUM_OUTCOMES; ++i) { atomicClear(counters.outcomes[i]); }
+  for (int i = 0; i < DXL_ERROR_BITS; ++i) { atomicClear(counters.error_bits[i]); }
+  for (int i = 0; i < DXL_LATENCY_BUCKETS; ++i) { atomicClear(counters.latency.buckets[i]); }
+  atomicClear(counters.latency.count);
+  atomicClear(counters.latency.total_usec);
+  atomicClear(counters.latency.max_usec);
+}
+
+}
@@ -72,6 +72,7 @@ ControllerManager::ControllerManager() : nh_(ros::NodeHandle()), private_nh_(ros
 
   std::string port_namespace;
   XmlRpc::XmlRpcValue::iterator it;
+  std::map<int, std::string> cpu_to_port;
 
   for (it = serial_ports.begin(); it != serial_ports.end(); ++it)
   {
@@ -91,9 +92,49 @@ ControllerManager::ControllerManager() : nh_(ros::NodeHandle()), private_nh_(ros
     int max_motor_id;
     private_nh_.param<int>(prefix + "max_motor_id", max_motor_id, 25);
 
+    double scan_timeout;
+    private_nh_.param<double>(prefix + "scan_timeout", scan_timeout, 0.01);
+
+    std::string topology_cache;
+    private_nh_.param<std::string>(prefix + "topology_cache", topology_cache, "");
+
     int update_rate;
     private_nh_.param<int>(prefix + "update_rate", update_rate, 10);
 
+    double slow_update_rate;
+    private_nh_.param<double>(prefix + "slow_update_rate", slow_update_rate, 1.0);
+
+    int protocol;
+    private_nh_.param<int>(prefix + "protocol", protocol, dynamixel_hardware_interface::DXL_PROTOCOL_1);
+
+    std::string port_options;
+    private_nh_.param<std::string>(prefix + "port_options", port_options, "");
+
+    int realtime_priority;
+    private_nh_.param<int>(prefix + "realtime_priority", realtime_priority, 0);
+
+    int cpu_affinity;
+    private_nh_.param<int>(prefix + "cpu_affinity", cpu_affinity, -1);
+
+    // every port has a bus thread of its own, pinned to the same CPU they
+    // would take turns instead of running side by side
+    if (cpu_affinity >= 0 && cpu_to_port.find(cpu_affinity) != cpu_to_port.end())
+    {
+      ROS_WARN("Serial ports %s and %s are both pinned to CPU %d, they will not run in parallel",
+               cpu_to_port[cpu_affinity].c_str(), port_namespace.c_str(), cpu_affinity);
+    }
+
+    if (cpu_affinity >= 0) { cpu_to_port[cpu_affinity] = port_namespace; }
+
+    std::string replay_file;
+    private_nh_.param<std::string>(prefix + "replay_file", replay_file, "");
+
+    std::string record_file;
+    private_nh_.param<std::string>(prefix + "recording/file", record_file, "");
+
+    int record_capacity;
+    private_nh_.param<int>(prefix + "recording/capacity", record_capacity, 100000);
+
     prefix += "diagnostics/";
 
     int error_level_temp;
@@ -102,6 +143,9 @@ ControllerManager::ControllerManager() : nh_(ros::NodeHandle()), private_nh_(ros
     int warn_level_temp;
     private_nh_.param<int>(prefix + "warn_level_temp", warn_level_temp, 60);
 
+    int change_threshold;
+    private_nh_.param<int>(prefix + "change_threshold", change_threshold, 0);
+
     dynamixel_hardware_interface::SerialProxy* serial_proxy =
       new dynamixel_hardware_interface::SerialProxy(port_name,
                                                     port_namespace,
@@ -111,7 +155,18 @@ ControllerManager::ControllerManager() : nh_(ros::NodeHandle()), private_nh_(ros
                                                     update_rate,
                                                     diagnostics_rate_,
                                                     error_level_temp,
-                                                    warn_level_temp);
+                                                    warn_level_temp,
+                                                    protocol,
+                                                    port_options,
+                                                    realtime_priority,
+                                                    cpu_affinity,
+                                                    slow_update_rate,
+                                                    change_threshold,
+                                                    topology_cache,
+                                                    scan_timeout,
+                                                    record_file,
+                                                    record_capacity,
+                                                    replay_file);
     if (!serial_proxy->connect())
     {
       delete serial_proxy;
@@ -226,6 +281,12 @@ bool ControllerManager::startController(std::string name, std::string port)
       return false;
     }
 
+    if (serial_proxies_[port]->getSerialPort() == NULL)
+    {
+      ROS_ERROR("Serial port %s is replaying recorded motor states, controller %s needs the real bus", port.c_str(), name.c_str());
+      return false;
+    }
+
     if (sj_controllers_.find(name) != sj_controllers_.end())
     {
       ROS_ERROR("Controller %s is already started", name.c_str());
@@ -267,6 +328,8 @@ bool ControllerManager::startController(std::string name, std::string port)
 
     try
     {
+      sjc->setBusScheduler(serial_proxies_[port]->getBusScheduler());
+      sjc->setMotorStateTable(serial_proxies_[port]->getMotorStateTable());
       initialized = sjc->initialize(name, port, serial_proxies_[port]->getSerialPort());
     }
     catch(std::exception &e)
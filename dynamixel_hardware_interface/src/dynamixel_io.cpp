@@ -29,7 +29,10 @@
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include <algorithm>
 #include <sstream>
 #include <map>
 #include <set>
@@ -47,7 +50,10 @@ namespace dynamixel_hardware_interface
 {
 
 DynamixelIO::DynamixelIO(std::string device="/dev/ttyUSB0",
-                         std::string baud="1000000")
+                         std::string baud="1000000",
+                         int protocol,
+                         std::string port_options)
+    : response_timeout_(0, 50000)
 {
     std::map<std::string, std::string> options;
     options["type"] = "serial";
@@ -55,12 +61,32 @@ DynamixelIO::DynamixelIO(std::string device="/dev/ttyUSB0",
     options["alwaysopen"] = "true";
     options["device"] = device;
     options["baud"] = baud;
+
+    // space separated key=value pairs, as flexiport::CreatePort() takes them
+    std::istringstream extra(port_options);
+    std::string option;
+    while (extra >> option)
+    {
+        size_t split = option.find('=');
+        if (split == std::string::npos) { options[option] = "1"; }
+        else { options[option.substr(0, split)] = option.substr(split + 1); }
+    }
     
-    read_count = 0;
-    read_error_count = 0;
-    last_reset_sec = 0.0;
+    baud_rate_ = atoi(options["baud"].c_str());
+    pipelined_reads_ = true;
+    protocol_ = protocol;
+    pending_id_ = DXL_BROADCAST;
+    pending_instruction_ = DXL_PING;
+    last_outcome_ = BusStatistics::RESPONSE;
+
+    for (int i = 0; i < 256; ++i)
+    {
+        cache_[i] = DynamixelData();
+        shadow_[i] = DynamixelShadow();
+    }
 
     pthread_mutex_init(&serial_mutex_, NULL);
+    pthread_mutex_init(&shadow_mutex_, NULL);
     port_ = flexiport::CreatePort(options);
     
     // 100 microseconds = 0.1 milliseconds
@@ -73,12 +99,7 @@ DynamixelIO::~DynamixelIO()
     port_->Close();
     delete port_;
     pthread_mutex_destroy(&serial_mutex_);
-    
-    std::map<int, DynamixelData*>::iterator it;
-    for (it = cache_.begin(); it != cache_.end(); ++it)
-    {
-        delete it->second;
-    }
+    pthread_mutex_destroy(&shadow_mutex_);
 }
 
 const DynamixelData* DynamixelIO::getCachedParameters(int servo_id)
@@ -90,23 +111,25 @@ const DynamixelData* DynamixelIO::getCachedParameters(int servo_id)
 
 bool DynamixelIO::ping(int servo_id)
 {
-    // Instruction, checksum
-    uint8_t length = 2;
-
-    // Check Sum = ~ (ID + LENGTH + INSTRUCTION + PARAM_1 + ... + PARAM_N)
-    // If the calculated value is > 255, the lower byte is the check sum.
-    uint8_t checksum = 0xFF - ( (servo_id + length + DXL_PING) % 256 );
-
-    // packet: FF  FF  ID LENGTH INSTRUCTION PARAM_1 ... CHECKSUM
-    const uint8_t packet_length = 6;
-    uint8_t packet[packet_length] = { 0xFF, 0xFF, servo_id, length, DXL_PING, checksum };
+    DynamixelPacket response;
+    bool success;
 
-    std::vector<uint8_t> response;
+    if (protocol_ == DXL_PROTOCOL_2)
+    {
+        success = ping2(servo_id, response);
+    }
+    else
+    {
+        DynamixelPacket packet;
+        packet.begin(servo_id, DXL_PING);
+        packet.finish();
 
-    pthread_mutex_lock(&serial_mutex_);
-    bool success = writePacket(packet, packet_length);
-    if (success) { success = readResponse(response); }
-    pthread_mutex_unlock(&serial_mutex_);
+        pthread_mutex_lock(&serial_mutex_);
+        beginTransaction(servo_id, DXL_PING);
+        success = writePacket(packet.data, packet.size);
+        if (success) { success = readResponse(response); }
+        pthread_mutex_unlock(&serial_mutex_);
+    }
     
     if (success)
     {
@@ -120,6 +143,23 @@ bool DynamixelIO::ping(int servo_id)
     return success;
 }
 
+void DynamixelIO::discover(const std::vector<int>& servo_ids, int timeout_usec, std::vector<int>& found)
+{
+    flexiport::Timeout default_timeout = response_timeout_;
+    response_timeout_ = flexiport::Timeout(timeout_usec / 1000000, timeout_usec % 1000000);
+
+    for (size_t i = 0; i < servo_ids.size(); ++i)
+    {
+        if (updateCachedParameters(servo_ids[i], findCachedParameters(servo_ids[i])))
+        {
+            connected_motors_.insert(servo_ids[i]);
+            found.push_back(servo_ids[i]);
+        }
+    }
+
+    response_timeout_ = default_timeout;
+}
+
 bool DynamixelIO::resetOverloadError(int servo_id)
 {
     if (setTorqueEnable(servo_id, false))
@@ -140,7 +180,7 @@ bool DynamixelIO::resetOverloadError(int servo_id)
 
 bool DynamixelIO::getModelNumber(int servo_id, uint16_t& model_number)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_MODEL_NUMBER_L, 2, response))
     {
@@ -154,7 +194,7 @@ bool DynamixelIO::getModelNumber(int servo_id, uint16_t& model_number)
 
 bool DynamixelIO::getFirmwareVersion(int servo_id, uint8_t& firmware_version)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_FIRMWARE_VERSION, 1, response))
     {
@@ -168,7 +208,7 @@ bool DynamixelIO::getFirmwareVersion(int servo_id, uint8_t& firmware_version)
 
 bool DynamixelIO::getBaudRate(int servo_id, uint8_t& baud_rate)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
     
     if (read(servo_id, DXL_BAUD_RATE, 1, response))
     {
@@ -182,7 +222,7 @@ bool DynamixelIO::getBaudRate(int servo_id, uint8_t& baud_rate)
 
 bool DynamixelIO::getReturnDelayTime(int servo_id, uint8_t& return_delay_time)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_RETURN_DELAY_TIME, 1, response))
     {
@@ -196,7 +236,7 @@ bool DynamixelIO::getReturnDelayTime(int servo_id, uint8_t& return_delay_time)
 
 bool DynamixelIO::getAngleLimits(int servo_id, uint16_t& cw_angle_limit, uint16_t& ccw_angle_limit)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_ANGLE_LIMIT_L, 4, response))
     {
@@ -211,7 +251,7 @@ bool DynamixelIO::getAngleLimits(int servo_id, uint16_t& cw_angle_limit, uint16_
 
 bool DynamixelIO::getCWAngleLimit(int servo_id, uint16_t& cw_angle)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_ANGLE_LIMIT_L, 2, response))
     {
@@ -225,7 +265,7 @@ bool DynamixelIO::getCWAngleLimit(int servo_id, uint16_t& cw_angle)
 
 bool DynamixelIO::getCCWAngleLimit(int servo_id, uint16_t& ccw_angle)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CCW_ANGLE_LIMIT_L, 2, response))
     {
@@ -239,7 +279,7 @@ bool DynamixelIO::getCCWAngleLimit(int servo_id, uint16_t& ccw_angle)
 
 bool DynamixelIO::getVoltageLimits(int servo_id, float& min_voltage_limit, float& max_voltage_limit)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_DOWN_LIMIT_VOLTAGE, 2, response))
     {
@@ -254,7 +294,7 @@ bool DynamixelIO::getVoltageLimits(int servo_id, float& min_voltage_limit, float
 
 bool DynamixelIO::getMinVoltageLimit(int servo_id, float& min_voltage_limit)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_DOWN_LIMIT_VOLTAGE, 1, response))
     {
@@ -268,7 +308,7 @@ bool DynamixelIO::getMinVoltageLimit(int servo_id, float& min_voltage_limit)
 
 bool DynamixelIO::getMaxVoltageLimit(int servo_id, float& max_voltage_limit)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_UP_LIMIT_VOLTAGE, 1, response))
     {
@@ -282,7 +322,7 @@ bool DynamixelIO::getMaxVoltageLimit(int servo_id, float& max_voltage_limit)
 
 bool DynamixelIO::getTemperatureLimit(int servo_id, uint8_t& max_temperature)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_LIMIT_TEMPERATURE, 1, response))
     {
@@ -296,7 +336,7 @@ bool DynamixelIO::getTemperatureLimit(int servo_id, uint8_t& max_temperature)
 
 bool DynamixelIO::getMaxTorque(int servo_id, uint16_t& max_torque)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_MAX_TORQUE_L, 2, response))
     {
@@ -310,7 +350,7 @@ bool DynamixelIO::getMaxTorque(int servo_id, uint16_t& max_torque)
 
 bool DynamixelIO::getAlarmLed(int servo_id, uint8_t& alarm_led)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_ALARM_LED, 1, response))
     {
@@ -324,7 +364,7 @@ bool DynamixelIO::getAlarmLed(int servo_id, uint8_t& alarm_led)
 
 bool DynamixelIO::getAlarmShutdown(int servo_id, uint8_t& alarm_shutdown)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_ALARM_SHUTDOWN, 1, response))
     {
@@ -339,7 +379,7 @@ bool DynamixelIO::getAlarmShutdown(int servo_id, uint8_t& alarm_shutdown)
 
 bool DynamixelIO::getTorqueEnable(int servo_id, bool& torque_enabled)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_TORQUE_ENABLE, 1, response))
     {
@@ -353,7 +393,7 @@ bool DynamixelIO::getTorqueEnable(int servo_id, bool& torque_enabled)
 
 bool DynamixelIO::getLedStatus(int servo_id, bool& led_enabled)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_LED, 1, response))
     {
@@ -367,7 +407,7 @@ bool DynamixelIO::getLedStatus(int servo_id, bool& led_enabled)
 
 bool DynamixelIO::getComplianceMargins(int servo_id, uint8_t& cw_compliance_margin, uint8_t& ccw_compliance_margin)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_COMPLIANCE_MARGIN, 2, response))
     {
@@ -382,7 +422,7 @@ bool DynamixelIO::getComplianceMargins(int servo_id, uint8_t& cw_compliance_marg
 
 bool DynamixelIO::getCWComplianceMargin(int servo_id, uint8_t& cw_compliance_margin)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_COMPLIANCE_MARGIN, 1, response))
     {
@@ -396,7 +436,7 @@ bool DynamixelIO::getCWComplianceMargin(int servo_id, uint8_t& cw_compliance_mar
 
 bool DynamixelIO::getCCWComplianceMargin(int servo_id, uint8_t& ccw_compliance_margin)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CCW_COMPLIANCE_MARGIN, 1, response))
     {
@@ -410,7 +450,7 @@ bool DynamixelIO::getCCWComplianceMargin(int servo_id, uint8_t& ccw_compliance_m
 
 bool DynamixelIO::getComplianceSlopes(int servo_id, uint8_t& cw_compliance_slope, uint8_t& ccw_compliance_slope)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_COMPLIANCE_SLOPE, 2, response))
     {
@@ -425,7 +465,7 @@ bool DynamixelIO::getComplianceSlopes(int servo_id, uint8_t& cw_compliance_slope
 
 bool DynamixelIO::getCWComplianceSlope(int servo_id, uint8_t& cw_compliance_slope)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CW_COMPLIANCE_SLOPE, 1, response))
     {
@@ -439,7 +479,7 @@ bool DynamixelIO::getCWComplianceSlope(int servo_id, uint8_t& cw_compliance_slop
 
 bool DynamixelIO::getCCWComplianceSlope(int servo_id, uint8_t& ccw_compliance_slope)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_CCW_COMPLIANCE_SLOPE, 1, response))
     {
@@ -454,7 +494,7 @@ bool DynamixelIO::getCCWComplianceSlope(int servo_id, uint8_t& ccw_compliance_sl
 
 bool DynamixelIO::getTargetPosition(int servo_id, uint16_t& target_position)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_GOAL_POSITION_L, 2, response))
     {
@@ -468,7 +508,7 @@ bool DynamixelIO::getTargetPosition(int servo_id, uint16_t& target_position)
 
 bool DynamixelIO::getTargetVelocity(int servo_id, int16_t& target_velocity)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_GOAL_SPEED_L, 2, response))
     {
@@ -484,7 +524,7 @@ bool DynamixelIO::getTargetVelocity(int servo_id, int16_t& target_velocity)
 
 bool DynamixelIO::getTorqueLimit(int servo_id, uint16_t& torque_limit)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_TORQUE_LIMIT_L, 2, response))
     {
@@ -499,7 +539,7 @@ bool DynamixelIO::getTorqueLimit(int servo_id, uint16_t& torque_limit)
 
 bool DynamixelIO::getPosition(int servo_id, uint16_t& position)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_PRESENT_POSITION_L, 2, response))
     {
@@ -513,7 +553,7 @@ bool DynamixelIO::getPosition(int servo_id, uint16_t& position)
 
 bool DynamixelIO::getVelocity(int servo_id, int16_t& velocity)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_PRESENT_SPEED_L, 2, response))
     {
@@ -529,7 +569,7 @@ bool DynamixelIO::getVelocity(int servo_id, int16_t& velocity)
 
 bool DynamixelIO::getLoad(int servo_id, int16_t& load)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_PRESENT_LOAD_L, 2, response))
     {
@@ -545,7 +585,7 @@ bool DynamixelIO::getLoad(int servo_id, int16_t& load)
 
 bool DynamixelIO::getVoltage(int servo_id, float& voltage)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_PRESENT_VOLTAGE, 1, response))
     {
@@ -559,7 +599,7 @@ bool DynamixelIO::getVoltage(int servo_id, float& voltage)
 
 bool DynamixelIO::getTemperature(int servo_id, uint8_t& temperature)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_PRESENT_TEMPERATURE, 1, response))
     {
@@ -573,7 +613,7 @@ bool DynamixelIO::getTemperature(int servo_id, uint8_t& temperature)
 
 bool DynamixelIO::getMoving(int servo_id, bool& is_moving)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
 
     if (read(servo_id, DXL_LED, 1, response))
     {
@@ -587,49 +627,101 @@ bool DynamixelIO::getMoving(int servo_id, bool& is_moving)
 
 bool DynamixelIO::getFeedback(int servo_id, DynamixelStatus& status)
 {
-    std::vector<uint8_t> response;
+    DynamixelPacket response;
+
+    if (read(servo_id, DXL_TORQUE_LIMIT_L, 13, response) && response.paramCount() == 13)
+    {
+        checkForErrors(servo_id, response.error(), "getFeedback");
+        return parseFeedback(response.params(), DXL_FEEDBACK_ALL, status);
+    }
+
+    return false;
+}
+
+bool DynamixelIO::getMultiFeedback(const std::vector<int>& servo_ids,
+                                   std::vector<DynamixelStatus>& status,
+                                   std::vector<bool>& valid)
+{
+    status.resize(servo_ids.size());
+    return readFeedback(servo_ids, NULL, status, valid);
+}
+
+bool DynamixelIO::getGroupFeedback(const std::vector<int>& servo_ids,
+                                   const std::vector<int>& groups,
+                                   std::vector<DynamixelStatus>& status,
+                                   std::vector<bool>& valid)
+{
+    if (groups.size() != servo_ids.size() || status.size() != servo_ids.size()) { return false; }
+    return readFeedback(servo_ids, groups.empty() ? NULL : &groups[0], status, valid);
+}
+
+bool DynamixelIO::readFeedback(const std::vector<int>& servo_ids,
+                               const int* groups,
+                               std::vector<DynamixelStatus>& status,
+                               std::vector<bool>& valid)
+{
+    // torque limit through moving flag, the fast group sits in the middle of it
+    const int full_size = DXL_MOVING + 1 - DXL_TORQUE_LIMIT_L;
+    const int fast_size = DXL_PRESENT_LOAD_H + 1 - DXL_PRESENT_POSITION_L;
+    size_t count = std::min(servo_ids.size(), DXL_MAX_SERVOS);
+
+    valid.assign(servo_ids.size(), false);
+
+    // Split servos into the ones that can be polled with a single BULK_READ
+    // and the ones that have to be asked one by one, and each of those into
+    // servos due for all their feedback registers and the ones that only get
+    // the fast group. Every batch is then one BULK_READ or readMulti call.
+    enum { BULK_ALL, BULK_FAST, SINGLE_ALL, SINGLE_FAST, NUM_BATCHES };
+
+    int batch_ids[NUM_BATCHES][DXL_MAX_SERVOS];
+    size_t batch_idx[NUM_BATCHES][DXL_MAX_SERVOS];
+    size_t batch_count[NUM_BATCHES] = { 0, 0, 0, 0 };
 
-    if (read(servo_id, DXL_TORQUE_LIMIT_L, 13, response))
+    for (size_t i = 0; i < count; ++i)
     {
-        struct timespec ts_now;
-        clock_gettime(CLOCK_REALTIME, &ts_now);
-        double timestamp = ts_now.tv_sec + ts_now.tv_nsec / 1.0e9;
+        const DynamixelData* dd = findCachedParameters(servo_ids[i]);
+        bool bulk = (protocol_ == DXL_PROTOCOL_2 || supportsBulkRead(dd->model_number));
+        bool fast_only = (groups != NULL && groups[i] == DXL_FEEDBACK_FAST);
 
-        checkForErrors(servo_id, response[4], "getFeedback");
+        int batch = (bulk ? BULK_ALL : SINGLE_ALL) + (fast_only ? 1 : 0);
+        batch_ids[batch][batch_count[batch]] = servo_ids[i];
+        batch_idx[batch][batch_count[batch]++] = i;
+    }
+
+    uint8_t data[DXL_MAX_SERVOS * full_size];
+    uint8_t error_codes[DXL_MAX_SERVOS];
+    bool received[DXL_MAX_SERVOS];
+    bool success = (count == servo_ids.size());
+
+    for (int batch = 0; batch < NUM_BATCHES; ++batch)
+    {
+        size_t n = batch_count[batch];
+        if (n == 0) { continue; }
 
-        if (response.size() == 19)
+        const int* ids = batch_ids[batch];
+        bool fast_only = (batch == BULK_FAST || batch == SINGLE_FAST);
+        int group = fast_only ? DXL_FEEDBACK_FAST : DXL_FEEDBACK_ALL;
+        int address = fast_only ? DXL_PRESENT_POSITION_L : DXL_TORQUE_LIMIT_L;
+        int size = fast_only ? fast_size : full_size;
+
+        if (batch == BULK_ALL || batch == BULK_FAST)
         {
-            int offset = 5;
-            
-            uint16_t torque_limit = response[offset+0] + (response[offset+1] << 8);
-            uint16_t position = response[offset+2] + (response[offset+3] << 8);
-
-            int16_t velocity = response[offset+4] + (response[offset+5] << 8);
-            int direction = (velocity & (1 << 10)) == 0 ? 1 : -1;
-            velocity = direction * (velocity & DXL_MAX_VELOCITY_ENCODER);
-
-            int16_t load = response[offset+6] + (response[offset+7] << 8);
-            direction = (load & (1 << 10)) == 0 ? 1 : -1;
-            load = direction * (load & DXL_MAX_LOAD_ENCODER);
-
-            uint8_t voltage = response[offset+8];
-            uint8_t temperature = response[offset+9];
-            bool moving = response[offset+12];
-
-            status.timestamp = timestamp;
-            status.torque_limit = torque_limit;
-            status.position = position;
-            status.velocity = velocity;
-            status.load = load;
-            status.voltage = voltage;
-            status.temperature = temperature;
-            status.moving = moving;
+            success &= bulkRead(ids, n, address, size, data, error_codes, received);
+        }
+        else
+        {
+            success &= readMulti(ids, n, address, size, data, error_codes, received);
+        }
 
-            return true;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (!received[i]) { continue; }
+            checkForErrors(ids[i], error_codes[i], "getMultiFeedback");
+            valid[batch_idx[batch][i]] = parseFeedback(data + i * size, group, status[batch_idx[batch][i]]);
         }
     }
 
-    return false;
+    return success;
 }
 
 
@@ -1076,18 +1168,8 @@ bool DynamixelIO::setPosition(int servo_id, uint16_t position)
 
 bool DynamixelIO::setVelocity(int servo_id, int16_t velocity)
 {
-    std::vector<uint8_t> data;
-
-    if (velocity >= 0)
-    {
-        data.push_back(velocity % 256); // lo_byte
-        data.push_back(velocity >> 8);  // hi_byte
-    }
-    else
-    {
-        data.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) % 256); // lo_byte
-        data.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) >> 8);  // hi_byte
-    }
+    std::vector<uint8_t> data(DxlGoalSpeed::width);
+    encodeRegister<DxlGoalSpeed>(velocity, &data[0]);
 
     std::vector<uint8_t> response;
 
@@ -1122,312 +1204,399 @@ bool DynamixelIO::setTorqueLimit(int servo_id, uint16_t torque_limit)
 }
 
 
-bool DynamixelIO::setMultiPosition(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiPosition(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
+    const uint8_t torque_on = 1;
 
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
         int motor_id = value_pairs[i][0];
         int position = value_pairs[i][1];
 
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->target_position = position;
-        dd->torque_enabled = true;
-        
-        std::vector<uint8_t> value_pair;
-        value_pair.push_back(motor_id);                 // servo id
-        value_pair.push_back(position % 256);           // lo_byte
-        value_pair.push_back(position >> 8);            // hi_byte
+        stage<DxlGoalPosition>(motor_id, position);
 
-        data.push_back(value_pair);
+        // a Protocol 1.0 servo switches torque on by itself once it receives a
+        // goal position, a Protocol 2.0 one ignores the goal while torque is off
+        if (protocol_ == DXL_PROTOCOL_1) { updateShadow(motor_id, DXL_TORQUE_ENABLE, &torque_on, 1); }
     }
 
-    if (syncWrite(DXL_GOAL_POSITION_L, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiVelocity(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiVelocity(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
-
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
         int motor_id = value_pairs[i][0];
         int velocity = value_pairs[i][1];
 
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->target_velocity = velocity;
-        dd->torque_enabled = true;
-        
-        std::vector<uint8_t> value_pair;
-        value_pair.push_back(motor_id);             // servo id
-
-        if (velocity >= 0)
-        {
-            value_pair.push_back(velocity % 256);   // lo_byte
-            value_pair.push_back(velocity >> 8);    // hi_byte
-        }
-        else
-        {
-            value_pair.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) % 256);  // lo_byte
-            value_pair.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) >> 8);   // hi_byte
-        }
-
-        data.push_back(value_pair);
+        stage<DxlGoalSpeed>(motor_id, velocity);
     }
 
-    if (syncWrite(DXL_GOAL_SPEED_L, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiPositionVelocity(std::vector<std::vector<int> > value_tuples)
+bool DynamixelIO::setMultiPositionVelocity(const std::vector<std::vector<int> >& value_tuples)
 {
-    std::vector<std::vector<uint8_t> > data;
+    DynamixelGoal goals[DXL_MAX_SERVOS];
+    size_t count = std::min(value_tuples.size(), DXL_MAX_SERVOS);
 
-    for (size_t i = 0; i < value_tuples.size(); ++i)
+    for (size_t i = 0; i < count; ++i)
     {
-        int motor_id = value_tuples[i][0];
-        int position = value_tuples[i][1];
-        int velocity = value_tuples[i][2];
-
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->target_position = position;
-        dd->target_velocity = velocity;
-        dd->torque_enabled = true;
+        goals[i].id = value_tuples[i][0];
+        goals[i].position = value_tuples[i][1];
+        goals[i].velocity = value_tuples[i][2];
+    }
 
-        std::vector<uint8_t> vals;
+    return setMultiPositionVelocity(goals, count);
+}
 
-        vals.push_back(motor_id);     // servo id
-        vals.push_back(position % 256);         // lo_byte
-        vals.push_back(position >> 8);          // hi_byte
+bool DynamixelIO::setMultiPositionVelocity(const DynamixelGoal* goals, size_t count)
+{
+    const uint8_t torque_on = 1;
 
-        if (velocity >= 0)
-        {
-            vals.push_back(velocity % 256);     // lo_byte
-            vals.push_back(velocity >> 8);      // hi_byte
-        }
-        else
-        {
-            vals.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) % 256);    // lo_byte
-            vals.push_back((DXL_MAX_VELOCITY_ENCODER - velocity) >> 8);     // hi_byte
-        }
+    for (size_t i = 0; i < count; ++i)
+    {
+        stage<DxlGoalPosition>(goals[i].id, goals[i].position);
+        stage<DxlGoalSpeed>(goals[i].id, goals[i].velocity);
 
-        data.push_back(vals);
+        // a Protocol 1.0 servo switches torque on by itself once it receives a
+        // goal position, a Protocol 2.0 one ignores the goal while torque is off
+        if (protocol_ == DXL_PROTOCOL_1) { updateShadow(goals[i].id, DXL_TORQUE_ENABLE, &torque_on, 1); }
     }
 
-    if (syncWrite(DXL_GOAL_POSITION_L, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiComplianceMargins(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiComplianceMargins(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
-    
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
         int motor_id = value_pairs[i][0];
         int cw_margin = value_pairs[i][1];
         int ccw_margin = value_pairs[i][2];
         
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->cw_compliance_margin = cw_margin;
-        dd->ccw_compliance_margin = ccw_margin;
-        
-        std::vector<uint8_t> value_pair;
-        value_pair.push_back(motor_id);         // servo id
-        value_pair.push_back(cw_margin);        // cw_compliance_margin
-        value_pair.push_back(ccw_margin);       // ccw_compliance_margin
-        
-        data.push_back(value_pair);
+        stage<DxlCWComplianceMargin>(motor_id, cw_margin);
+        stage<DxlCCWComplianceMargin>(motor_id, ccw_margin);
     }
     
-    if (syncWrite(DXL_CW_COMPLIANCE_MARGIN, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiComplianceSlopes(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiComplianceSlopes(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
-    
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
         int motor_id = value_pairs[i][0];
         int cw_slope = value_pairs[i][1];
         int ccw_slope = value_pairs[i][2];
         
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->cw_compliance_slope = cw_slope;
-        dd->ccw_compliance_slope = ccw_slope;
-        
-        std::vector<uint8_t> value_pair;
-        value_pair.push_back(motor_id);     // servo id
-        value_pair.push_back(cw_slope);     // cw_compliance_slope
-        value_pair.push_back(ccw_slope);    // ccw_compliance_slope
-        
-        data.push_back(value_pair);
+        stage<DxlCWComplianceSlope>(motor_id, cw_slope);
+        stage<DxlCCWComplianceSlope>(motor_id, ccw_slope);
     }
     
-    if (syncWrite(DXL_CW_COMPLIANCE_SLOPE, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiTorqueEnabled(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiTorqueEnabled(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
-    
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
         int motor_id = value_pairs[i][0];
         bool torque_enabled = value_pairs[i][1];
         
-        DynamixelData* dd = findCachedParameters(motor_id);
-        dd->torque_enabled = torque_enabled;
-        
-        std::vector<uint8_t> value_pair;
-        value_pair.push_back(motor_id);         // servo id
-        value_pair.push_back(torque_enabled);   // torque_enabled
-        
-        data.push_back(value_pair);
+        stage<DxlTorqueEnable>(motor_id, torque_enabled);
     }
     
-    if (syncWrite(DXL_TORQUE_ENABLE, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiTorqueLimit(std::vector<std::vector<int> > value_pairs)
+bool DynamixelIO::setMultiTorqueLimit(const std::vector<std::vector<int> >& value_pairs)
 {
-    std::vector<std::vector<uint8_t> > data;
-
     for (size_t i = 0; i < value_pairs.size(); ++i)
     {
-        std::vector<uint8_t> value_pair;
-
+        int motor_id = value_pairs[i][0];
         int torque_limit = value_pairs[i][1];
 
-        value_pair.push_back(value_pairs[i][0]);        // servo id
-        value_pair.push_back(torque_limit % 256);       // lo_byte
-        value_pair.push_back(torque_limit >> 8);        // hi_byte
-
-        data.push_back(value_pair);
+        stage<DxlTorqueLimit>(motor_id, torque_limit);
     }
 
-    if (syncWrite(DXL_TORQUE_LIMIT_L, data)) { return true; }
-    else { return false; }
+    return flush();
 }
 
-bool DynamixelIO::setMultiValues(std::vector<std::map<std::string, int> > value_maps)
+bool DynamixelIO::setMultiValues(const std::vector<std::map<std::string, int> >& value_maps)
 {
-    std::vector<std::vector<uint8_t> > data;
-    
+    // only the values that were asked for get staged, whatever the servo
+    // already has for the rest does not need to be read back first
     for (size_t i = 0; i < value_maps.size(); ++i)
     {
-        std::map<std::string, int> m = value_maps[i];
+        const std::map<std::string, int>& m = value_maps[i];
         std::map<std::string, int>::const_iterator it;
         
         it = m.find("id");
         if (it == m.end()) { return false; }
         
         int id = it->second;
-        const DynamixelData* cache = getCachedParameters(id);
-        if (cache == NULL) { return false; }
-        
-        bool     torque_enabled = cache->torque_enabled;
-        uint8_t  led = cache->led;
-        uint8_t  cw_compliance_margin = cache->cw_compliance_margin;
-        uint8_t  ccw_compliance_margin = cache->ccw_compliance_margin;
-        uint8_t  cw_compliance_slope = cache->cw_compliance_slope;
-        uint8_t  ccw_compliance_slope = cache->ccw_compliance_slope;
-        uint16_t target_position = cache->target_position;
-        int16_t  target_velocity = cache->target_velocity;
         
         it = m.find("torque_enabled");
-        if (it != m.end()) { torque_enabled = it->second; }
+        if (it != m.end()) { stage<DxlTorqueEnable>(id, it->second); }
         
         it = m.find("cw_compliance_margin");
-        if (it != m.end()) { cw_compliance_margin = it->second; }
+        if (it != m.end()) { stage<DxlCWComplianceMargin>(id, it->second); }
         
         it = m.find("ccw_compliance_margin");
-        if (it != m.end()) { ccw_compliance_margin = it->second; }
+        if (it != m.end()) { stage<DxlCCWComplianceMargin>(id, it->second); }
         
         it = m.find("cw_compliance_slope");
-        if (it != m.end()) { cw_compliance_slope = it->second; }
+        if (it != m.end()) { stage<DxlCWComplianceSlope>(id, it->second); }
         
         it = m.find("ccw_compliance_slope");
-        if (it != m.end()) { ccw_compliance_slope = it->second; }
+        if (it != m.end()) { stage<DxlCCWComplianceSlope>(id, it->second); }
         
         it = m.find("target_position");
-        if (it != m.end()) { target_position = it->second; }
+        if (it != m.end()) { stage<DxlGoalPosition>(id, it->second); }
         
         it = m.find("target_velocity");
-        if (it != m.end()) { target_velocity = it->second; }
-        
-        std::vector<uint8_t> vals;
-        
-        vals.push_back(id);
-        
-        vals.push_back(torque_enabled);
-        vals.push_back(led);
-        vals.push_back(cw_compliance_margin);
-        vals.push_back(ccw_compliance_margin);
-        vals.push_back(cw_compliance_slope);
-        vals.push_back(ccw_compliance_slope);
-        
-        vals.push_back(target_position % 256);         // lo_byte
-        vals.push_back(target_position >> 8);          // hi_byte
-        
-        if (target_velocity >= 0)
+        if (it != m.end()) { stage<DxlGoalSpeed>(id, it->second); }
+    }
+
+    return flush();
+}
+
+namespace
+{
+
+// bits of the shadow masks covering size bytes starting at address
+inline uint64_t shadowMask(int address, int size)
+{
+    if (address < 0 || address >= DXL_CONTROL_TABLE_SIZE || size <= 0) { return 0; }
+    if (address + size > DXL_CONTROL_TABLE_SIZE) { size = DXL_CONTROL_TABLE_SIZE - address; }
+
+    uint64_t bits = (size >= 64) ? ~(uint64_t) 0 : (((uint64_t) 1 << size) - 1);
+    return bits << address;
+}
+
+// first contiguous run of set bits in mask, mask must not be zero
+inline void firstRun(uint64_t mask, int& start, int& end)
+{
+    start = 0;
+    while ((mask & ((uint64_t) 1 << start)) == 0) { ++start; }
+
+    end = start;
+    while (end < DXL_CONTROL_TABLE_SIZE && (mask & ((uint64_t) 1 << end)) != 0) { ++end; }
+}
+
+}
+
+bool DynamixelIO::flush()
+{
+    bool success = true;
+    DynamixelPacket packet;
+    uint8_t sent_ids[DXL_BROADCAST];
+
+    while (true)
+    {
+        pthread_mutex_lock(&shadow_mutex_);
+
+        uint64_t all_dirty = 0;
+        for (int id = 0; id < DXL_BROADCAST; ++id) { all_dirty |= shadow_[id].dirty; }
+
+        if (all_dirty == 0)
         {
-            vals.push_back(target_velocity % 256);     // lo_byte
-            vals.push_back(target_velocity >> 8);      // hi_byte
+            pthread_mutex_unlock(&shadow_mutex_);
+            break;
         }
-        else
+
+        int start, end;
+        firstRun(all_dirty, start, end);
+        uint64_t run = shadowMask(start, end - start);
+
+        // a servo can only join the packet if every byte of the run is known,
+        // otherwise we would be writing garbage into the registers it did not
+        // stage. If nobody qualifies shrink the run to what the first dirty
+        // servo has staged, that part is always known.
+        int n_servos = 0;
+        for (int id = 0; id < DXL_BROADCAST; ++id)
         {
-            vals.push_back((DXL_MAX_VELOCITY_ENCODER - target_velocity) % 256);    // lo_byte
-            vals.push_back((DXL_MAX_VELOCITY_ENCODER - target_velocity) >> 8);     // hi_byte
+            if ((shadow_[id].dirty & run) != 0 && (shadow_[id].known & run) == run) { ++n_servos; }
+        }
+
+        if (n_servos == 0)
+        {
+            for (int id = 0; id < DXL_BROADCAST; ++id)
+            {
+                if ((shadow_[id].dirty & run) != 0)
+                {
+                    firstRun(shadow_[id].dirty & run, start, end);
+                    run = shadowMask(start, end - start);
+                    break;
+                }
+            }
+        }
+
+        packet.beginSyncWrite(start, end - start);
+        int n_sent = 0;
+
+        for (int id = 0; id < DXL_BROADCAST; ++id)
+        {
+            DynamixelShadow& shadow = shadow_[id];
+            if ((shadow.dirty & run) == 0 || (shadow.known & run) != run) { continue; }
+
+            // servos that do not fit go out with the next packet
+            if (packet.capacity() < (size_t) (1 + end - start)) { break; }
+
+            packet.append(id);
+            for (int address = start; address < end; ++address)
+            {
+                packet.append(shadow.table[address]);
+            }
+
+            shadow.dirty &= ~run;
+            sent_ids[n_sent++] = id;
+        }
+
+        pthread_mutex_unlock(&shadow_mutex_);
+
+        bool written = false;
+
+        try
+        {
+            written = syncWrite(packet);
+        }
+        catch (flexiport::PortException pex)
+        {
+            forgetShadow(sent_ids, n_sent, run);
+            throw;
+        }
+
+        if (!written)
+        {
+            forgetShadow(sent_ids, n_sent, run);
+            success = false;
         }
-        
-        data.push_back(vals);
     }
 
-    if (syncWrite(DXL_TORQUE_ENABLE, data)) { return true; }
-    else { return false; }
+    return success;
+}
+
+void DynamixelIO::stageBytes(int servo_id, int address, const uint8_t* bytes, int size)
+{
+    uint64_t mask = shadowMask(address, size);
+    if (mask == 0) { return; }
+
+    pthread_mutex_lock(&shadow_mutex_);
+    DynamixelShadow& shadow = shadow_[servo_id & 0xFF];
+
+    // a goal position is also what switches torque back on after an overload,
+    // so only treat it as a no-op if we know torque is still on
+    bool changed = (address <= DXL_GOAL_POSITION_H && address + size > DXL_GOAL_POSITION_L) &&
+                   !((shadow.known & shadowMask(DXL_TORQUE_ENABLE, 1)) && shadow.table[DXL_TORQUE_ENABLE]);
+
+    changed |= (shadow.known & mask) != mask;
+
+    for (int i = 0; !changed && i < size; ++i)
+    {
+        changed = (shadow.table[address + i] != bytes[i]);
+    }
+
+    // multi byte registers are always written as a whole
+    if (changed)
+    {
+        memcpy(shadow.table + address, bytes, std::min(size, DXL_CONTROL_TABLE_SIZE - address));
+        shadow.known |= mask;
+        shadow.dirty |= mask;
+
+        if (address < DXL_TORQUE_LIMIT_L) { decodeShadow(shadow, findCachedParameters(servo_id)); }
+    }
+
+    pthread_mutex_unlock(&shadow_mutex_);
+}
+
+void DynamixelIO::updateShadow(int servo_id, int address, const uint8_t* bytes, int size)
+{
+    uint64_t mask = shadowMask(address, size);
+    if (mask == 0) { return; }
+
+    pthread_mutex_lock(&shadow_mutex_);
+    DynamixelShadow& shadow = shadow_[servo_id & 0xFF];
+
+    // bytes that are staged but not yet sent keep their new value
+    for (int i = 0; i < size && address + i < DXL_CONTROL_TABLE_SIZE; ++i)
+    {
+        if ((shadow.dirty & ((uint64_t) 1 << (address + i))) == 0)
+        {
+            shadow.table[address + i] = bytes[i];
+        }
+    }
+
+    shadow.known |= mask;
+
+    if (address < DXL_TORQUE_LIMIT_L) { decodeShadow(shadow, findCachedParameters(servo_id)); }
+    pthread_mutex_unlock(&shadow_mutex_);
+}
+
+void DynamixelIO::invalidateShadow(int servo_id, int address, int size)
+{
+    uint64_t mask = shadowMask(address, size);
+
+    pthread_mutex_lock(&shadow_mutex_);
+    DynamixelShadow& shadow = shadow_[servo_id & 0xFF];
+    shadow.known &= ~mask;
+    shadow.dirty &= ~mask;
+    pthread_mutex_unlock(&shadow_mutex_);
+}
+
+// Nobody knows what the servos in a lost packet hold now, the next time the
+// same bytes are staged they go out again. Anything staged since stays dirty.
+void DynamixelIO::forgetShadow(const uint8_t* servo_ids, int count, uint64_t mask)
+{
+    pthread_mutex_lock(&shadow_mutex_);
+    for (int i = 0; i < count; ++i) { shadow_[servo_ids[i]].known &= ~mask; }
+    pthread_mutex_unlock(&shadow_mutex_);
+}
+
+void DynamixelIO::decodeShadow(const DynamixelShadow& shadow, DynamixelData* data)
+{
+    const uint8_t* table = shadow.table;
+
+    data->model_number = decodeRegister<DxlModelNumber>(table + DXL_MODEL_NUMBER_L);
+    data->firmware_version = table[DXL_FIRMWARE_VERSION];
+    data->id = table[DXL_ID];
+    data->baud_rate = table[DXL_BAUD_RATE];
+    data->return_delay_time = table[DXL_RETURN_DELAY_TIME];
+    data->cw_angle_limit = decodeRegister<DxlCWAngleLimit>(table + DXL_CW_ANGLE_LIMIT_L);
+    data->ccw_angle_limit = decodeRegister<DxlCCWAngleLimit>(table + DXL_CCW_ANGLE_LIMIT_L);
+    data->drive_mode = table[DXL_DRIVE_MODE];
+    data->temperature_limit = table[DXL_LIMIT_TEMPERATURE];
+    data->voltage_limit_low = table[DXL_DOWN_LIMIT_VOLTAGE];
+    data->voltage_limit_high = table[DXL_UP_LIMIT_VOLTAGE];
+    data->max_torque = decodeRegister<DxlMaxTorque>(table + DXL_MAX_TORQUE_L);
+    data->return_level = table[DXL_RETURN_LEVEL];
+    data->alarm_led = table[DXL_ALARM_LED];
+    data->alarm_shutdown = table[DXL_ALARM_SHUTDOWN];
+    data->torque_enabled = table[DXL_TORQUE_ENABLE];
+    data->led = table[DXL_LED];
+    data->cw_compliance_margin = table[DXL_CW_COMPLIANCE_MARGIN];
+    data->ccw_compliance_margin = table[DXL_CCW_COMPLIANCE_MARGIN];
+    data->cw_compliance_slope = table[DXL_CW_COMPLIANCE_SLOPE];
+    data->ccw_compliance_slope = table[DXL_CCW_COMPLIANCE_SLOPE];
+    data->target_position = decodeRegister<DxlGoalPosition>(table + DXL_GOAL_POSITION_L);
+    data->target_velocity = decodeRegister<DxlGoalSpeed>(table + DXL_GOAL_SPEED_L);
+    data->voltage = table[DXL_PRESENT_VOLTAGE];
+    data->temperature = table[DXL_PRESENT_TEMPERATURE];
 }
 
 bool DynamixelIO::updateCachedParameters(int servo_id, DynamixelData* data)
 {
-    std::vector<uint8_t> response;
-    if (read(servo_id, DXL_MODEL_NUMBER_L, 34, response))
+    // read() mirrors the response into the control table shadow, everything
+    // up to present temperature is a few bytes more than the settings alone
+    // and saves asking for voltage separately
+    DynamixelPacket response;
+    if (read(servo_id, DXL_MODEL_NUMBER_L, DXL_PRESENT_TEMPERATURE + 1, response))
     {
-        uint8_t byte_num = 5;
-        
-        data->model_number = response[byte_num+0] + (response[byte_num+1] << 8);
-        data->firmware_version = response[byte_num+2];
-        data->id = response[byte_num+3];
-        data->baud_rate = response[byte_num+4];
-        data->return_delay_time = response[byte_num+5];
-        data->cw_angle_limit = response[byte_num+6] + (response[byte_num+7] << 8);
-        data->ccw_angle_limit = response[byte_num+8] + (response[byte_num+9] << 8);
-        data->drive_mode = response[byte_num+10];
-        data->temperature_limit = response[byte_num+11];
-        data->voltage_limit_low = response[byte_num+12];
-        data->voltage_limit_high = response[byte_num+13];
-        data->max_torque = response[byte_num+14] + (response[byte_num+15] << 8);
-        data->return_level = response[byte_num+16];
-        data->alarm_led = response[byte_num+17];
-        data->alarm_shutdown = response[byte_num+18];
-        data->torque_enabled = response[byte_num+24];
-        data->led = response[byte_num+25];
-        data->cw_compliance_margin = response[byte_num+26];
-        data->ccw_compliance_margin = response[byte_num+27];
-        data->cw_compliance_slope = response[byte_num+28];
-        data->ccw_compliance_slope = response[byte_num+29];
-        data->target_position = response[byte_num+30] + (response[byte_num+31] << 8);
-        
-        int16_t target_velocity = response[byte_num+32] + (response[byte_num+33] << 8);
-        int direction = (target_velocity & (1 << 10)) == 0 ? 1 : -1;
-        target_velocity = direction * (target_velocity & DXL_MAX_VELOCITY_ENCODER);
-        data->target_velocity = target_velocity;
+        pthread_mutex_lock(&shadow_mutex_);
+        decodeShadow(shadow_[servo_id & 0xFF], data);
+        pthread_mutex_unlock(&shadow_mutex_);
         
         return true;
     }
@@ -1435,7 +1604,7 @@ bool DynamixelIO::updateCachedParameters(int servo_id, DynamixelData* data)
     return false;
 }
 
-void DynamixelIO::checkForErrors(int servo_id, uint8_t error_code, std::string command_failed)
+void DynamixelIO::checkForErrors(int servo_id, uint8_t error_code, const char* command_failed)
 {
     DynamixelData* dd = findCachedParameters(servo_id);
     
@@ -1487,73 +1656,152 @@ void DynamixelIO::checkForErrors(int servo_id, uint8_t error_code, std::string c
     
     m << "] during " << command_failed << " command on servo #" << servo_id; 
     dd->error = m.str();
-    updateCachedParameters(servo_id, dd);
+
+    // an alarm shutdown drops torque and the torque limit and may light the
+    // LED, forget what we knew about those instead of reading everything back,
+    // the next full feedback poll brings the torque limit back in
+    invalidateShadow(servo_id, DXL_TORQUE_ENABLE, 2);
+    invalidateShadow(servo_id, DXL_TORQUE_LIMIT_L, 2);
+}
+
+bool DynamixelIO::parseFeedback(const uint8_t* params, int group, DynamixelStatus& status)
+{
+    struct timespec ts_now;
+    clock_gettime(CLOCK_REALTIME, &ts_now);
+
+    status.timestamp = ts_now.tv_sec + ts_now.tv_nsec / 1.0e9;
+    status.fast_timestamp = status.timestamp;
+
+    // params only hold present position through present load
+    if ((group & DXL_FEEDBACK_SLOW) == 0)
+    {
+        status.position = decodeRegisterAt<DxlPresentPosition, DXL_PRESENT_POSITION_L>(params);
+        status.velocity = decodeRegisterAt<DxlPresentSpeed, DXL_PRESENT_POSITION_L>(params);
+        status.load = decodeRegisterAt<DxlPresentLoad, DXL_PRESENT_POSITION_L>(params);
+        return true;
+    }
+
+    status.slow_timestamp = status.timestamp;
+    status.torque_limit = decodeRegisterAt<DxlTorqueLimit, DXL_TORQUE_LIMIT_L>(params);
+    status.position = decodeRegisterAt<DxlPresentPosition, DXL_TORQUE_LIMIT_L>(params);
+    status.velocity = decodeRegisterAt<DxlPresentSpeed, DXL_TORQUE_LIMIT_L>(params);
+    status.load = decodeRegisterAt<DxlPresentLoad, DXL_TORQUE_LIMIT_L>(params);
+    status.voltage = decodeRegisterAt<DxlPresentVoltage, DXL_TORQUE_LIMIT_L>(params);
+    status.temperature = decodeRegisterAt<DxlPresentTemperature, DXL_TORQUE_LIMIT_L>(params);
+    status.moving = decodeRegisterAt<DxlMoving, DXL_TORQUE_LIMIT_L>(params);
+
+    return true;
 }
 
 bool DynamixelIO::read(int servo_id,
                        int address,
                        int size,
-                       std::vector<uint8_t>& response)
+                       DynamixelPacket& response)
 {
-    // Number of bytes following standard header (0xFF, 0xFF, id, length)
-    uint8_t length = 4;
+    bool success;
 
-    // Check Sum = ~ (ID + LENGTH + INSTRUCTION + PARAM_1 + ... + PARAM_N)
-    // If the calculated value is > 255, the lower byte is the check sum.
-    uint8_t checksum = 0xFF - ( (servo_id + length + DXL_READ_DATA + address + size) % 256 );
+    if (protocol_ == DXL_PROTOCOL_2)
+    {
+        success = read2(servo_id, address, size, response);
+    }
+    else
+    {
+        DynamixelPacket packet;
+        packet.begin(servo_id, DXL_READ_DATA);
+        packet.append(address);
+        packet.append(size);
+        packet.finish();
 
-    // packet: FF  FF  ID LENGTH INSTRUCTION PARAM_1 ... CHECKSUM
-    uint8_t packet[8] = { 0xFF, 0xFF, servo_id, length, DXL_READ_DATA, address, size, checksum };
+        pthread_mutex_lock(&serial_mutex_);
+        beginTransaction(servo_id, DXL_READ_DATA);
+        success = writePacket(packet.data, packet.size);
+        if (success) { success = readResponse(response); }
+        pthread_mutex_unlock(&serial_mutex_);
+    }
 
-    pthread_mutex_lock(&serial_mutex_);
-    bool success = writePacket(packet, 8);
-    if (success) { success = readResponse(response); }
-    pthread_mutex_unlock(&serial_mutex_);
+    if (success && (int) response.paramCount() == size)
+    {
+        updateShadow(servo_id, address, response.params(), size);
+    }
+
+    return success;
+}
+
+bool DynamixelIO::read(int servo_id,
+                       int address,
+                       int size,
+                       std::vector<uint8_t>& response)
+{
+    DynamixelPacket packet;
+    bool success = read(servo_id, address, size, packet);
 
+    response.assign(packet.data, packet.data + (success ? packet.size : 0));
     return success;
 }
 
 bool DynamixelIO::write(int servo_id,
                         int address,
-                        const std::vector<uint8_t>& data,
-                        std::vector<uint8_t>& response)
+                        const uint8_t* data,
+                        size_t count,
+                        DynamixelPacket& response)
 {
-    // Number of bytes following standard header (0xFF, 0xFF, id, length)
-    // instruction, address, len(data), checksum
-    uint8_t length = 3 + data.size();
+    bool success;
 
-    // Check Sum = ~ (ID + LENGTH + INSTRUCTION + PARAM_1 + ... + PARAM_N)
-    // If the calculated value is > 255, the lower byte is the check sum.
-    uint32_t sum = 0;
-
-    for (uint32_t i = 0; i < data.size(); ++i)
+    if (protocol_ == DXL_PROTOCOL_2)
     {
-        sum += data[i];
+        success = write2(servo_id, address, data, count, response);
     }
+    else
+    {
+        DynamixelPacket packet;
+        packet.begin(servo_id, DXL_WRITE_DATA);
+        packet.append(address);
 
-    uint8_t checksum = 0xFF - ( (servo_id + length + DXL_WRITE_DATA + address + sum) % 256 );
+        if (packet.capacity() < count) { return false; }
 
-    // packet: FF  FF  ID LENGTH INSTRUCTION PARAM_1 ... CHECKSUM
-    uint8_t packetLength = 4 + length;
-    uint8_t packet[packetLength];
+        for (size_t i = 0; i < count; ++i)
+        {
+            packet.append(data[i]);
+        }
 
-    packet[0] = 0xFF;
-    packet[1] = 0xFF;
-    packet[2] = servo_id;
-    packet[3] = length;
-    packet[4] = DXL_WRITE_DATA;
-    packet[5] = address;
+        packet.finish();
 
-    for (uint8_t i = 0; i < data.size(); ++i)
-    {
-        packet[6+i] = data[i];
+        pthread_mutex_lock(&serial_mutex_);
+        beginTransaction(servo_id, DXL_WRITE_DATA);
+        success = writePacket(packet.data, packet.size);
+        if (success) { success = readResponse(response); }
+        pthread_mutex_unlock(&serial_mutex_);
     }
 
-    packet[packetLength-1] = checksum;
+    if (success) { updateShadow(servo_id, address, data, count); }
+
+    return success;
+}
+
+bool DynamixelIO::write(int servo_id,
+                        int address,
+                        const std::vector<uint8_t>& data,
+                        std::vector<uint8_t>& response)
+{
+    DynamixelPacket packet;
+    bool success = write(servo_id, address, data.empty() ? NULL : &data[0], data.size(), packet);
+
+    response.assign(packet.data, packet.data + (success ? packet.size : 0));
+    return success;
+}
+
+bool DynamixelIO::syncWrite(DynamixelPacket& packet)
+{
+    // nothing but the address and data length, no servos to write to
+    if (packet.size <= 7) { return true; }
+
+    if (protocol_ == DXL_PROTOCOL_2) { return syncWrite2(packet); }
+
+    packet.finish();
 
     pthread_mutex_lock(&serial_mutex_);
-    bool success = writePacket(packet, packetLength);
-    if (success) { success = readResponse(response); }
+    beginTransaction(DXL_BROADCAST, DXL_SYNC_WRITE);
+    bool success = writePacket(packet.data, packet.size);
     pthread_mutex_unlock(&serial_mutex_);
 
     return success;
@@ -1563,154 +1811,480 @@ bool DynamixelIO::syncWrite(int address,
                             const std::vector<std::vector<uint8_t> >& data)
 {
     // data = ( (id, byte1, byte2... ), (id, byte1, byte2...), ... )
+    if (data.empty()) { return true; }
 
-    // Instruction, address, length, checksum
-    uint8_t length = 4;
-
-    // Check Sum = ~ (ID + LENGTH + INSTRUCTION + PARAM_1 + ... + PARAM_N)
-    // If the calculated value is > 255, the lower byte is the check sum.
-    uint32_t sum = 0;
-    uint8_t servo_length = 0;
+    DynamixelPacket packet;
+    packet.beginSyncWrite(address, data[0].size() - 1);
 
     for (size_t i = 0; i < data.size(); ++i)
     {
+        if (packet.capacity() < data[i].size()) { return false; }
+
         for (size_t j = 0; j < data[i].size(); ++j)
         {
-            sum += data[i][j];
+            packet.append(data[i][j]);
         }
+    }
 
-        length += data[i].size();
-        servo_length = data[i].size() - 1;
+    if (!syncWrite(packet)) { return false; }
+
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        if (data[i].size() > 1) { updateShadow(data[i][0], address, &data[i][1], data[i].size() - 1); }
     }
 
-    uint8_t checksum = 0xFF - ( (DXL_BROADCAST + length + DXL_SYNC_WRITE + address + servo_length + sum) % 256 );
+    return true;
+}
 
-    // packet: FF  FF  ID LENGTH INSTRUCTION PARAM_1 ... CHECKSUM
-    int packet_length = 4 + length;
-    uint8_t packet[packet_length];
+bool DynamixelIO::readMulti(const int* servo_ids,
+                            size_t count,
+                            int address,
+                            int size,
+                            uint8_t* data,
+                            uint8_t* error_codes,
+                            bool* valid)
+{
+    if (protocol_ == DXL_PROTOCOL_2) { return bulkRead(servo_ids, count, address, size, data, error_codes, valid); }
 
-    packet[0] = 0xFF;
-    packet[1] = 0xFF;
-    packet[2] = DXL_BROADCAST;
-    packet[3] = length;
-    packet[4] = DXL_SYNC_WRITE;
-    packet[5] = address;
-    packet[6] = servo_length;
+    // Servos without BULK_READ support are asked one after another, but the
+    // bus is held for the whole batch so that no other command can sneak in
+    // between requests and the feedback cycle completes in one go.
+    DynamixelPacket packet;
+    DynamixelPacket response;
+    bool all_success = true;
 
-    for (size_t i = 0; i < data.size(); ++i)
+    pthread_mutex_lock(&serial_mutex_);
+
+    for (size_t i = 0; i < count; )
     {
-        for (size_t j = 0; j < data[i].size(); ++j)
+        size_t depth = pipelined_reads_ ? pipelineDepth(servo_ids + i, count - i, size) : 1;
+
+        if (depth > 1)
         {
-            packet[7+i*data[i].size()+j] = data[i][j];
+            all_success &= readPipelined(servo_ids + i, depth, address, size,
+                                         data + i * size, error_codes + i, valid + i);
+            i += depth;
+            continue;
         }
-    }
 
-    packet[packet_length-1] = checksum;
+        packet.begin(servo_ids[i], DXL_READ_DATA);
+        packet.append(address);
+        packet.append(size);
+        packet.finish();
+
+        beginTransaction(servo_ids[i], DXL_READ_DATA);
+        bool success = writePacket(packet.data, packet.size);
+        if (success) { success = readResponse(response); }
+        if (success) { success = (response.id() == servo_ids[i] && (int) response.paramCount() == size); }
+
+        if (success)
+        {
+            memcpy(data + i * size, response.params(), size);
+            error_codes[i] = response.error();
+        }
+
+        valid[i] = success;
+        all_success &= success;
+        ++i;
+    }
 
-    pthread_mutex_lock(&serial_mutex_);
-    bool success = writePacket(packet, packet_length);
     pthread_mutex_unlock(&serial_mutex_);
 
-    return success;
+    mirrorMulti(servo_ids, count, address, size, data, valid);
+    return all_success;
 }
 
-bool DynamixelIO::waitForBytes(ssize_t n_bytes, uint16_t timeout_ms)
+bool DynamixelIO::bulkRead(const int* servo_ids,
+                           size_t count,
+                           int address,
+                           int size,
+                           uint8_t* data,
+                           uint8_t* error_codes,
+                           bool* valid)
 {
-    struct timespec ts_now;
-    clock_gettime(CLOCK_REALTIME, &ts_now);
-    double start_time_ms = ts_now.tv_sec * 1.0e3 + ts_now.tv_nsec / 1.0e6;
+    // every 2.0 servo can do SYNC_READ, which is all a BULK_READ of one
+    // address range is
+    if (protocol_ == DXL_PROTOCOL_2)
+    {
+        bool success = syncRead2(servo_ids, count, address, size, data, error_codes, valid);
+        mirrorMulti(servo_ids, count, address, size, data, valid);
+        return success;
+    }
 
-    // wait for response packet from the motor
-    while (port_->BytesAvailableWait() < n_bytes)
+    // packet: FF  FF  FE LENGTH BULK_READ 0x00 (SIZE ID ADDRESS) ... CHECKSUM
+    DynamixelPacket packet;
+    DynamixelPacket response;
+    bool all_success = true;
+    size_t asked = 0;       // servos before this one have had a request counted
+
+    for (size_t start = 0; start < count; )
     {
-        clock_gettime(CLOCK_REALTIME, &ts_now);
-        double current_time_ms = ts_now.tv_sec * 1.0e3 + ts_now.tv_nsec / 1.0e6;
+        packet.begin(DXL_BROADCAST, DXL_BULK_READ);
+        packet.append(0x00);
 
-        if (current_time_ms - start_time_ms > timeout_ms)
+        size_t end = start;
+        for (; end < count && packet.capacity() >= 3; ++end)
         {
-            //printf("waitForBytes timed out trying to read %zd bytes in less than %dms\n", n_bytes, timeout_ms);
-            return false;
+            packet.append(size);
+            packet.append(servo_ids[end]);
+            packet.append(address);
+        }
+
+        packet.finish();
+
+        pthread_mutex_lock(&serial_mutex_);
+
+        for (size_t i = start; i < end; ++i)
+        {
+            if (i < asked) { retryTransaction(servo_ids[i], DXL_BULK_READ); }
+            else { beginTransaction(servo_ids[i], DXL_BULK_READ); }
         }
+
+        asked = std::max(asked, end);
+
+        bool written = writePacket(packet.data, packet.size);
+        size_t silent = end;
+
+        // servos answer in the order they were listed, each one waiting for
+        // the previous reply, so a missing servo silences the rest of the chain.
+        // A reply that only failed its checksum was still sent in full and the
+        // chain goes on behind it, stopping there would leave the rest of the
+        // replies to turn up in the middle of the next transaction.
+        for (size_t i = start; i < end && silent == end; ++i)
+        {
+            bool success = false;
+            expectResponse(servo_ids[i]);
+
+            if (!written)
+            {
+                recordResponse(BusStatistics::HEADER_TIMEOUT, servo_ids[i]);
+            }
+            else if (readResponse(response))
+            {
+                success = (response.id() == servo_ids[i] && (int) response.paramCount() == size);
+            }
+            else if (last_outcome_ != BusStatistics::CHECKSUM_FAILURE)
+            {
+                silent = i;
+            }
+
+            if (success)
+            {
+                memcpy(data + i * size, response.params(), size);
+                error_codes[i] = response.error();
+            }
+
+            valid[i] = success;
+            all_success &= success;
+        }
+
+        pthread_mutex_unlock(&serial_mutex_);
+
+        // the servos queued behind one that never answered are still there,
+        // give them a BULK_READ of their own instead of losing the whole cycle.
+        // Nothing is recorded for them until then, they did nothing wrong.
+        start = (silent < end) ? silent + 1 : end;
     }
 
-    return true;
+    mirrorMulti(servo_ids, count, address, size, data, valid);
+    return all_success;
+}
+
+size_t DynamixelIO::pipelineDepth(const int* servo_ids, size_t count, int size)
+{
+    // Each request is padded to the length of a reply so that requests sent
+    // back to back come back as back to back replies. All requests of a burst
+    // have to be on the wire before the first servo's return delay runs out,
+    // and every servo in it needs the same delay or the replies would collide.
+    size_t slot_bytes = std::max<size_t>(DXL_READ_REQUEST_SIZE, 6 + size);
+    double byte_usec = 10.0e6 / baud_rate_;
+    double slot_usec = slot_bytes * byte_usec;
+
+    size_t depth = 0;
+    uint64_t rdt_bit = (uint64_t) 1 << DXL_RETURN_DELAY_TIME;
+    int rdt = -1;
+
+    pthread_mutex_lock(&shadow_mutex_);
+
+    for (; depth < count && depth < DXL_MAX_PIPELINE_DEPTH; ++depth)
+    {
+        const DynamixelShadow& shadow = shadow_[servo_ids[depth] & 0xFF];
+        if ((shadow.known & rdt_bit) == 0) { break; }
+
+        int servo_rdt = shadow.table[DXL_RETURN_DELAY_TIME];
+        if (rdt < 0) { rdt = servo_rdt; }
+        if (servo_rdt != rdt) { break; }
+
+        // return delay time is in units of 2 microseconds
+        if (depth * slot_usec + DXL_PIPELINE_GUARD_USEC > rdt * 2.0) { break; }
+    }
+
+    pthread_mutex_unlock(&shadow_mutex_);
+
+    return std::max<size_t>(depth, 1);
+}
+
+bool DynamixelIO::readPipelined(const int* servo_ids,
+                                size_t count,
+                                int address,
+                                int size,
+                                uint8_t* data,
+                                uint8_t* error_codes,
+                                bool* valid)
+{
+    // padding goes in front of each request, servos skip anything that does
+    // not start with 0xFF 0xFF so only the end of the request is timed
+    uint8_t stream[DXL_MAX_PIPELINE_DEPTH * DXL_MAX_PACKET_SIZE];
+    size_t padding = std::max<size_t>(DXL_READ_REQUEST_SIZE, 6 + size) - DXL_READ_REQUEST_SIZE;
+    size_t stream_size = 0;
+
+    DynamixelPacket packet;
+    DynamixelPacket response;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        memset(stream + stream_size, 0x00, padding);
+        stream_size += padding;
+
+        packet.begin(servo_ids[i], DXL_READ_DATA);
+        packet.append(address);
+        packet.append(size);
+        packet.finish();
+
+        memcpy(stream + stream_size, packet.data, packet.size);
+        stream_size += packet.size;
+
+        beginTransaction(servo_ids[i], DXL_READ_DATA);
+        valid[i] = false;
+    }
+
+    // every servo in the burst has been counted as asked
+    if (!writePacket(stream, stream_size))
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            expectResponse(servo_ids[i]);
+            recordResponse(BusStatistics::HEADER_TIMEOUT, servo_ids[i]);
+        }
+
+        return false;
+    }
+
+    struct timespec deadline;
+    flexiport::DeadlineFromNow(response_timeout_, deadline);
+
+    size_t received = 0;
+
+    // replies come back in request order, once the last servo has answered
+    // any servo before it that did not is not going to
+    expectResponse(servo_ids[0]);
+    bool timed_out = false;
+
+    while (!valid[count-1])
+    {
+        if (!readNextResponse(response, size, deadline))
+        {
+            timed_out = true;
+            break;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!valid[i] && response.id() == servo_ids[i])
+            {
+                memcpy(data + i * size, response.params(), size);
+                error_codes[i] = response.error();
+                valid[i] = true;
+                ++received;
+                break;
+            }
+        }
+
+        // a failed response is put down to the first servo still missing
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!valid[i]) { expectResponse(servo_ids[i]); break; }
+        }
+    }
+
+    // servos skipped over by later replies are not going to answer either,
+    // the one the last read timed out on has been counted already
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!valid[i] && !(timed_out && servo_ids[i] == pending_id_))
+        {
+            recordResponse(BusStatistics::HEADER_TIMEOUT, servo_ids[i]);
+        }
+    }
+
+    return received == count;
+}
+
+void DynamixelIO::mirrorMulti(const int* servo_ids,
+                              size_t count,
+                              int address,
+                              int size,
+                              const uint8_t* data,
+                              const bool* valid)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (valid[i])
+        {
+            updateShadow(servo_ids[i], address, data + i * size, size);
+        }
+        else
+        {
+            // a servo that stops answering may have browned out and come
+            // back with its RAM area reset to defaults
+            invalidateShadow(servo_ids[i], DXL_TORQUE_ENABLE, DXL_CONTROL_TABLE_SIZE - DXL_TORQUE_ENABLE);
+        }
+    }
 }
 
 bool DynamixelIO::writePacket(const void* const buffer, size_t count)
 {
-    port_->Flush();
+    // throw away stale input (late replies), but unlike Flush() leave the output
+    // queue alone, a preceding SYNC_WRITE might still be on its way out
+    ssize_t stale = port_->BytesAvailable();
+    if (stale > 0) { port_->Skip(stale); }
+
     return (port_->Write(buffer, count) == (ssize_t) count);
 }
 
-bool DynamixelIO::readResponse(std::vector<uint8_t>& response)
+void DynamixelIO::beginTransaction(int servo_id, int instruction)
+{
+    clock_gettime(CLOCK_MONOTONIC, &request_time_);
+    pending_id_ = servo_id;
+    pending_instruction_ = instruction;
+    stats_.countRequest(servo_id, instruction);
+}
+
+void DynamixelIO::retryTransaction(int servo_id, int instruction)
+{
+    clock_gettime(CLOCK_MONOTONIC, &request_time_);
+    pending_id_ = servo_id;
+    pending_instruction_ = instruction;
+}
+
+void DynamixelIO::recordResponse(BusStatistics::Outcome outcome, int servo_id, uint8_t error)
 {
     struct timespec ts_now;
-    clock_gettime(CLOCK_REALTIME, &ts_now);
-    double current_time_sec = ts_now.tv_sec + ts_now.tv_nsec / 1.0e9;
-    
-    if (current_time_sec - last_reset_sec > 20)
-    {
-        read_count = 0;
-        read_error_count = 0;
-        last_reset_sec = current_time_sec;
-    }
-    
-    ++read_count;
-    
-    static const uint16_t timeout_ms = 50;
+    clock_gettime(CLOCK_MONOTONIC, &ts_now);
+
+    int64_t latency_usec = (ts_now.tv_sec - request_time_.tv_sec) * 1000000LL +
+                           (ts_now.tv_nsec - request_time_.tv_nsec) / 1000;
+
+    stats_.countResponse(servo_id, pending_instruction_, outcome, std::max<int64_t>(latency_usec, 0), error);
+    last_outcome_ = outcome;
+}
+
+bool DynamixelIO::readResponse(DynamixelPacket& response)
+{
+    // the whole response has to arrive within response_timeout_ of us starting to
+    // wait for it, the port sleeps in the kernel until then instead of polling
+    struct timespec deadline;
+    flexiport::DeadlineFromNow(response_timeout_, deadline);
     
-    uint8_t buffer[1024];
-    response.clear();
+    response.size = 0;
 
     // wait until we receive the header bytes and read them
-    if (!waitForBytes(4, timeout_ms) || port_->Read(buffer, 4) != 4)
+    if (port_->ReadFullDeadline(response.data, 4, deadline) != 4)
     {
-        ++read_error_count;
+        recordResponse(BusStatistics::HEADER_TIMEOUT, pending_id_);
         return false;
     }
     
-    if (buffer[0] == 0xFF && buffer[1] == 0xFF)
+    if (response[0] == 0xFF && response[1] == 0xFF)
     {
-        response.push_back(buffer[0]);  // 0xFF
-        response.push_back(buffer[1]);  // 0xFF
-        response.push_back(buffer[2]);  // ID
-        uint8_t n_bytes = buffer[3];    // Length
-        response.push_back(n_bytes);
+        uint8_t n_bytes = response[3];    // Length
         
+        if (n_bytes < 2)
+        {
+            recordResponse(BusStatistics::BAD_HEADER, pending_id_);
+            return false;
+        }
+
         // wait for and read the rest of response bytes
-        if (!waitForBytes(n_bytes, timeout_ms) || port_->Read(buffer, n_bytes) != n_bytes)
+        if (port_->ReadFullDeadline(response.data + 4, n_bytes, deadline) != n_bytes)
         {
-            ++read_error_count;
-            response.clear();
+            recordResponse(BusStatistics::PAYLOAD_TIMEOUT, pending_id_);
             return false;
         }
         
-        for (int i = 0; i < n_bytes; ++i)
+        response.size = 4 + n_bytes;
+
+        // verify checksum
+        if (!response.checksumValid())
         {
-            response.push_back(buffer[i]);
+            recordResponse(BusStatistics::CHECKSUM_FAILURE, pending_id_);
+            response.size = 0;
+            return false;
         }
 
-        // verify checksum
-        uint8_t checksum = 0xFF;
-        uint32_t sum = 0;
+        recordResponse(BusStatistics::RESPONSE, response.id(), response.error());
+        return true;
+    }
+
+    recordResponse(BusStatistics::BAD_HEADER, pending_id_);
+    return false;
+}
+
+bool DynamixelIO::readNextResponse(DynamixelPacket& response, int param_count, const struct timespec& deadline)
+{
+    // Unlike readResponse() a bad byte does not end the transaction, the
+    // replies of a pipelined read share one stream and the next one may be
+    // fine. Slide forward to the next 0xFF 0xFF and try again until the
+    // deadline passes.
 
-        for (uint32_t i = 2; i < response.size() - 1; ++i)
+    size_t expected = 6 + param_count;
+    size_t have = 0;
+    bool resynced = false;
+
+    while (true)
+    {
+        if (have < expected)
         {
-            sum += response[i];
+            ssize_t n_bytes = expected - have;
+            if (port_->ReadFullDeadline(response.data + have, n_bytes, deadline) != n_bytes)
+            {
+                if (!resynced)
+                {
+                    recordResponse(have == 0 ? BusStatistics::HEADER_TIMEOUT : BusStatistics::PAYLOAD_TIMEOUT, pending_id_);
+                }
+
+                response.size = 0;
+                return false;
+            }
+
+            have = expected;
         }
 
-        checksum -= sum % 256;
-        
-        if (checksum != response.back())
+        response.size = expected;
+
+        bool header_valid = (response[0] == 0xFF && response[1] == 0xFF && response[3] == param_count + 2);
+
+        if (header_valid && response.checksumValid())
         {
-            ++read_error_count;
-            return false;
+            recordResponse(BusStatistics::RESPONSE, response.id(), response.error());
+            return true;
         }
 
-        return true;
-    }
+        if (!resynced)
+        {
+            recordResponse(header_valid ? BusStatistics::CHECKSUM_FAILURE : BusStatistics::BAD_HEADER, pending_id_);
+            resynced = true;
+        }
 
-    return false;
+        size_t start = 1;
+        while (start < have && !(response[start] == 0xFF && (start + 1 == have || response[start+1] == 0xFF)))
+        {
+            ++start;
+        }
+
+        memmove(response.data, response.data + start, have - start);
+        have -= start;
+    }
 }
 
 }
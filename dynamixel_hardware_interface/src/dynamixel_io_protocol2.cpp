@@ -0,0 +1,536 @@
+/*
+    Copyright (c) 2011, Antons Rebguns <email>
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+        * Redistributions of source code must retain the above copyright
+        notice, this list of conditions and the following disclaimer.
+        * Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+        * Neither the name of the <organization> nor the
+        names of its contributors may be used to endorse or promote products
+        derived from this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY Antons Rebguns <email> ''AS IS'' AND ANY
+    EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+    WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+    DISCLAIMED. IN NO EVENT SHALL Antons Rebguns <email> BE LIABLE FOR ANY
+    DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+    (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+    LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+    ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <time.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <clam/gearbox/flexiport/flexiport.h>
+
+#include <dynamixel_hardware_interface/dynamixel_const.h>
+#include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/dynamixel_protocol2.h>
+
+namespace dynamixel_hardware_interface
+{
+
+namespace
+{
+
+// Where a register of the 1.0 control table lives on a 2.0 servo. Registers
+// the X series does not have read back as a fixed value and writes to them
+// are dropped.
+struct XRegister
+{
+    int address;            // in the 1.0 table
+    int width;
+    bool is_signed;         // sign-magnitude in the 1.0 table, two's complement on the servo
+    int x_address;          // -1 if the servo has no such register
+    int x_width;
+    double x_per_unit;      // servo units per 1.0 unit
+    int emulated;           // value read back when there is no such register
+};
+
+// speed is 0.229 rpm per unit on the servo, callers keep using MX units
+const double X_SPEED_SCALE = DXL_X_VELOCITY_RPM_PER_TICK / 0.229;
+
+const XRegister X_REGISTERS[] =
+{
+    { DXL_MODEL_NUMBER_L,         2, false, DXL_X_MODEL_NUMBER,           2, 1.0,           0    },
+    { DXL_FIRMWARE_VERSION,       1, false, DXL_X_FIRMWARE_VERSION,       1, 1.0,           0    },
+    { DXL_ID,                     1, false, DXL_X_ID,                     1, 1.0,           0    },
+    { DXL_BAUD_RATE,              1, false, DXL_X_BAUD_RATE,              1, 1.0,           0    },
+    { DXL_RETURN_DELAY_TIME,      1, false, DXL_X_RETURN_DELAY_TIME,      1, 1.0,           0    },
+    { DXL_CW_ANGLE_LIMIT_L,       2, false, DXL_X_MIN_POSITION_LIMIT,     4, 1.0,           0    },
+    { DXL_CCW_ANGLE_LIMIT_L,      2, false, DXL_X_MAX_POSITION_LIMIT,     4, 1.0,           0    },
+    { DXL_DRIVE_MODE,             1, false, DXL_X_DRIVE_MODE,             1, 1.0,           0    },
+    { DXL_LIMIT_TEMPERATURE,      1, false, DXL_X_TEMPERATURE_LIMIT,      1, 1.0,           0    },
+    { DXL_DOWN_LIMIT_VOLTAGE,     1, false, DXL_X_MIN_VOLTAGE_LIMIT,      2, 1.0,           0    },
+    { DXL_UP_LIMIT_VOLTAGE,       1, false, DXL_X_MAX_VOLTAGE_LIMIT,      2, 1.0,           0    },
+    { DXL_MAX_TORQUE_L,           2, false, -1,                           0, 1.0,           1023 },
+    { DXL_RETURN_LEVEL,           1, false, DXL_X_STATUS_RETURN_LEVEL,    1, 1.0,           0    },
+    { DXL_ALARM_LED,              1, false, -1,                           0, 1.0,           0    },
+    { DXL_ALARM_SHUTDOWN,         1, false, DXL_X_SHUTDOWN,               1, 1.0,           0    },
+    { DXL_TORQUE_ENABLE,          1, false, DXL_X_TORQUE_ENABLE,          1, 1.0,           0    },
+    { DXL_LED,                    1, false, DXL_X_LED,                    1, 1.0,           0    },
+    { DXL_CW_COMPLIANCE_MARGIN,   1, false, -1,                           0, 1.0,           0    },
+    { DXL_CCW_COMPLIANCE_MARGIN,  1, false, -1,                           0, 1.0,           0    },
+    { DXL_CW_COMPLIANCE_SLOPE,    1, false, -1,                           0, 1.0,           32   },
+    { DXL_CCW_COMPLIANCE_SLOPE,   1, false, -1,                           0, 1.0,           32   },
+    { DXL_GOAL_POSITION_L,        2, false, DXL_X_GOAL_POSITION,          4, 1.0,           0    },
+    { DXL_GOAL_SPEED_L,           2, false, DXL_X_PROFILE_VELOCITY,       4, X_SPEED_SCALE, 0    },
+    { DXL_TORQUE_LIMIT_L,         2, false, -1,                           0, 1.0,           1023 },
+    { DXL_PRESENT_POSITION_L,     2, false, DXL_X_PRESENT_POSITION,       4, 1.0,           0    },
+    { DXL_PRESENT_SPEED_L,        2, true,  DXL_X_PRESENT_VELOCITY,       4, X_SPEED_SCALE, 0    },
+    { DXL_PRESENT_LOAD_L,         2, true,  DXL_X_PRESENT_LOAD,           2, 1.0,           0    },
+    { DXL_PRESENT_VOLTAGE,        1, false, DXL_X_PRESENT_INPUT_VOLTAGE,  2, 1.0,           0    },
+    { DXL_PRESENT_TEMPERATURE,    1, false, DXL_X_PRESENT_TEMPERATURE,    1, 1.0,           0    },
+    // on the servo this one sits far below the feedback registers, mapping it
+    // would stretch every feedback read from 122 down to 69
+    { DXL_REGISTERED_INSTRUCTION, 1, false, -1,                           0, 1.0,           0    },
+    { DXL_MOVING,                 1, false, DXL_X_MOVING,                 1, 1.0,           0    },
+    { DXL_LOCK,                   1, false, -1,                           0, 1.0,           0    },
+    { DXL_PUNCH_L,                2, false, -1,                           0, 1.0,           0    },
+};
+
+const size_t X_REGISTER_COUNT = sizeof(X_REGISTERS) / sizeof(X_REGISTERS[0]);
+
+// one past the last byte of the X table that is mapped
+const int X_TABLE_SIZE = DXL_X_PRESENT_TEMPERATURE + 1;
+
+inline int scaleValue(int value, double factor)
+{
+    return (int) (value * factor + (value < 0 ? -0.5 : 0.5));
+}
+
+// physical address range [x_start, x_end) holding the registers that overlap
+// the logical range, false if none of them exist on the servo
+bool physicalSpan(int address, int size, int& x_start, int& x_end)
+{
+    x_start = X_TABLE_SIZE;
+    x_end = 0;
+
+    for (size_t i = 0; i < X_REGISTER_COUNT; ++i)
+    {
+        const XRegister& reg = X_REGISTERS[i];
+
+        if (reg.x_address < 0 || reg.address + reg.width <= address || reg.address >= address + size) { continue; }
+
+        x_start = std::min(x_start, reg.x_address);
+        x_end = std::max(x_end, reg.x_address + reg.x_width);
+    }
+
+    return x_start < x_end;
+}
+
+// fills in the logical range from the bytes of a read that started at x_start
+void toLogical(int address, int size, const uint8_t* x_data, int x_start, uint8_t* data)
+{
+    memset(data, 0, size);
+
+    for (size_t i = 0; i < X_REGISTER_COUNT; ++i)
+    {
+        const XRegister& reg = X_REGISTERS[i];
+
+        if (reg.address + reg.width <= address || reg.address >= address + size) { continue; }
+
+        int value = reg.emulated;
+
+        if (reg.x_address >= 0)
+        {
+            const uint8_t* src = x_data + reg.x_address - x_start;
+            uint32_t raw = 0;
+
+            for (int j = reg.x_width - 1; j >= 0; --j)
+            {
+                raw = (raw << 8) | src[j];
+            }
+
+            if (reg.x_width == 4) { value = (int32_t) raw; }
+            else if (reg.x_width == 2) { value = (int16_t) raw; }
+            else { value = raw; }
+
+            value = scaleValue(value, 1.0 / reg.x_per_unit);
+        }
+
+        if (reg.is_signed)
+        {
+            int magnitude = std::min(abs(value), 0x3FF);
+            value = (value < 0) ? (magnitude | (1 << 10)) : magnitude;
+        }
+        else
+        {
+            value = std::max(0, std::min(value, reg.width == 2 ? 0xFFFF : 0xFF));
+        }
+
+        uint8_t bytes[2] = { (uint8_t) (value & 0xFF), (uint8_t) (value >> 8) };
+
+        for (int j = 0; j < reg.width; ++j)
+        {
+            int offset = reg.address + j - address;
+            if (offset >= 0 && offset < size) { data[offset] = bytes[j]; }
+        }
+    }
+}
+
+// lays the registers that lie completely inside the logical range out at
+// their physical addresses and marks the bytes that were filled in
+void toPhysical(int address, const uint8_t* data, size_t count, uint8_t* x_table, bool* x_used)
+{
+    for (size_t i = 0; i < X_REGISTER_COUNT; ++i)
+    {
+        const XRegister& reg = X_REGISTERS[i];
+
+        if (reg.x_address < 0 || reg.address < address || reg.address + reg.width > address + (int) count) { continue; }
+
+        const uint8_t* src = data + reg.address - address;
+        int value = (reg.width == 2) ? src[0] + (src[1] << 8) : src[0];
+
+        if (reg.is_signed && (value & (1 << 10))) { value = -(value & 0x3FF); }
+
+        uint32_t raw = scaleValue(value, reg.x_per_unit);
+
+        for (int j = 0; j < reg.x_width; ++j)
+        {
+            x_table[reg.x_address + j] = (raw >> (8 * j)) & 0xFF;
+            x_used[reg.x_address + j] = true;
+        }
+    }
+}
+
+// next run of contiguous marked bytes at or after end, each one becomes a
+// single WRITE or SYNC_WRITE
+bool nextRun(const bool* x_used, int& start, int& end)
+{
+    for (start = end; start < X_TABLE_SIZE && !x_used[start]; ++start) {}
+    if (start == X_TABLE_SIZE) { return false; }
+
+    for (end = start; end < X_TABLE_SIZE && x_used[end]; ++end) {}
+    return true;
+}
+
+// status in the 1.0 layout the getters expect
+void makeResponse(int servo_id, uint8_t error, const uint8_t* params, size_t count, DynamixelPacket& response)
+{
+    response.begin(servo_id, error);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        response.append(params[i]);
+    }
+
+    response.finish();
+}
+
+}
+
+bool DynamixelIO::ping2(int servo_id, DynamixelPacket& response)
+{
+    Dynamixel2Packet packet;
+    packet.begin(servo_id, DXL_PING);
+    packet.finish();
+
+    Dynamixel2Packet status;
+
+    pthread_mutex_lock(&serial_mutex_);
+    beginTransaction(servo_id, DXL_PING);
+    bool success = writePacket(packet.data, packet.size);
+    if (success) { success = readResponse2(status); }
+    pthread_mutex_unlock(&serial_mutex_);
+
+    if (success) { success = (status.id() == servo_id); }
+    if (success) { makeResponse(servo_id, convertError(status.error()), NULL, 0, response); }
+
+    return success;
+}
+
+bool DynamixelIO::read2(int servo_id,
+                        int address,
+                        int size,
+                        DynamixelPacket& response)
+{
+    if (size <= 0 || (size_t) size > DXL_MAX_PACKET_SIZE - 6) { return false; }
+
+    uint8_t data[DXL_MAX_PACKET_SIZE];
+    uint8_t error = 0;
+    int x_start, x_end;
+
+    // a range made up of emulated registers only is answered without asking
+    if (physicalSpan(address, size, x_start, x_end))
+    {
+        Dynamixel2Packet packet;
+        packet.begin(servo_id, DXL_READ_DATA);
+        packet.append16(x_start);
+        packet.append16(x_end - x_start);
+        packet.finish();
+
+        Dynamixel2Packet status;
+
+        pthread_mutex_lock(&serial_mutex_);
+        beginTransaction(servo_id, DXL_READ_DATA);
+        bool success = writePacket(packet.data, packet.size);
+        if (success) { success = readResponse2(status); }
+        pthread_mutex_unlock(&serial_mutex_);
+
+        if (success) { success = (status.id() == servo_id && (int) status.paramCount() == x_end - x_start); }
+        if (!success) { return false; }
+
+        toLogical(address, size, status.params(), x_start, data);
+        error = convertError(status.error());
+    }
+    else
+    {
+        toLogical(address, size, NULL, 0, data);
+    }
+
+    makeResponse(servo_id, error, data, size, response);
+    return true;
+}
+
+bool DynamixelIO::write2(int servo_id,
+                         int address,
+                         const uint8_t* data,
+                         size_t count,
+                         DynamixelPacket& response)
+{
+    uint8_t x_table[X_TABLE_SIZE];
+    bool x_used[X_TABLE_SIZE] = { false };
+    toPhysical(address, data, count, x_table, x_used);
+
+    Dynamixel2Packet packet;
+    Dynamixel2Packet status;
+    uint8_t error = 0;
+    bool success = true;
+    int start, end = 0;
+
+    pthread_mutex_lock(&serial_mutex_);
+
+    while (success && nextRun(x_used, start, end))
+    {
+        packet.begin(servo_id, DXL_WRITE_DATA);
+        packet.append16(start);
+
+        for (int i = start; i < end; ++i)
+        {
+            packet.append(x_table[i]);
+        }
+
+        beginTransaction(servo_id, DXL_WRITE_DATA);
+        success = packet.finish() && writePacket(packet.data, packet.size);
+        if (success) { success = readResponse2(status); }
+        if (success) { success = (status.id() == servo_id); }
+        if (success) { error |= convertError(status.error()); }
+    }
+
+    pthread_mutex_unlock(&serial_mutex_);
+
+    if (success) { makeResponse(servo_id, error, NULL, 0, response); }
+
+    return success;
+}
+
+bool DynamixelIO::syncWrite2(const DynamixelPacket& packet)
+{
+    // packet: FF  FF  FE LENGTH SYNC_WRITE ADDRESS DATA_LENGTH (ID DATA_1 ... DATA_N) ...
+    int address = packet[5];
+    size_t length = packet[6];
+    size_t stride = length + 1;
+
+    // every servo gets the same registers, the first one decides how they
+    // fall apart into runs on the X table
+    uint8_t x_table[X_TABLE_SIZE];
+    bool x_used[X_TABLE_SIZE] = { false };
+    toPhysical(address, packet.data + 8, length, x_table, x_used);
+
+    Dynamixel2Packet x_packet;
+    bool success = true;
+    int start, end = 0;
+
+    while (success && nextRun(x_used, start, end))
+    {
+        x_packet.begin(DXL_BROADCAST, DXL_SYNC_WRITE);
+        x_packet.append16(start);
+        x_packet.append16(end - start);
+
+        for (size_t i = 7; i + stride <= packet.size; i += stride)
+        {
+            if (x_packet.capacity() < (size_t) (1 + end - start)) { return false; }
+
+            toPhysical(address, packet.data + i + 1, length, x_table, x_used);
+            x_packet.append(packet[i]);
+
+            for (int j = start; j < end; ++j)
+            {
+                x_packet.append(x_table[j]);
+            }
+        }
+
+        success = x_packet.finish();
+
+        if (success)
+        {
+            pthread_mutex_lock(&serial_mutex_);
+            beginTransaction(DXL_BROADCAST, DXL_SYNC_WRITE);
+            success = writePacket(x_packet.data, x_packet.size);
+            pthread_mutex_unlock(&serial_mutex_);
+        }
+    }
+
+    return success;
+}
+
+bool DynamixelIO::syncRead2(const int* servo_ids,
+                            size_t count,
+                            int address,
+                            int size,
+                            uint8_t* data,
+                            uint8_t* error_codes,
+                            bool* valid)
+{
+    int x_start, x_end;
+
+    if (!physicalSpan(address, size, x_start, x_end))
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            toLogical(address, size, NULL, 0, data + i * size);
+            error_codes[i] = 0;
+            valid[i] = true;
+        }
+
+        return true;
+    }
+
+    Dynamixel2Packet packet;
+    Dynamixel2Packet status;
+    bool all_success = true;
+
+    for (size_t start = 0; start < count; )
+    {
+        // packet: FF FF FD 00 FE LEN_L LEN_H SYNC_READ ADDR_L ADDR_H SIZE_L SIZE_H ID_1 ... ID_N CRC_L CRC_H
+        packet.begin(DXL_BROADCAST, DXL_SYNC_READ);
+        packet.append16(x_start);
+        packet.append16(x_end - x_start);
+
+        for (size_t i = start; i < count; ++i)
+        {
+            packet.append(servo_ids[i]);
+        }
+
+        bool packed = packet.finish();
+
+        pthread_mutex_lock(&serial_mutex_);
+
+        // a retry goes out to the servos behind a silent one, their first request was counted
+        for (size_t i = start; i < count; ++i)
+        {
+            if (start > 0) { retryTransaction(servo_ids[i], DXL_SYNC_READ); }
+            else { beginTransaction(servo_ids[i], DXL_SYNC_READ); }
+        }
+
+        bool written = packed && writePacket(packet.data, packet.size);
+        size_t silent = count;
+
+        // as with BULK_READ every servo waits for the reply of the one listed
+        // before it, a missing servo silences the rest of the chain. A reply
+        // that is only corrupt was still sent and the chain goes on behind it.
+        for (size_t i = start; i < count && written && silent == count; ++i)
+        {
+            bool success = false;
+            expectResponse(servo_ids[i]);
+
+            if (readResponse2(status))
+            {
+                success = (status.id() == servo_ids[i] && (int) status.paramCount() == x_end - x_start);
+            }
+            else if (last_outcome_ == BusStatistics::HEADER_TIMEOUT)
+            {
+                silent = i;
+            }
+
+            if (success)
+            {
+                toLogical(address, size, status.params(), x_start, data + i * size);
+                error_codes[i] = convertError(status.error());
+            }
+
+            valid[i] = success;
+            all_success &= success;
+        }
+
+        if (!written)
+        {
+            for (size_t i = start; i < count; ++i) { valid[i] = false; }
+            all_success = false;
+        }
+
+        pthread_mutex_unlock(&serial_mutex_);
+
+        // retry whoever was queued behind a servo that never answered, nothing
+        // is recorded for them until then
+        start = (silent < count) ? silent + 1 : count;
+    }
+
+    return all_success;
+}
+
+bool DynamixelIO::readResponse2(Dynamixel2Packet& status)
+{
+    struct timespec deadline;
+    flexiport::DeadlineFromNow(response_timeout_, deadline);
+
+    status.size = 0;
+
+    // wait until we receive the header bytes and read them
+    if (port_->ReadFullDeadline(status.data, DXL2_HEADER_SIZE, deadline) != (ssize_t) DXL2_HEADER_SIZE)
+    {
+        recordResponse(BusStatistics::HEADER_TIMEOUT, pending_id_);
+        return false;
+    }
+
+    // instruction, error and CRC at the least
+    ssize_t n_bytes = status.length();
+
+    if (status.data[0] != 0xFF || status.data[1] != 0xFF || status.data[2] != 0xFD || status.data[3] != 0x00 ||
+        n_bytes < 4 || DXL2_HEADER_SIZE + n_bytes > DXL2_MAX_PACKET_SIZE)
+    {
+        recordResponse(BusStatistics::BAD_HEADER, pending_id_);
+        return false;
+    }
+
+    if (port_->ReadFullDeadline(status.data + DXL2_HEADER_SIZE, n_bytes, deadline) != n_bytes)
+    {
+        recordResponse(BusStatistics::PAYLOAD_TIMEOUT, pending_id_);
+        return false;
+    }
+
+    status.size = DXL2_HEADER_SIZE + n_bytes;
+
+    if (!status.crcValid())
+    {
+        recordResponse(BusStatistics::CHECKSUM_FAILURE, pending_id_);
+        status.size = 0;
+        return false;
+    }
+
+    if (status.instruction() != DXL_STATUS)
+    {
+        recordResponse(BusStatistics::BAD_HEADER, pending_id_);
+        status.size = 0;
+        return false;
+    }
+
+    status.unstuff();
+    recordResponse(BusStatistics::RESPONSE, status.id(), convertError(status.error()));
+    return true;
+}
+
+}
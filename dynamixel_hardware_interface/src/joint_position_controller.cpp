@@ -69,7 +69,9 @@ bool JointPositionController::initialize(std::string name,
     {
       ROS_WARN("%s: motor %d is not set to position control mode, setting motor to position control mode", name_.c_str(), motor_id);
 
-      if (!dxl_io_->setAngleLimits(motor_id, 0, motor_model_max_encoder_))
+      if (!runOnBus(BusScheduler::HOUSEKEEPING,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setAngleLimits, dxl_io_,
+                                motor_id, 0, motor_model_max_encoder_)))
       {
         ROS_ERROR("%s: unable to set motor %d to position control mode", name_.c_str(), motor_id);
         return false;
@@ -136,26 +138,33 @@ std::vector<std::vector<int> > JointPositionController::getRawMotorCommands(doub
   return value_pairs;
 }
 
-void JointPositionController::processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg)
+void JointPositionController::getRawMotorGoals(double position, double velocity,
+                                               dynamixel_hardware_interface::DynamixelGoal* goals)
 {
-  dynamixel_hardware_interface::MotorState state;
-  int master_id = motor_ids_[0];
+  uint16_t pos_enc = posRad2Enc(position);
+  uint16_t vel_enc = velRad2Enc(velocity);
 
-  for (size_t i = 0; i < msg->motor_states.size(); ++i)
+  for (size_t i = 0; i < motor_ids_.size(); ++i)
   {
-    if (master_id == msg->motor_states[i].id)
+    int motor_id = motor_ids_[i];
+
+    goals[i].id = motor_id;
+    goals[i].velocity = vel_enc;
+
+    // slave motors in reverse drive mode mirror the master, e.g. smart arm double joints
+    if (i > 0 && drive_mode_reversed_[motor_id])
     {
-      state = msg->motor_states[i];
-      break;
+      goals[i].position = motor_model_max_encoder_ - pos_enc;
+    }
+    else
+    {
+      goals[i].position = pos_enc;
     }
   }
+}
 
-  if (state.id != master_id)
-  {
-    ROS_ERROR("%s: motor %d not found in motor states message", name_.c_str(), master_id);
-    return;
-  }
-
+void JointPositionController::processMotorState(const dynamixel_hardware_interface::MotorState& state)
+{
   joint_state_.header.stamp = ros::Time(state.timestamp);
   joint_state_.target_position = convertToRadians(state.target_position);
   joint_state_.target_velocity = ((double)state.target_velocity / dynamixel_hardware_interface::DXL_MAX_VELOCITY_ENCODER) * motor_max_velocity_;
@@ -205,7 +214,7 @@ void JointPositionController::processCommand(const std_msgs::Float64ConstPtr& ms
     mcv.push_back(pair);
   }
 
-  dxl_io_->setMultiPosition(mcv);
+  runOnBus(BusScheduler::SETPOINT, boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiPosition, dxl_io_, mcv));
 }
 
 bool JointPositionController::setVelocity(double velocity)
@@ -227,7 +236,7 @@ bool JointPositionController::setVelocity(double velocity)
   // Remember velcity in case servos get reset
   current_velocity_ = velocity;
 
-  return dxl_io_->setMultiVelocity(mcv);
+  return runOnBus(BusScheduler::SETPOINT, boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiVelocity, dxl_io_, mcv));
 }
 
 bool JointPositionController::processSetVelocity(dynamixel_hardware_interface::SetVelocity::Request& req,
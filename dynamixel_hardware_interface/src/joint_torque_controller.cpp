@@ -64,7 +64,9 @@ bool JointTorqueController::initialize(std::string name,
         {
             ROS_WARN("%s: motor %d is not set to torque control mode, setting motor to torque control mode", name_.c_str(), motor_ids_[i]);
             
-            if (!dxl_io_->setAngleLimits(motor_ids_[i], 0, 0))
+            if (!runOnBus(BusScheduler::HOUSEKEEPING,
+                          boost::bind(&dynamixel_hardware_interface::DynamixelIO::setAngleLimits, dxl_io_,
+                                      motor_ids_[i], 0, 0)))
             {
                 ROS_ERROR("%s: unable to set motor to torque control mode", name_.c_str());
                 return false;
@@ -117,26 +119,8 @@ std::vector<std::vector<int> > JointTorqueController::getRawMotorCommands(double
     return mcv;
 }
 
-void JointTorqueController::processMotorStates(const dynamixel_hardware_interface::MotorStateListConstPtr& msg)
+void JointTorqueController::processMotorState(const dynamixel_hardware_interface::MotorState& state)
 {
-    dynamixel_hardware_interface::MotorState state;
-    int master_id = motor_ids_[0];
-    
-    for (size_t i = 0; i < msg->motor_states.size(); ++i)
-    {
-        if (master_id == msg->motor_states[i].id)
-        {
-            state = msg->motor_states[i];
-            break;
-        }
-    }
-    
-    if (state.id != master_id)
-    {
-        ROS_ERROR("%s: motor id %d not found", name_.c_str(), master_id);
-        return;
-    }
-    
     joint_state_.header.stamp = ros::Time(state.timestamp);
     joint_state_.target_position = convertToRadians(state.target_position);
     joint_state_.target_velocity = ((double)state.target_velocity / dynamixel_hardware_interface::DXL_MAX_VELOCITY_ENCODER) * motor_max_velocity_;
@@ -158,7 +142,9 @@ void JointTorqueController::processCommand(const std_msgs::Float64ConstPtr& msg)
 
 bool JointTorqueController::setVelocity(double velocity)
 {
-    return dxl_io_->setMultiVelocity(getRawMotorCommands(0.0, velocity));
+    return runOnBus(BusScheduler::SETPOINT,
+                    boost::bind(&dynamixel_hardware_interface::DynamixelIO::setMultiVelocity, dxl_io_,
+                                getRawMotorCommands(0.0, velocity)));
 }
 
 bool JointTorqueController::processSetVelocity(dynamixel_hardware_interface::SetVelocity::Request& req,
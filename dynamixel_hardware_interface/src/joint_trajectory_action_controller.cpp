@@ -26,6 +26,14 @@
 */
 
 // Standard
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <map>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -34,6 +42,7 @@
 // Dynamixel Low Level
 #include <dynamixel_hardware_interface/dynamixel_const.h>
 #include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/realtime_thread.h>
 
 // Dynamixel Controllers
 #include <dynamixel_hardware_interface/single_joint_controller.h>
@@ -46,20 +55,17 @@
 
 // Messages
 #include <dynamixel_hardware_interface/JointState.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <trajectory_msgs/JointTrajectory.h>
 #include <control_msgs/FollowJointTrajectoryAction.h>
 
 // ROS
 #include <ros/ros.h>
-#include <ros/package.h> // for getting package file path
 #include <pluginlib/class_list_macros.h>
+#include <diagnostic_updater/DiagnosticStatusWrapper.h>
 
 // Boost
-#include <boost/filesystem.hpp>  // for error logging to file
-
-// TODO: remove. For recording data
-#include <iostream>
-#include <fstream>
+#include <boost/lexical_cast.hpp>
 
 PLUGINLIB_DECLARE_CLASS(dynamixel_hardware_interface,
                         JointTrajectoryActionController,
@@ -70,12 +76,164 @@ namespace controller
 {
 // TODO: lower this const:
 static const double ACCEPTABLE_BOUND = 0.05; // amount two positions can vary without being considered different positions.
-static const bool USE_ERROR_OUTPUT_LOG = false; // during trajectory execution, log the position and velcoty error
+
+namespace
+{
+
+// Matches position and velocity at both ends, and acceleration as well for a quintic
+Spline fitSpline(double p0, double v0, double a0, double p1, double v1, double a1, double T, bool quintic)
+{
+  Spline s = { { p0, v0, 0.0, 0.0, 0.0, 0.0 } };
+
+  double T2 = T * T;
+  double T3 = T2 * T;
+
+  if (quintic)
+  {
+    double T4 = T3 * T;
+    double T5 = T4 * T;
+
+    s.c[2] = a0 / 2.0;
+    s.c[3] = (20.0 * (p1 - p0) - (8.0 * v1 + 12.0 * v0) * T - (3.0 * a0 - a1) * T2) / (2.0 * T3);
+    s.c[4] = (30.0 * (p0 - p1) + (14.0 * v1 + 16.0 * v0) * T + (3.0 * a0 - 2.0 * a1) * T2) / (2.0 * T4);
+    s.c[5] = (12.0 * (p1 - p0) - 6.0 * (v1 + v0) * T + (a1 - a0) * T2) / (2.0 * T5);
+  }
+  else
+  {
+    s.c[2] = (3.0 * (p1 - p0) - (2.0 * v0 + v1) * T) / T2;
+    s.c[3] = (2.0 * (p0 - p1) + (v0 + v1) * T) / T3;
+  }
+
+  return s;
+}
+
+double splinePosition(const Spline& s, double t)
+{
+  return s.c[0] + t * (s.c[1] + t * (s.c[2] + t * (s.c[3] + t * (s.c[4] + t * s.c[5]))));
+}
+
+double splineVelocity(const Spline& s, double t)
+{
+  return s.c[1] + t * (2.0 * s.c[2] + t * (3.0 * s.c[3] + t * (4.0 * s.c[4] + t * 5.0 * s.c[5])));
+}
+
+double splineAcceleration(const Spline& s, double t)
+{
+  return 2.0 * s.c[2] + t * (6.0 * s.c[3] + t * (12.0 * s.c[4] + t * 20.0 * s.c[5]));
+}
+
+// Fastest a spline moves from 0 to T, which is at either end or where its acceleration
+// crosses zero. The acceleration is at most a cubic, its roots are bracketed on a grid fine
+// enough to tell them apart and then bisected.
+double splinePeakSpeed(const Spline& s, double T)
+{
+  const int GRID_STEPS = 32;
+  const int BISECTIONS = 40;
+
+  double peak = std::max(std::abs(splineVelocity(s, 0.0)), std::abs(splineVelocity(s, T)));
+  double t0 = 0.0;
+  double a0 = splineAcceleration(s, 0.0);
+
+  for (int k = 1; k <= GRID_STEPS; ++k)
+  {
+    double t1 = T * k / GRID_STEPS;
+    double a1 = splineAcceleration(s, t1);
+
+    if ((a0 < 0.0) != (a1 < 0.0))
+    {
+      double lo = t0;
+      double hi = t1;
+
+      for (int n = 0; n < BISECTIONS; ++n)
+      {
+        double mid = 0.5 * (lo + hi);
+        if ((splineAcceleration(s, mid) < 0.0) == (a0 < 0.0)) { lo = mid; }
+        else { hi = mid; }
+      }
+
+      peak = std::max(peak, std::abs(splineVelocity(s, 0.5 * (lo + hi))));
+    }
+
+    t0 = t1;
+    a0 = a1;
+  }
+
+  return peak;
+}
+
+using dynamixel_hardware_interface::NSEC_PER_SEC;
+using dynamixel_hardware_interface::diffNsec;
+
+double toSeconds(const struct timespec& ts)
+{
+  return ts.tv_sec + ts.tv_nsec / (double) NSEC_PER_SEC;
+}
+
+double monotonicNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return toSeconds(ts);
+}
+
+// Swaps the head of a list of posted plans, a full barrier so a plan is complete before it can be seen
+TrajectoryPlan* exchangePlans(TrajectoryPlan* volatile* head, TrajectoryPlan* plans)
+{
+  TrajectoryPlan* old = *head;
+  TrajectoryPlan* seen;
+
+  while ((seen = __sync_val_compare_and_swap(head, old, plans)) != old)
+  {
+    old = seen;
+  }
+
+  return old;
+}
+
+void releasePlan(TrajectoryPlan* plan)
+{
+  if (__sync_sub_and_fetch(&plan->refs, 1) == 0)
+  {
+    delete plan;
+  }
+}
+
+}
+
+TrajectoryPlan::TrajectoryPlan()
+  : streamed(false),
+    quintic(false),
+    start_time(0.0),
+    end_time(0.0),
+    segment(0),
+    sent(false),
+    back_half(false),
+    settling(false),
+    settle_time(0.0),
+    next(NULL),
+    cancel(false),
+    finished(false),
+    error_code(control_msgs::FollowJointTrajectoryResult::SUCCESSFUL),
+    preempted(false),
+    refs(1)
+{
+}
 
 
 JointTrajectoryActionController::JointTrajectoryActionController()
 {
   terminate_ = false;
+  posted_plans_ = NULL;
+  executing_ = false;
+  sent_plan_ = NULL;
+  executor_priority_ = 0;
+  executor_cpu_ = -1;
+  trace_capacity_ = 0;
+  overruns_ = 0;
+  wakeup_jitter_.clear();
+  tick_time_.clear();
+  feedback_thread_ = NULL;
+  executor_thread_ = NULL;
 }
 
 JointTrajectoryActionController::~JointTrajectoryActionController()
@@ -99,14 +257,31 @@ bool JointTrajectoryActionController::initialize(std::string name,
   c_nh_.param<double>(prefix + "goal_time", goal_time_constraint_, 0.0);
   c_nh_.param<double>(prefix + "stopped_velocity_tolerance", stopped_velocity_tolerance_, 0.01);
   c_nh_.param<double>("joint_trajectory_action_node/min_velocity", min_velocity_, 0.1);
+  c_nh_.param<bool>("joint_trajectory_action_node/streaming/enabled", stream_setpoints_, false);
+  c_nh_.param<double>("joint_trajectory_action_node/streaming/rate", stream_rate_, 50.0);
+  c_nh_.param<int>("joint_trajectory_action_node/executor/realtime_priority", executor_priority_, 0);
+  c_nh_.param<int>("joint_trajectory_action_node/executor/cpu_affinity", executor_cpu_, -1);
+  c_nh_.param<std::string>("joint_trajectory_action_node/trace/file", trace_file_, "");
+  c_nh_.param<int>("joint_trajectory_action_node/trace/capacity", trace_capacity_, 10000);
+
+  if (stream_setpoints_ && stream_rate_ <= 0.0)
+  {
+    ROS_ERROR("%s: streaming rate has to be positive, sending waypoints instead", name_.c_str());
+    stream_setpoints_ = false;
+  }
 
+  commanded_.resize(num_joints_);
   goal_constraints_.resize(num_joints_);
   trajectory_constraints_.resize(num_joints_);
+  trace_states_.resize(num_joints_);
+  trace_desired_.resize(num_joints_);
+  trace_actual_.resize(num_joints_);
 
   for (size_t i = 0; i < num_joints_; ++i)
   {
     c_nh_.param<double>(prefix + joint_names_[i] + "/goal", goal_constraints_[i], -1.0);
     c_nh_.param<double>(prefix + joint_names_[i] + "/trajectory", trajectory_constraints_[i], -1.0);
+    trace_states_[i] = joint_states_[joint_names_[i]];
   }
 
   // Setup/resize feedback message
@@ -128,16 +303,35 @@ void JointTrajectoryActionController::start()
 {
   command_sub_ = c_nh_.subscribe("command", 50, &JointTrajectoryActionController::processCommand, this);
   state_pub_ = c_nh_.advertise<control_msgs::FollowJointTrajectoryFeedback>("state", 50);
+  diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 50);
 
   action_server_.reset(new FJTAS(c_nh_, "follow_joint_trajectory",
                                  boost::bind(&JointTrajectoryActionController::processFollowTrajectory, this, _1),
                                  false));
   action_server_->start();
+
+  if (!trace_file_.empty())
+  {
+    if (trace_capacity_ > 0 && trace_.open(trace_file_, joint_names_, trace_capacity_))
+    {
+      ROS_INFO("%s: tracing trajectory tracking errors to %s", name_.c_str(), trace_file_.c_str());
+    }
+    else
+    {
+      ROS_WARN("%s: unable to trace trajectory tracking errors to %s", name_.c_str(), trace_file_.c_str());
+    }
+  }
+
   feedback_thread_ = new boost::thread(boost::bind(&JointTrajectoryActionController::updateState, this));
+  executor_thread_ = new boost::thread(boost::bind(&JointTrajectoryActionController::executeTrajectories, this));
 }
 
 void JointTrajectoryActionController::stop()
 {
+  command_sub_.shutdown();
+
+  // from here on goals are refused, the executor finishes whatever was posted before and a goal
+  // callback waiting on one of those returns once it has
   {
     boost::mutex::scoped_lock terminate_lock(terminate_mutex_);
     terminate_ = true;
@@ -146,23 +340,19 @@ void JointTrajectoryActionController::stop()
   feedback_thread_->join();
   delete feedback_thread_;
 
-  command_sub_.shutdown();
+  executor_thread_->join();
+  delete executor_thread_;
+
+  trace_.close();
+
   state_pub_.shutdown();
+  diagnostics_pub_.shutdown();
   action_server_->shutdown();
 }
 
+// Posts the trajectory to the executor and returns, it takes over from any goal being executed
 void JointTrajectoryActionController::processCommand(const trajectory_msgs::JointTrajectoryConstPtr& msg)
 {
-  if (action_server_->isActive())
-  {
-    action_server_->setPreempted();
-  }
-
-  while (action_server_->isActive())
-  {
-    ros::Duration(0.01).sleep();
-  }
-
   processTrajectory(*msg, false);
 }
 
@@ -176,6 +366,7 @@ void JointTrajectoryActionController::processFollowTrajectory(const control_msgs
 void JointTrajectoryActionController::updateState()
 {
   ros::Rate rate(state_update_rate_);
+  int cycles = 0;
 
   while (nh_.ok())
   {
@@ -184,6 +375,13 @@ void JointTrajectoryActionController::updateState()
       if (terminate_) { break; }
     }
 
+    // executor statistics go out about once a second
+    if (++cycles >= state_update_rate_)
+    {
+      publishExecutorDiagnostics();
+      cycles = 0;
+    }
+
     feedback_msg_.header.stamp = ros::Time::now();
 
     for (size_t j = 0; j < joint_names_.size(); ++j)
@@ -353,6 +551,16 @@ void JointTrajectoryActionController::processTrajectory(const trajectory_msgs::J
       seg.velocities[j] = point.velocities[lookup[j]];
       seg.positions[j] = point.positions[lookup[j]];
     }
+
+    // Accelerations are optional, streaming matches them when every point has them
+    if (point.accelerations.size() == num_joints_)
+    {
+      seg.accelerations.resize(num_joints_);
+      for (size_t j = 0; j < num_joints_; ++j)
+      {
+        seg.accelerations[j] = point.accelerations[lookup[j]];
+      }
+    }
     trajectory.push_back(seg);
   }
 
@@ -377,100 +585,249 @@ void JointTrajectoryActionController::processTrajectory(const trajectory_msgs::J
       break;
     }
   }
-  // Check if all the states were inside the position bounds
-  if( !outside_bounds )
+  // Check if all the states were inside the position bounds, while another trajectory is being
+  // executed this one still has to take over from it
+  if( !outside_bounds && !executing_ )
   {
     // We can exit trajectory
     traj_result.error_code = control_msgs::FollowJointTrajectoryResult::SUCCESSFUL;
     error_msg = "Trajectory execution skipped because goal is same as current state";
     ROS_INFO("%s", error_msg.c_str());
-    action_server_->setSucceeded(traj_result, error_msg);
+    if (is_action)
+    {
+      action_server_->setSucceeded(traj_result, error_msg);
+    }
     return;
   }
     ROS_INFO("6");
 
+  // Work out every goal the bus will be sent now, so that a trajectory that would exceed a
+  // joint's max velocity is rejected before anything moves and executing it is only sending
+  TrajectoryPlan* plan = new TrajectoryPlan();
+
+  if (!compileTrajectory(trajectory, *plan, error_msg))
+  {
+    delete plan;
+    traj_result.error_code = control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED;
+    ROS_ERROR("%s", error_msg.c_str());
+    if (is_action)
+    {
+      action_server_->setAborted(traj_result, error_msg);
+    }
+    return;
+  }
+
   // Set the compliance margin and slope
   // TODO: move this to configuration file
   int traj_compliance_margin = 1;
   int traj_compliance_slope = 10; //20
   MultiJointController::setAllComplianceMarginSlope( traj_compliance_margin, traj_compliance_slope );
     ROS_INFO("7");
-  // -----------------------------------------------------------------------------------------------
-  // Log position and velocity error for each joint to file
-  std::ofstream error_log_file;
-  std::string error_log_string;
-  if( USE_ERROR_OUTPUT_LOG )
+
+  ROS_INFO("Trajectory start time is %.3lf, end time is %.3lf, total duration is %.3lf",
+           trajectory.front().start_time, trajectory.back().start_time + trajectory.back().duration,
+           trajectory_duration);
+
+  trajectory_ = trajectory;
+
+  // The executor holds on to the plan until it is done with it, an action goal's callback until
+  // it has reported the result
+  plan->refs = is_action ? 2 : 1;
+
+  // a plan posted once the controller is stopping would never be finished
+  bool posted = false;
+
   {
-    std::string error_log_path;
-    getUniqueErrorLogPath(error_log_path);
+    boost::mutex::scoped_lock terminate_lock(terminate_mutex_);
 
-    // Save results to file
-    error_log_file.open(error_log_path.c_str());
+    if (!terminate_)
+    {
+      postPlan(plan);
+      posted = true;
+    }
+  }
 
-    // Output list of joint names to first line of erronnr log
-    for (size_t j = 0; j < joint_names_.size(); ++j)
+  if (!posted)
+  {
+    delete plan;
+    traj_result.error_code = control_msgs::FollowJointTrajectoryResult::INVALID_GOAL;
+    error_msg = "Controller is stopping, trajectory rejected.";
+    ROS_WARN("%s", error_msg.c_str());
+    if (is_action)
     {
-      if(!j) // no comma before first item
-        error_log_file << joint_names_[j];
-      else
-        error_log_file << "," << joint_names_[j];
+      action_server_->setAborted(traj_result, error_msg);
     }
-    error_log_file << "\n";
+    return;
   }
-    ROS_INFO("8");
-  // Wait until we've reached the trajectory start time
-  ROS_INFO("Trajectory start requested at %.3lf, waiting...", traj_msg.header.stamp.toSec());
-  ros::Time::sleepUntil(traj_msg.header.stamp);
 
-  ros::Time end_time = traj_msg.header.stamp + ros::Duration(trajectory_duration);
-  std::vector<ros::Time> seg_end_times(num_points, ros::Time(0.0));
+  if (!is_action)
+  {
+    return;
+  }
 
-  for (int i = 0; i < num_points; ++i)
+  // A new goal takes over from this one where it starts, so the arm keeps moving until then,
+  // only a cancel has the executor stop it where it is
+  while (!plan->finished)
   {
-    seg_end_times[i] = ros::Time(trajectory[i].start_time + durations[i]);
+    if (action_server_->isPreemptRequested())
+    {
+      if (action_server_->isNewGoalAvailable())
+      {
+        traj_result.error_code = control_msgs::FollowJointTrajectoryResult::SUCCESSFUL;
+        error_msg = "New trajectory received. It takes over from the old one where it starts.";
+        action_server_->setPreempted(traj_result, error_msg);
+        ROS_WARN("%s", error_msg.c_str());
+        releasePlan(plan);
+        return;
+      }
+
+      plan->cancel = true;
+    }
+
+    ros::Duration(0.01).sleep();
   }
 
-  ROS_INFO("Trajectory start time is %.3lf, end time is %.3lf, total duration is %.3lf", time.toSec(), end_time.toSec(), trajectory_duration);
+  __sync_synchronize();
+  traj_result.error_code = plan->error_code;
 
-  trajectory_ = trajectory;
-  ros::Time traj_start_time = ros::Time::now();
-  ros::Rate rate(update_rate_);
+  if (plan->preempted)
+  {
+    action_server_->setPreempted(traj_result, plan->error_msg);
+  }
+  else if (plan->error_code == control_msgs::FollowJointTrajectoryResult::SUCCESSFUL)
+  {
+    action_server_->setSucceeded(traj_result, plan->error_msg);
+  }
+  else
+  {
+    action_server_->setAborted(traj_result, plan->error_msg);
+  }
+
+  releasePlan(plan);
+}
+
+// Works out the goal of every motor for every segment with a duration, in encoder units, or
+// fits the splines a streamed trajectory follows and lays out its ports. Returns false with
+// error_msg set if a segment would exceed a joint's max velocity.
+bool JointTrajectoryActionController::compileTrajectory(const std::vector<Segment>& trajectory,
+                                                        TrajectoryPlan& plan, std::string& error_msg)
+{
+  // the executor keeps time by CLOCK_MONOTONIC, not by ROS time
+  const double to_monotonic = monotonicNow() - ros::Time::now().toSec();
+
+  plan.start_time = trajectory.front().start_time + to_monotonic;
+  plan.end_time = trajectory.back().start_time + trajectory.back().duration + to_monotonic;
 
-  //------------------------------------------------------------------------------------------------
-  // The main loop - sends motor commands once per for loop
-  for (int traj_seg = 0; traj_seg < num_points; ++traj_seg)
+  if (stream_setpoints_)
   {
-    ROS_DEBUG("Processing segment %d -------------------------------------------------", traj_seg);
+    plan.streamed = true;
 
-    // first point in trajectories calculated by OMPL is current position with duration of 0 seconds, skip it
-    if (durations[traj_seg] == 0.0)
+    // quintics match accelerations as well, which needs every point to have them
+    plan.quintic = true;
+    for (size_t i = 0; i < trajectory.size(); ++i)
     {
-      ROS_DEBUG("Skipping segment %d because duration is 0", traj_seg);
-      continue;
+      if (trajectory[i].accelerations.empty())
+        plan.quintic = false;
+    }
+
+    // Segments of no duration, such as the current state planners put first, only set where the
+    // next segment starts from
+    std::vector<double> position(num_joints_);
+    std::vector<double> velocity(num_joints_, 0.0);
+    std::vector<double> acceleration(num_joints_, 0.0);
+
+    for (size_t j = 0; j < num_joints_; ++j)
+    {
+      position[j] = joint_states_[joint_names_[j]]->position;
+    }
+
+    for (size_t i = 0; i < trajectory.size(); ++i)
+    {
+      const Segment& seg = trajectory[i];
+
+      if (seg.duration > 0.0)
+      {
+        std::vector<Spline> seg_splines(num_joints_);
+        for (size_t j = 0; j < num_joints_; ++j)
+        {
+          seg_splines[j] = fitSpline(position[j], velocity[j], acceleration[j],
+                                     seg.positions[j], seg.velocities[j], plan.quintic ? seg.accelerations[j] : 0.0,
+                                     seg.duration, plan.quintic);
+        }
+
+        if (!checkSplineVelocities(seg_splines, seg.duration, i, error_msg))
+          return false;
+
+        plan.segments.push_back(seg);
+        plan.segments.back().start_time += to_monotonic;
+        plan.splines.push_back(seg_splines);
+      }
+
+      position = seg.positions;
+      velocity = seg.velocities;
+      if (plan.quintic)
+        acceleration = seg.accelerations;
     }
 
-    // List of every port, and that port's corresponding commands for every motor
-    std::map<std::string, std::vector<std::vector<int> > > multi_port_commands;
+    // Every tick looks the joints up by index and converts them straight into these goals
+    for (std::map<std::string, std::vector<std::string> >::const_iterator port_it =
+           port_to_joints_.begin(); port_it != port_to_joints_.end(); ++port_it)
+    {
+      TrajectoryPlan::Port port;
+      port.bus_scheduler = port_to_scheduler_[port_it->first];
+      port.dxl_io = port_to_io_[port_it->first];
+      port.motor_count = 0;
+
+      for (std::vector<std::string>::const_iterator joint_it = port_it->second.begin();
+           joint_it != port_it->second.end(); ++joint_it)
+      {
+        size_t motors = joint_to_controller_[*joint_it]->getMotorIDs().size();
 
-    // -----------------------------------------------------------------------------------------
-    // Combine all the commands for every motor of every joint that is on the same port into one
-    // "multi_port_commands"
+        port.joints.push_back(joint_to_idx_[*joint_it]);
+        port.joint_motors.push_back(motors);
+        port.motor_count += motors;
+      }
+
+      port.goals.resize(2 * port.motor_count);
+      plan.ports.push_back(port);
+    }
 
-    // Loop through every port in this multi joint controller
-    for ( std::map<std::string, std::vector<std::string> >::const_iterator port_it =
-            port_to_joints_.begin(); port_it != port_to_joints_.end(); ++port_it)
+    return true;
+  }
+
+  // first point in trajectories calculated by OMPL is current position with duration of 0 seconds, skip it
+  for (size_t i = 0; i < trajectory.size(); ++i)
+  {
+    if (trajectory[i].duration == 0.0)
     {
-      ROS_DEBUG_STREAM("Processing Port " << port_it->first );
+      ROS_DEBUG("Skipping segment %d because duration is 0", (int) i);
+      continue;
+    }
+
+    plan.waypoints.push_back(i);
+    plan.end_times.push_back(trajectory[i].start_time + trajectory[i].duration + to_monotonic);
+  }
 
-      // List of all commands for a particular port
-      std::vector<std::vector<int> > port_motor_commands;
+  size_t num_segments = plan.waypoints.size();
+
+  // Loop through every port in this multi joint controller
+  for (std::map<std::string, std::vector<std::string> >::const_iterator port_it =
+         port_to_joints_.begin(); port_it != port_to_joints_.end(); ++port_it)
+  {
+    TrajectoryPlan::Port port;
+    port.bus_scheduler = port_to_scheduler_[port_it->first];
+    port.dxl_io = port_to_io_[port_it->first];
+
+    for (size_t k = 0; k < num_segments; ++k)
+    {
+      int traj_seg = plan.waypoints[k];
 
       // Loop through every joint on the port
-      for ( std::vector<std::string>::const_iterator joint_it = port_it->second.begin();
-            joint_it != port_it->second.end(); ++joint_it)
+      for (std::vector<std::string>::const_iterator joint_it = port_it->second.begin();
+           joint_it != port_it->second.end(); ++joint_it)
       {
-        // Cache joint data
         int joint_idx = joint_to_idx_[*joint_it];
+        const boost::shared_ptr<SingleJointController>& joint_controller = joint_to_controller_[*joint_it];
 
         // Get start position of this joint
         double start_position;
@@ -487,213 +844,619 @@ void JointTrajectoryActionController::processTrajectory(const trajectory_msgs::J
         double desired_position = trajectory[traj_seg].positions[joint_idx];
         double desired_velocity = std::max<double>(min_velocity_,
                                                    std::abs(desired_position - start_position) /
-                                                   durations[traj_seg]);
+                                                   trajectory[traj_seg].duration);
 
-        ROS_DEBUG("\tstart_position: %f, duration: %f", start_position, durations[traj_seg]);
         ROS_DEBUG("\tport: %s, joint: %s, dpos: %f, dvel: %f", port_it->first.c_str(),
                   joint_it->c_str(), desired_position, desired_velocity);
 
         // Check that desired_veclocity is not too high, e.g. the position difference not too large
-        if( desired_velocity > joint_to_controller_[*joint_it]->getMaxVelocity() )
+        if (desired_velocity > joint_controller->getMaxVelocity())
         {
-          traj_result.error_code = control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED;
           error_msg = "Invalid joint trajectory: max velocity exceeded for joint " + *joint_it +
             " with a velocity of " + boost::lexical_cast<std::string>(desired_velocity) +
             " when the max velocity is set to " +
-            boost::lexical_cast<std::string>(joint_to_controller_[*joint_it]->getMaxVelocity()) +
+            boost::lexical_cast<std::string>(joint_controller->getMaxVelocity()) +
             ". On trajectory step " + boost::lexical_cast<std::string>(traj_seg);
-          ROS_ERROR("%s", error_msg.c_str());
-          if (is_action)
-          {
-            action_server_->setAborted(traj_result, error_msg);
-          }
-          return;
+          return false;
         }
 
-        // Generate raw motor commands
+        // Generate raw motor commands, one goal per motor
         std::vector<std::vector<int> > joint_motor_commands =
-          joint_to_controller_[*joint_it]->getRawMotorCommands(desired_position, desired_velocity);
+          joint_controller->getRawMotorCommands(desired_position, desired_velocity);
 
-        // Copy raw motor commands to port vector
         for (size_t i = 0; i < joint_motor_commands.size(); ++i)
         {
-          port_motor_commands.push_back(joint_motor_commands[i]);
+          dynamixel_hardware_interface::DynamixelGoal goal;
+          goal.id = joint_motor_commands[i][0];
+          goal.position = joint_motor_commands[i][1];
+          goal.velocity = joint_motor_commands[i][2];
+          port.goals.push_back(goal);
         }
-
-        // Copy port vector to multi port vector
-        multi_port_commands[port_it->first] = port_motor_commands;
       }
     }
 
-    // Loop through every port and send it their raw commands
-    for ( std::map<std::string, std::vector<std::vector<int> > >::const_iterator
-            multi_port_commands_it = multi_port_commands.begin();
-          multi_port_commands_it != multi_port_commands.end(); ++multi_port_commands_it)
+    port.motor_count = (num_segments > 0) ? port.goals.size() / num_segments : 0;
+    plan.ports.push_back(port);
+  }
+
+  return true;
+}
+
+// Pushes plan onto the list the executor takes at its next tick
+void JointTrajectoryActionController::postPlan(TrajectoryPlan* plan)
+{
+  TrajectoryPlan* head;
+
+  do
+  {
+    head = posted_plans_;
+    plan->next = head;
+  } while (__sync_val_compare_and_swap(&posted_plans_, head, plan) != head);
+}
+
+// Executes posted plans until the controller stops, one tick per update period. A plan takes
+// over from the one being executed once it is due and replaces any queued to start after it.
+void JointTrajectoryActionController::executeTrajectories()
+{
+  dynamixel_hardware_interface::applyRealtimeSettings(name_, "executor", executor_priority_, executor_cpu_);
+
+  std::deque<TrajectoryPlan*> queued;
+  TrajectoryPlan* active = NULL;
+
+  // every tick is due a whole period after the previous one, no matter how long the ticks
+  // take, so the rate does not drift
+  const int64_t period_nsec = (int64_t) (NSEC_PER_SEC / (stream_setpoints_ ? stream_rate_ : update_rate_));
+  struct timespec deadline;
+  struct timespec start;
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (nh_.ok())
+  {
     {
-      port_to_io_[multi_port_commands_it->first]->setMultiPositionVelocity(multi_port_commands_it->second);
+      boost::mutex::scoped_lock terminate_lock(terminate_mutex_);
+      if (terminate_) { break; }
     }
 
-    // Now wait for the next segment to be ready to go
-    while (time < seg_end_times[traj_seg])
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t wakeup_nsec = std::max<int64_t>(diffNsec(start, deadline), 0);
+    double now = toSeconds(start);
+
+    // the list comes newest first
+    TrajectoryPlan* posted = exchangePlans(&posted_plans_, NULL);
+    TrajectoryPlan* oldest = NULL;
+
+    while (posted)
+    {
+      TrajectoryPlan* next = posted->next;
+      posted->next = oldest;
+      oldest = posted;
+      posted = next;
+    }
+
+    while (oldest)
     {
-      // check if new trajectory was received, if so abort old one by setting the desired state to current state
-      if (is_action && action_server_->isPreemptRequested())
+      TrajectoryPlan* plan = oldest;
+      oldest = plan->next;
+
+      while (!queued.empty() && queued.back()->start_time >= plan->start_time)
       {
-        traj_result.error_code = control_msgs::FollowJointTrajectoryResult::SUCCESSFUL;
-        error_msg = "New trajectory received. Aborting old trajectory.";
+        finishPlan(queued.back(), control_msgs::FollowJointTrajectoryResult::SUCCESSFUL,
+                   "Trajectory replaced by a new one before it started.", true);
+        queued.pop_back();
+      }
 
-        std::map<std::string, std::vector<std::vector<int> > > multi_port_commands;
+      queued.push_back(plan);
+    }
 
-        std::map<std::string, std::vector<std::string> >::const_iterator port_it;
-        std::vector<std::string>::const_iterator joint_it;
+    for (std::deque<TrajectoryPlan*>::iterator it = queued.begin(); it != queued.end(); )
+    {
+      if ((*it)->cancel)
+      {
+        finishPlan(*it, control_msgs::FollowJointTrajectoryResult::SUCCESSFUL,
+                   "Trajectory canceled before it started.", true);
+        it = queued.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
 
-        for (port_it = port_to_joints_.begin(); port_it != port_to_joints_.end(); ++port_it)
-        {
-          std::vector<std::vector<int> > port_motor_commands;
+    while (!queued.empty() && queued.front()->start_time <= now)
+    {
+      TrajectoryPlan* plan = queued.front();
+      queued.pop_front();
 
-          for (joint_it = port_it->second.begin(); joint_it != port_it->second.end(); ++joint_it)
-          {
-            std::string joint = *joint_it;
+      std::string error_msg;
 
-            double desired_position = joint_states_[joint]->position;
-            double desired_velocity = joint_states_[joint]->velocity;
+      if (!beginPlan(plan, active, now, error_msg))
+      {
+        finishPlan(plan, control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED, error_msg);
+        continue;
+      }
 
-            std::vector<std::vector<int> > joint_motor_commands = joint_to_controller_[joint]->getRawMotorCommands(desired_position, desired_velocity);
-            for (size_t i = 0; i < joint_motor_commands.size(); ++i)
-            {
-              port_motor_commands.push_back(joint_motor_commands[i]);
-            }
+      if (active)
+      {
+        finishPlan(active, control_msgs::FollowJointTrajectoryResult::SUCCESSFUL,
+                   "New trajectory received. It took over from the old one.", true);
+      }
 
-            multi_port_commands[port_it->first] = port_motor_commands;
-          }
-        }
+      active = plan;
+    }
 
-        std::map<std::string, std::vector<std::vector<int> > >::const_iterator multi_port_commands_it;
-        for (multi_port_commands_it = multi_port_commands.begin(); multi_port_commands_it != multi_port_commands.end(); ++multi_port_commands_it)
-        {
-          port_to_io_[multi_port_commands_it->first]->setMultiPositionVelocity(multi_port_commands_it->second);
-        }
+    bool traced = (active != NULL);
 
-        action_server_->setPreempted(traj_result, error_msg);
-        ROS_WARN("%s", error_msg.c_str());
-        return;
+    if (active && !tickPlan(active, now))
+    {
+      active = NULL;
+    }
+
+    // a record of where the joints are against where they were sent, for every tick a plan executed in
+    if (traced && trace_.isOpen())
+    {
+      for (size_t j = 0; j < num_joints_; ++j)
+      {
+        trace_desired_[j] = trace_states_[j]->target_position;
+        trace_actual_[j] = trace_states_[j]->position;
       }
 
-      rate.sleep();
-      time = ros::Time::now();
+      trace_.push(start.tv_sec * NSEC_PER_SEC + start.tv_nsec, &trace_desired_[0], &trace_actual_[0]);
     }
 
-    // -----------------------------------------------------------------------------------------
-    // Verifies trajectory constraints
-    for (size_t j = 0; j < joint_names_.size(); ++j)
+    executing_ = (active != NULL || !queued.empty());
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t missed = dynamixel_hardware_interface::advanceDeadline(deadline, period_nsec, end);
+
+    {
+      boost::mutex::scoped_lock stats_lock(executor_stats_mutex_);
+      wakeup_jitter_.record(wakeup_nsec / 1000);
+      tick_time_.record(diffNsec(end, start) / 1000);
+      overruns_ += missed;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+  }
+
+  // The controller is stopping, whatever is left ends where it is
+  if (active)
+  {
+    queued.push_back(active);
+  }
+
+  for (TrajectoryPlan* posted = exchangePlans(&posted_plans_, NULL); posted; posted = posted->next)
+  {
+    queued.push_back(posted);
+  }
+
+  for (size_t i = 0; i < queued.size(); ++i)
+  {
+    finishPlan(queued[i], control_msgs::FollowJointTrajectoryResult::SUCCESSFUL, "Controller stopped.", true);
+  }
+
+  waitMotorGoals();
+
+  if (sent_plan_)
+  {
+    releasePlan(sent_plan_);
+    sent_plan_ = NULL;
+  }
+
+  executing_ = false;
+}
+
+// Publishes how well the executor kept its deadlines since the last time
+void JointTrajectoryActionController::publishExecutorDiagnostics()
+{
+  dynamixel_hardware_interface::LatencyHistogram wakeup_jitter;
+  dynamixel_hardware_interface::LatencyHistogram tick_time;
+  uint64_t overruns;
+
+  {
+    boost::mutex::scoped_lock stats_lock(executor_stats_mutex_);
+    wakeup_jitter = wakeup_jitter_;
+    tick_time = tick_time_;
+    overruns = overruns_;
+    wakeup_jitter_.clear();
+    tick_time_.clear();
+    overruns_ = 0;
+  }
+
+  diagnostic_updater::DiagnosticStatusWrapper status;
+  status.name = "Joint Trajectory Executor (" + name_ + ")";
+  status.hardware_id = name_;
+  status.add("Update Rate", stream_setpoints_ ? stream_rate_ : (double) update_rate_);
+  if (executor_priority_ > 0) { status.add("Realtime Priority", executor_priority_); }
+  if (executor_cpu_ >= 0) { status.add("CPU Affinity", executor_cpu_); }
+  status.add("Executing", executing_ ? "yes" : "no");
+
+  if (tick_time.count > 0)
+  {
+    status.addf("Wakeup Jitter", "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                wakeup_jitter.percentile(0.5), wakeup_jitter.percentile(0.99), (double) wakeup_jitter.max_usec);
+    status.addf("Tick Time", "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                tick_time.percentile(0.5), tick_time.percentile(0.99), (double) tick_time.max_usec);
+    status.addf("Overruns", "%llu", (unsigned long long) overruns);
+  }
+
+  if (trace_.isOpen())
+  {
+    status.add("Trace File", trace_file_);
+    status.addf("Trace Records Dropped", "%llu", (unsigned long long) trace_.getDropped());
+  }
+
+  status.summary(status.OK, "OK");
+
+  if (overruns > 0)
+  {
+    status.mergeSummary(status.WARN, "Trajectory executor is missing its deadlines");
+  }
+
+  diagnostic_msgs::DiagnosticArray diag_msg;
+  diag_msg.header.stamp = ros::Time::now();
+  diag_msg.status.push_back(status);
+  diagnostics_pub_.publish(diag_msg);
+}
+
+// Starts executing plan at now. A streamed plan's current segment is refitted to start from where
+// the previous plan has the joints now, at the speed and acceleration it has them at, so the
+// splice does not jerk them. Returns false with error_msg set, and the previous plan carries on,
+// if getting there in time would exceed a joint's max velocity.
+bool JointTrajectoryActionController::beginPlan(TrajectoryPlan* plan, const TrajectoryPlan* previous, double now,
+                                                std::string& error_msg)
+{
+  if (!plan->streamed)
+  {
+    // segments already over when it takes over are skipped
+    plan->segment = std::upper_bound(plan->end_times.begin(), plan->end_times.end(), now) - plan->end_times.begin();
+    return true;
+  }
+
+  bool blend = (previous != NULL && previous->streamed && !previous->segments.empty());
+
+  if (!blend)
+  {
+    for (size_t j = 0; j < num_joints_; ++j)
+    {
+      commanded_[j] = joint_states_[joint_names_[j]]->position;
+    }
+  }
+
+  if (plan->segments.empty())
+    return true;
+
+  while (plan->segment + 1 < plan->segments.size() &&
+         now >= plan->segments[plan->segment].start_time + plan->segments[plan->segment].duration)
+  {
+    ++plan->segment;
+  }
+
+  Segment& seg = plan->segments[plan->segment];
+  double remaining = seg.start_time + seg.duration - now;
+
+  if (remaining <= 0.0)
+    return true;
+
+  size_t prev_idx = previous ? previous->segment : 0;
+  if (blend)
+  {
+    while (prev_idx + 1 < previous->segments.size() &&
+           now >= previous->segments[prev_idx].start_time + previous->segments[prev_idx].duration)
+    {
+      ++prev_idx;
+    }
+  }
+
+  for (size_t j = 0; j < num_joints_; ++j)
+  {
+    double p0 = joint_states_[joint_names_[j]]->position;
+    double v0 = 0.0;
+    double a0 = 0.0;
+
+    if (blend)
+    {
+      const Segment& prev_seg = previous->segments[prev_idx];
+      const Spline& prev_spline = previous->splines[prev_idx][j];
+      double t = std::max(0.0, std::min(now - prev_seg.start_time, prev_seg.duration));
+
+      p0 = splinePosition(prev_spline, t);
+      v0 = splineVelocity(prev_spline, t);
+      a0 = splineAcceleration(prev_spline, t);
+    }
+
+    plan->splines[plan->segment][j] = fitSpline(p0, v0, a0, seg.positions[j], seg.velocities[j],
+                                                plan->quintic ? seg.accelerations[j] : 0.0,
+                                                remaining, plan->quintic);
+  }
+
+  if (!checkSplineVelocities(plan->splines[plan->segment], remaining, -1, error_msg))
+    return false;
+
+  seg.start_time = now;
+  seg.duration = remaining;
+  return true;
+}
+
+// Sends plan's setpoints for now, returns false once it has finished
+bool JointTrajectoryActionController::tickPlan(TrajectoryPlan* plan, double now)
+{
+  if (plan->cancel)
+  {
+    sendHoldCommands();
+    finishPlan(plan, control_msgs::FollowJointTrajectoryResult::SUCCESSFUL,
+               "Trajectory canceled. Holding the joints where they are.", true);
+    return false;
+  }
+
+  if (plan->settling)
+  {
+    if (now < plan->settle_time)
+      return true;
+
+    // Check if all motors are within their goal constraints
+    for (size_t i = 0; i < num_joints_; ++i)
     {
-      if (trajectory_constraints_[j] > 0.0 && feedback_msg_.error.positions[j] > trajectory_constraints_[j])
+      if (goal_constraints_[i] > 0 && std::abs(feedback_msg_.error.positions[i]) > goal_constraints_[i])
       {
-        traj_result.error_code = control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED;
-        error_msg = "Unsatisfied position constraint for " + joint_names_[j] +
-          " trajectory point " + boost::lexical_cast<std::string>(traj_seg) +
-          ", " + boost::lexical_cast<std::string>(feedback_msg_.error.positions[j]) +
-          " is larger than " + boost::lexical_cast<std::string>(trajectory_constraints_[j]);
-        ROS_ERROR("%s", error_msg.c_str());
-        if (is_action)
-        {
-          action_server_->setAborted(traj_result, error_msg);
-        }
-        return;
+        finishPlan(plan, control_msgs::FollowJointTrajectoryResult::GOAL_TOLERANCE_VIOLATED,
+                   "Aborting at end because " + joint_names_[i] +
+                   " joint wound up outside the goal constraints. The position error " +
+                   boost::lexical_cast<std::string>(fabs(feedback_msg_.error.positions[i])) +
+                   " is larger than the goal constraints " + boost::lexical_cast<std::string>(goal_constraints_[i]));
+        return false;
       }
+    }
 
-      // Save to file
-      if( USE_ERROR_OUTPUT_LOG )
+    finishPlan(plan, control_msgs::FollowJointTrajectoryResult::SUCCESSFUL,
+               "Trajectory execution successfully completed");
+    return false;
+  }
+
+  if (plan->streamed)
+  {
+    return streamSetpoints(plan, now);
+  }
+
+  // segments that have ended since the last tick are checked against the path constraints
+  while (plan->segment < plan->end_times.size() && now >= plan->end_times[plan->segment])
+  {
+    if (!checkPathConstraints(plan, plan->waypoints[plan->segment]))
+      return false;
+
+    ++plan->segment;
+    plan->sent = false;
+  }
+
+  if (plan->segment == plan->end_times.size())
+  {
+    // let motors roll for specified amount of time
+    plan->settling = true;
+    plan->settle_time = now + goal_time_constraint_;
+  }
+  else if (!plan->sent)
+  {
+    ROS_DEBUG("Processing segment %d", plan->waypoints[plan->segment]);
+
+    // Hand every port its goals for this segment, all ports are written to in parallel while
+    // the executor carries on
+    for (size_t p = 0; p < plan->ports.size(); ++p)
+    {
+      const TrajectoryPlan::Port& port = plan->ports[p];
+
+      if (port.motor_count > 0)
       {
-        if(!j) // no comma before first item
-          error_log_string = boost::lexical_cast<std::string>(feedback_msg_.error.positions[j]);
-        else
-          error_log_string += "," + boost::lexical_cast<std::string>(feedback_msg_.error.positions[j]);
+        queueMotorGoals(port.bus_scheduler, port.dxl_io, &port.goals[plan->segment * port.motor_count], port.motor_count);
       }
+    }
+
+    sendMotorGoals();
+    holdSentPlan(plan);
+    plan->sent = true;
+  }
+
+  return true;
+}
+
+// Sends each joint the position its spline puts it at one period ahead, at the speed that gets it
+// there in that period. The bus load is one SYNC_WRITE per port every period, however many points
+// the trajectory has.
+bool JointTrajectoryActionController::streamSetpoints(TrajectoryPlan* plan, double now)
+{
+  const double period = 1.0 / stream_rate_;
+
+  if (plan->segments.empty())
+  {
+    plan->settling = true;
+    plan->settle_time = now + goal_time_constraint_;
+    return true;
+  }
+
+  const double end_time = plan->segments.back().start_time + plan->segments.back().duration;
+  double target_time = std::min(now + period, end_time);
+
+  while (plan->segment + 1 < plan->segments.size() &&
+         target_time > plan->segments[plan->segment].start_time + plan->segments[plan->segment].duration)
+  {
+    ++plan->segment;
+  }
+
+  const Segment& seg = plan->segments[plan->segment];
+  const std::vector<Spline>& splines = plan->splines[plan->segment];
+  double t = std::max(0.0, std::min(target_time - seg.start_time, seg.duration));
+
+  // the bus may still be writing the last tick's goals out of the other half
+  size_t half = plan->back_half ? 1 : 0;
+  plan->back_half = !plan->back_half;
 
+  for (size_t p = 0; p < plan->ports.size(); ++p)
+  {
+    TrajectoryPlan::Port& port = plan->ports[p];
+    dynamixel_hardware_interface::DynamixelGoal* goals = &port.goals[half * port.motor_count];
+    dynamixel_hardware_interface::DynamixelGoal* joint_goals = goals;
+
+    for (size_t k = 0; k < port.joints.size(); ++k)
+    {
+      size_t joint_idx = port.joints[k];
+
+      // the splines were checked against the joints' max velocities when the goal was accepted
+      double desired_position = splinePosition(splines[joint_idx], t);
+      double desired_velocity = std::max<double>(min_velocity_, std::abs(desired_position - commanded_[joint_idx]) / period);
+
+      commanded_[joint_idx] = desired_position;
+
+      deps_[joint_idx]->getRawMotorGoals(desired_position, desired_velocity, joint_goals);
+      joint_goals += port.joint_motors[k];
     }
 
-    // End line - the entire set of position error for each trajectory point is saved per line
-    if( USE_ERROR_OUTPUT_LOG )
+    if (port.motor_count > 0)
     {
-      error_log_file << error_log_string << "\n";
+      queueMotorGoals(port.bus_scheduler, port.dxl_io, goals, port.motor_count);
     }
+  }
 
-  } // end of the main loop
+  sendMotorGoals();
+  holdSentPlan(plan);
 
-  // let motors roll for specified amount of time
-  ros::Duration(goal_time_constraint_).sleep();
+  if (!checkPathConstraints(plan, -1))
+    return false;
 
-  // Check if all motors are within their goal constraints
-  bool aborted_at_end = false;
-  for (size_t i = 0; i < num_joints_; ++i)
+  if (target_time >= end_time)
   {
-    if (goal_constraints_[i] > 0 && std::abs(feedback_msg_.error.positions[i]) > goal_constraints_[i])
+    // let motors roll for specified amount of time
+    plan->settling = true;
+    plan->settle_time = now + goal_time_constraint_;
+  }
+
+  return true;
+}
+
+// Returns false with error_msg set if any joint's spline moves it faster than its max velocity
+// at some point of a segment, point is the trajectory point the segment moves to if known
+bool JointTrajectoryActionController::checkSplineVelocities(const std::vector<Spline>& splines, double duration,
+                                                            int point, std::string& error_msg)
+{
+  for (size_t j = 0; j < num_joints_; ++j)
+  {
+    double peak_velocity = splinePeakSpeed(splines[j], duration);
+    double max_velocity = deps_[j]->getMaxVelocity();
+
+    if (peak_velocity > max_velocity)
     {
-      traj_result.error_code = control_msgs::FollowJointTrajectoryResult::GOAL_TOLERANCE_VIOLATED;
-      error_msg = "Aborting at end because " + joint_names_[i] +
-        " joint wound up outside the goal constraints. The position error " +
-        boost::lexical_cast<std::string>(fabs(feedback_msg_.error.positions[i])) +
-        " is larger than the goal constraints " + boost::lexical_cast<std::string>(goal_constraints_[i]);
-      ROS_ERROR("%s", error_msg.c_str());
-      if (is_action)
+      error_msg = "Invalid joint trajectory: max velocity exceeded for joint " + joint_names_[j] +
+        " with a velocity of " + boost::lexical_cast<std::string>(peak_velocity) +
+        " when the max velocity is set to " + boost::lexical_cast<std::string>(max_velocity);
+      if (point >= 0)
       {
-        action_server_->setAborted(traj_result, error_msg);
+        error_msg += ". On trajectory step " + boost::lexical_cast<std::string>(point);
       }
-      aborted_at_end = true;
+      return false;
     }
+  }
 
-    // Save final results to file
-    if( USE_ERROR_OUTPUT_LOG )
+  return true;
+}
+
+// Keeps plan while the ports write goals read out of it. The goals sent before are written by
+// the time new ones are sent, the plan they came from can go then
+void JointTrajectoryActionController::holdSentPlan(TrajectoryPlan* plan)
+{
+  if (sent_plan_ == plan)
+    return;
+
+  if (sent_plan_)
+  {
+    releasePlan(sent_plan_);
+  }
+
+  __sync_add_and_fetch(&plan->refs, 1);
+  sent_plan_ = plan;
+}
+
+// Finishes plan and returns false if a joint is further from where it should be than its
+// trajectory constraint allows, point is the trajectory point it is moving to if known
+bool JointTrajectoryActionController::checkPathConstraints(TrajectoryPlan* plan, int point)
+{
+  for (size_t j = 0; j < joint_names_.size(); ++j)
+  {
+    if (trajectory_constraints_[j] > 0.0 && feedback_msg_.error.positions[j] > trajectory_constraints_[j])
     {
-      if(!i) // no comma before first item
-        error_log_string = boost::lexical_cast<std::string>(feedback_msg_.error.positions[i]);
-      else
-        error_log_string += "," + boost::lexical_cast<std::string>(feedback_msg_.error.positions[i]);
+      std::string error_msg = "Unsatisfied position constraint for " + joint_names_[j];
+      if (point >= 0)
+      {
+        error_msg += " trajectory point " + boost::lexical_cast<std::string>(point);
+      }
+      error_msg += ", " + boost::lexical_cast<std::string>(feedback_msg_.error.positions[j]) +
+        " is larger than " + boost::lexical_cast<std::string>(trajectory_constraints_[j]);
+
+      finishPlan(plan, control_msgs::FollowJointTrajectoryResult::PATH_TOLERANCE_VIOLATED, error_msg);
+      return false;
     }
+  }
+
+  return true;
+}
 
+// Hands the outcome to the goal callback waiting on plan, if any, and lets go of it
+void JointTrajectoryActionController::finishPlan(TrajectoryPlan* plan, int error_code,
+                                                const std::string& error_msg, bool preempted)
+{
+  if (preempted)
+  {
+    ROS_WARN("%s", error_msg.c_str());
   }
-  // End line - the entire set of position error for each trajectory point is saved per line
-  if( USE_ERROR_OUTPUT_LOG )
+  else if (error_code != control_msgs::FollowJointTrajectoryResult::SUCCESSFUL)
   {
-    error_log_file << error_log_string << "\n";
+    ROS_ERROR("%s", error_msg.c_str());
+  }
+  else
+  {
+    ROS_INFO("%s", error_msg.c_str());
   }
 
-  if( aborted_at_end )
-    return;
-
-  // -----------------------------------------------------------------------------------------------
-  // Finish up
+  plan->error_code = error_code;
+  plan->error_msg = error_msg;
+  plan->preempted = preempted;
 
-  // Close log file
-  if( USE_ERROR_OUTPUT_LOG )
-    error_log_file.close();
+  // the outcome is in place before the plan is seen finished
+  __sync_synchronize();
+  plan->finished = true;
 
-  // Set result
-  traj_result.error_code = control_msgs::FollowJointTrajectoryResult::SUCCESSFUL;
-  error_msg = "Trajectory execution successfully completed";
-  ROS_INFO("%s", error_msg.c_str());
-  action_server_->setSucceeded(traj_result, error_msg);
+  releasePlan(plan);
 }
 
-
-void JointTrajectoryActionController::getUniqueErrorLogPath(std::string &error_log_path)
+// Commands every joint to stay where it is, at the speed it is moving at
+void JointTrajectoryActionController::sendHoldCommands()
 {
-  // Get the location of the dynamixel package within ros
-  const std::string package_path = ros::package::getPath("dynamixel_hardware_interface");
+  std::map<std::string, std::vector<std::vector<int> > > multi_port_commands;
 
-  std::string error_log_base_path = package_path + "/data/trajectory_error_";
+  std::map<std::string, std::vector<std::string> >::const_iterator port_it;
+  std::vector<std::string>::const_iterator joint_it;
 
-  // Loop until we find a number-appended file name that does not exist
-  unsigned int file_id = 0;
-  do
+  for (port_it = port_to_joints_.begin(); port_it != port_to_joints_.end(); ++port_it)
   {
-    error_log_path = error_log_base_path + boost::lexical_cast<std::string>(file_id) + ".csv";
-    ++file_id;
-  } while( boost::filesystem::is_regular_file( error_log_path ) );
+    std::vector<std::vector<int> > port_motor_commands;
+
+    for (joint_it = port_it->second.begin(); joint_it != port_it->second.end(); ++joint_it)
+    {
+      std::string joint = *joint_it;
+
+      double desired_position = joint_states_[joint]->position;
+      double desired_velocity = joint_states_[joint]->velocity;
+
+      std::vector<std::vector<int> > joint_motor_commands = joint_to_controller_[joint]->getRawMotorCommands(desired_position, desired_velocity);
+      for (size_t i = 0; i < joint_motor_commands.size(); ++i)
+      {
+        port_motor_commands.push_back(joint_motor_commands[i]);
+      }
+
+      multi_port_commands[port_it->first] = port_motor_commands;
+    }
+  }
 
-  ROS_INFO_STREAM("Error logging to " << error_log_path);
-  //error_log_path = "/home/dave/ros/clam/src/dynamixel_hardware_interface/data";
+  sendMotorCommands(multi_port_commands);
 }
 
 }
@@ -0,0 +1,237 @@
+// Author: Antons Rebguns
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <dynamixel_hardware_interface/motor_state_recorder.h>
+#include <dynamixel_hardware_interface/motor_state_table.h>
+
+#include <ros/ros.h>
+
+namespace dynamixel_hardware_interface
+{
+
+namespace
+{
+
+const char RECORDING_MAGIC[8] = { 'D', 'X', 'L', 'S', 'T', 'A', 'T', 'E' };
+const uint32_t RECORDING_VERSION = 1;
+
+// Start of the file, padded to a cache line so the records that follow are
+// aligned
+struct RecordingHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  volatile uint64_t count;      // records ever appended
+  uint8_t padding[32];
+};
+
+}
+
+MotorStateRecorder::MotorStateRecorder()
+  : fd_(-1),
+    length_(0),
+    map_(NULL),
+    count_(NULL),
+    capacity_(0),
+    records_(NULL)
+{
+}
+
+MotorStateRecorder::~MotorStateRecorder()
+{
+  close();
+}
+
+bool MotorStateRecorder::open(const std::string& path, size_t capacity)
+{
+  close();
+
+  if (capacity == 0) { return false; }
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (fd_ < 0)
+  {
+    ROS_ERROR("Unable to create motor state recording %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  length_ = sizeof(RecordingHeader) + capacity * sizeof(MotorStateRecord);
+
+  // allocate the blocks now, a full disk should fail here and not with a
+  // SIGBUS in the middle of a feedback cycle
+  int error = posix_fallocate(fd_, 0, length_);
+  void* map = (error == 0) ? mmap(NULL, length_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0) : MAP_FAILED;
+
+  if (map == MAP_FAILED)
+  {
+    ROS_ERROR("Unable to map motor state recording %s: %s", path.c_str(), strerror(error ? error : errno));
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  // touching every page now keeps page faults out of the feedback cycle
+  memset(map, 0, length_);
+
+  RecordingHeader* header = static_cast<RecordingHeader*>(map);
+  memcpy(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+  header->version = RECORDING_VERSION;
+  header->record_size = sizeof(MotorStateRecord);
+  header->capacity = capacity;
+  header->count = 0;
+
+  map_ = map;
+  count_ = &header->count;
+  capacity_ = capacity;
+  records_ = reinterpret_cast<MotorStateRecord*>(header + 1);
+
+  return true;
+}
+
+void MotorStateRecorder::close()
+{
+  if (map_)
+  {
+    munmap(map_, length_);
+    map_ = NULL;
+    count_ = NULL;
+    records_ = NULL;
+  }
+
+  if (fd_ >= 0)
+  {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool MotorStateRecorder::isOpen() const
+{
+  return map_ != NULL;
+}
+
+void MotorStateRecorder::append(uint64_t stamp, uint32_t cycle, int motor_id, const MotorStateSample& sample)
+{
+  uint64_t count = *count_;
+  MotorStateRecord& record = records_[count % capacity_];
+
+  record.stamp = stamp;
+  record.cycle = cycle;
+  record.motor_id = motor_id;
+  record.sample = sample;
+
+  // the record is complete before anyone can count it
+  __sync_synchronize();
+  *count_ = count + 1;
+}
+
+uint64_t MotorStateRecorder::getCount() const
+{
+  return map_ ? *count_ : 0;
+}
+
+MotorStateRecording::MotorStateRecording()
+  : fd_(-1),
+    length_(0),
+    map_(NULL),
+    records_(NULL),
+    capacity_(0),
+    first_(0),
+    size_(0)
+{
+}
+
+MotorStateRecording::~MotorStateRecording()
+{
+  close();
+}
+
+bool MotorStateRecording::open(const std::string& path)
+{
+  close();
+
+  fd_ = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd_ < 0 || fstat(fd_, &st) != 0)
+  {
+    ROS_ERROR("Unable to open motor state recording %s: %s", path.c_str(), strerror(errno));
+    close();
+    return false;
+  }
+
+  length_ = st.st_size;
+  map_ = (length_ >= sizeof(RecordingHeader)) ? mmap(NULL, length_, PROT_READ, MAP_SHARED, fd_, 0) : NULL;
+
+  if (map_ == MAP_FAILED || map_ == NULL)
+  {
+    ROS_ERROR("Unable to map motor state recording %s", path.c_str());
+    map_ = NULL;
+    close();
+    return false;
+  }
+
+  const RecordingHeader* header = static_cast<const RecordingHeader*>(map_);
+
+  if (memcmp(header->magic, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0 ||
+      header->version != RECORDING_VERSION ||
+      header->record_size != sizeof(MotorStateRecord) ||
+      length_ < sizeof(*header) + header->capacity * sizeof(MotorStateRecord))
+  {
+    ROS_ERROR("%s is not a motor state recording this build can read", path.c_str());
+    close();
+    return false;
+  }
+
+  uint64_t count = header->count;
+  __sync_synchronize();
+
+  records_ = reinterpret_cast<const MotorStateRecord*>(header + 1);
+  capacity_ = header->capacity;
+  first_ = (count > capacity_) ? count - capacity_ : 0;
+  size_ = count - first_;
+
+  return true;
+}
+
+void MotorStateRecording::close()
+{
+  if (map_)
+  {
+    munmap(const_cast<void*>(map_), length_);
+    map_ = NULL;
+  }
+
+  if (fd_ >= 0)
+  {
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  records_ = NULL;
+  size_ = 0;
+}
+
+size_t MotorStateRecording::size() const
+{
+  return size_;
+}
+
+const MotorStateRecord& MotorStateRecording::operator[](size_t index) const
+{
+  return records_[(first_ + index) % capacity_];
+}
+
+}
@@ -0,0 +1,184 @@
+// Author: Antons Rebguns
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <dynamixel_hardware_interface/motor_state_table.h>
+#include <dynamixel_hardware_interface/MotorState.h>
+#include <dynamixel_hardware_interface/MotorStateList.h>
+
+namespace dynamixel_hardware_interface
+{
+
+MotorStateTable::MotorStateTable()
+  : cycle_(0),
+    next_listener_(0)
+{
+  memset(slots_, 0, sizeof(slots_));
+}
+
+void MotorStateTable::update(int motor_id, const MotorStateSample& sample)
+{
+  Slot& slot = slots_[motor_id & 0xFF];
+
+  // odd while the slot is being written
+  slot.sequence = slot.sequence + 1;
+  __sync_synchronize();
+
+  slot.sample = sample;
+  slot.sample.cycle = cycle_ + 1;
+
+  __sync_synchronize();
+  slot.sequence = slot.sequence + 1;
+}
+
+void MotorStateTable::commit()
+{
+  __sync_synchronize();
+  cycle_ = cycle_ + 1;
+
+  boost::mutex::scoped_lock lock(listeners_mutex_);
+
+  for (std::map<int, Listener>::iterator it = listeners_.begin(); it != listeners_.end(); ++it)
+  {
+    it->second();
+  }
+}
+
+bool MotorStateTable::read(int motor_id, MotorStateSample& sample) const
+{
+  const Slot& slot = slots_[motor_id & 0xFF];
+  uint32_t before;
+  uint32_t after;
+
+  do
+  {
+    before = slot.sequence;
+    __sync_synchronize();
+    sample = slot.sample;
+    __sync_synchronize();
+    after = slot.sequence;
+  }
+  while (before != after || (before & 1));
+
+  return sample.cycle != 0;
+}
+
+void copyMotorState(int motor_id, const MotorStateSample& sample, MotorState& state)
+{
+  state.timestamp = sample.status.timestamp;
+  state.fast_timestamp = sample.status.fast_timestamp;
+  state.slow_timestamp = sample.status.slow_timestamp;
+  state.id = motor_id;
+  state.target_position = sample.target_position;
+  state.target_velocity = sample.target_velocity;
+  state.position = sample.status.position;
+  state.velocity = sample.status.velocity;
+  state.torque_limit = sample.status.torque_limit;
+  state.load = sample.status.load;
+  state.moving = sample.status.moving;
+  state.alive = sample.alive;
+  state.voltage = sample.status.voltage;
+  state.temperature = sample.status.temperature;
+}
+
+bool MotorStateTable::read(int motor_id, MotorState& state) const
+{
+  MotorStateSample sample;
+  if (!read(motor_id, sample)) { return false; }
+
+  copyMotorState(motor_id, sample, state);
+  return true;
+}
+
+uint32_t MotorStateTable::getCycle() const
+{
+  return cycle_;
+}
+
+int MotorStateTable::addListener(const Listener& listener)
+{
+  boost::mutex::scoped_lock lock(listeners_mutex_);
+  listeners_[next_listener_] = listener;
+  return next_listener_++;
+}
+
+void MotorStateTable::removeListener(int handle)
+{
+  boost::mutex::scoped_lock lock(listeners_mutex_);
+  listeners_.erase(handle);
+}
+
+MotorStatePool::MotorStatePool(size_t buffer_count)
+  : buffers_(buffer_count),
+    next_buffer_(0),
+    motor_count_(0)
+{
+  resize(0);
+}
+
+void MotorStatePool::resize(size_t motor_count)
+{
+  motor_count_ = motor_count;
+
+  {
+    boost::mutex::scoped_lock lock(latest_mutex_);
+    latest_.reset();
+  }
+
+  for (size_t i = 0; i < buffers_.size(); ++i)
+  {
+    buffers_[i].reset(new MotorStateList);
+    buffers_[i]->motor_states.resize(motor_count_);
+  }
+}
+
+MotorStateListPtr MotorStatePool::acquire()
+{
+  // a reference can only be copied from another one, once the pool's is the
+  // last one left nobody can get hold of the buffer again until we publish it
+  for (size_t n = 0; n < buffers_.size(); ++n)
+  {
+    size_t i = (next_buffer_ + n) % buffers_.size();
+
+    if (buffers_[i].unique())
+    {
+      // whatever the last holder did to the buffer happened before it let go
+      __sync_synchronize();
+      next_buffer_ = (i + 1) % buffers_.size();
+      return buffers_[i];
+    }
+  }
+
+  MotorStateListPtr buffer(new MotorStateList);
+  buffer->motor_states.resize(motor_count_);
+  buffers_.push_back(buffer);
+  next_buffer_ = 0;
+
+  return buffer;
+}
+
+void MotorStatePool::publish(const MotorStateListPtr& message)
+{
+  boost::mutex::scoped_lock lock(latest_mutex_);
+  latest_ = message;
+}
+
+MotorStateListConstPtr MotorStatePool::latest() const
+{
+  boost::mutex::scoped_lock lock(latest_mutex_);
+  return latest_;
+}
+
+size_t MotorStatePool::getBufferCount() const
+{
+  return buffers_.size();
+}
+
+}
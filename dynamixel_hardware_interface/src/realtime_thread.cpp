@@ -0,0 +1,82 @@
+// Author: Antons Rebguns
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <string>
+
+#include <dynamixel_hardware_interface/realtime_thread.h>
+
+#include <ros/ros.h>
+
+namespace dynamixel_hardware_interface
+{
+
+void addNsec(struct timespec& ts, int64_t nsec)
+{
+  nsec += ts.tv_nsec;
+  ts.tv_sec += nsec / NSEC_PER_SEC;
+  ts.tv_nsec = nsec % NSEC_PER_SEC;
+}
+
+int64_t diffNsec(const struct timespec& later, const struct timespec& earlier)
+{
+  return (later.tv_sec - earlier.tv_sec) * NSEC_PER_SEC + (later.tv_nsec - earlier.tv_nsec);
+}
+
+uint64_t advanceDeadline(struct timespec& deadline, int64_t period_nsec, const struct timespec& end)
+{
+  // a loop that ran past the next deadline gives up the periods it missed
+  // instead of trying to catch up with a burst of iterations
+  uint64_t missed = 0;
+  addNsec(deadline, period_nsec);
+
+  while (diffNsec(end, deadline) >= 0)
+  {
+    addNsec(deadline, period_nsec);
+    ++missed;
+  }
+
+  return missed;
+}
+
+bool applyRealtimeSettings(const std::string& owner, const char* thread_name, int priority, int cpu)
+{
+  bool success = true;
+
+  if (priority > 0)
+  {
+    struct sched_param param;
+    param.sched_priority = priority;
+
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0)
+    {
+      ROS_WARN("%s: unable to run %s thread at SCHED_FIFO priority %d: %s", owner.c_str(),
+               thread_name, priority, strerror(error));
+      success = false;
+    }
+  }
+
+  if (cpu >= 0)
+  {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0)
+    {
+      ROS_WARN("%s: unable to pin %s thread to CPU %d: %s", owner.c_str(),
+               thread_name, cpu, strerror(error));
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+}
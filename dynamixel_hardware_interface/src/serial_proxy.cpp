@@ -1,10 +1,16 @@
 
 // Author: Antons Rebguns
 
+#include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
+#include <algorithm>
 #include <cmath>
+#include <fstream>
+#include <map>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -14,11 +20,17 @@
 
 #include <clam/gearbox/flexiport/flexiport.h>
 
+#include <dynamixel_hardware_interface/bus_scheduler.h>
+#include <dynamixel_hardware_interface/bus_statistics.h>
 #include <dynamixel_hardware_interface/dynamixel_const.h>
 #include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/motor_state_recorder.h>
+#include <dynamixel_hardware_interface/realtime_thread.h>
 #include <dynamixel_hardware_interface/serial_proxy.h>
 #include <dynamixel_hardware_interface/MotorState.h>
 #include <dynamixel_hardware_interface/MotorStateList.h>
+#include <dynamixel_hardware_interface/TransactionStatistics.h>
+#include <dynamixel_hardware_interface/GetBusStatistics.h>
 
 #include <ros/ros.h>
 #include <diagnostic_updater/DiagnosticStatusWrapper.h>
@@ -28,6 +40,141 @@
 namespace dynamixel_hardware_interface
 {
 
+namespace
+{
+
+void fillTransactionStatistics(const std::string& name,
+                               const BusStatistics::Counters& counters,
+                               TransactionStatistics& stats)
+{
+  stats.name = name;
+  stats.requests = counters.requests;
+  stats.responses = counters.outcomes[BusStatistics::RESPONSE];
+  stats.header_timeouts = counters.outcomes[BusStatistics::HEADER_TIMEOUT];
+  stats.payload_timeouts = counters.outcomes[BusStatistics::PAYLOAD_TIMEOUT];
+  stats.checksum_failures = counters.outcomes[BusStatistics::CHECKSUM_FAILURE];
+  stats.bad_headers = counters.outcomes[BusStatistics::BAD_HEADER];
+
+  stats.input_voltage_errors = counters.error_bits[0];
+  stats.angle_limit_errors = counters.error_bits[1];
+  stats.overheating_errors = counters.error_bits[2];
+  stats.range_errors = counters.error_bits[3];
+  stats.checksum_errors = counters.error_bits[4];
+  stats.overload_errors = counters.error_bits[5];
+  stats.instruction_errors = counters.error_bits[6];
+
+  stats.latency_mean = counters.latency.mean();
+  stats.latency_p50 = counters.latency.percentile(0.5);
+  stats.latency_p99 = counters.latency.percentile(0.99);
+  stats.latency_max = counters.latency.max_usec;
+}
+
+// counters since the previous call, last is updated to the current ones
+void takeWindow(BusStatistics::Counters& current, BusStatistics::Counters& last)
+{
+  BusStatistics::Counters window = current;
+
+  // the statistics service may have reset everything in between
+  if (current.requests >= last.requests) { window.subtract(last); }
+
+  last = current;
+  current = window;
+}
+
+// A motor that misses this many feedback cycles in a row is left out of the
+// poll and probed in the background instead, first after the shortest
+// backoff, then at doubling intervals up to the longest one
+const int MOTOR_DROP_FAILURES = 3;
+const double PROBE_BACKOFF_MIN = 0.1;
+const double PROBE_BACKOFF_MAX = 5.0;
+
+struct MotorHealth
+{
+  int failures;                       // feedback cycles missed in a row
+  bool dropped;                       // left out of the poll
+  double backoff;                     // seconds from a failed probe to the next one
+  double next_probe;                  // CLOCK_MONOTONIC time of the next probe
+  bool probing;                       // probe is waiting on the bus
+  boost::shared_future<bool> probe;
+
+  MotorHealth() : failures(0), dropped(false), backoff(0.0), next_probe(0.0), probing(false) {}
+};
+
+// Values of a motor's diagnostics that change while running, they follow the
+// ones that never do
+enum MotorDiagnosticsValue
+{
+  DIAG_TORQUE_ENABLED,
+  DIAG_MOVING,
+  DIAG_TARGET_POSITION,
+  DIAG_TARGET_VELOCITY,
+  DIAG_POSITION,
+  DIAG_VELOCITY,
+  DIAG_POSITION_ERROR,
+  DIAG_VELOCITY_ERROR,
+  DIAG_TORQUE_LIMIT,
+  DIAG_LOAD,
+  DIAG_VOLTAGE,
+  DIAG_TEMPERATURE,
+  DIAG_LATENCY,
+  DIAG_FAILURES,
+  NUM_DIAG_VALUES
+};
+
+const char* DIAG_VALUE_KEYS[NUM_DIAG_VALUES] =
+{
+  "Torque Enabled",
+  "Moving",
+  "Target Position",
+  "Target Velocity",
+  "Position",
+  "Velocity",
+  "Position Error",
+  "Velocity Error",
+  "Torque Limit",
+  "Load",
+  "Voltage",
+  "Temperature",
+  "Round Trip Latency",
+  "Failed Responses",
+};
+
+// what the changing values of a motor's diagnostics were last formatted from
+struct MotorDiagnostics
+{
+  size_t first_value;
+  int last[NUM_DIAG_VALUES][3];
+  bool formatted;
+};
+
+// Formats value again only if one of the numbers it shows moved by more than
+// threshold since it was last formatted, format takes up to three ints.
+void updateValue(diagnostic_msgs::DiagnosticStatus& status,
+                 MotorDiagnostics& diag,
+                 MotorDiagnosticsValue value,
+                 int threshold,
+                 const char* format,
+                 int a, int b=0, int c=0)
+{
+  int* last = diag.last[value];
+
+  if (diag.formatted &&
+      abs(a - last[0]) <= threshold && abs(b - last[1]) <= threshold && abs(c - last[2]) <= threshold)
+  {
+    return;
+  }
+
+  last[0] = a;
+  last[1] = b;
+  last[2] = c;
+
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), format, a, b, c);
+  status.values[diag.first_value + value].value = buffer;
+}
+
+}
+
 SerialProxy::SerialProxy(std::string port_name,
                          std::string port_namespace,
                          std::string baud_rate,
@@ -36,7 +183,18 @@ SerialProxy::SerialProxy(std::string port_name,
                          double update_rate,
                          double diagnostics_rate,
                          int error_level_temp,
-                         int warn_level_temp)
+                         int warn_level_temp,
+                         int protocol,
+                         std::string port_options,
+                         int realtime_priority,
+                         int cpu_affinity,
+                         double slow_update_rate,
+                         int diagnostics_threshold,
+                         std::string topology_cache,
+                         double scan_timeout,
+                         std::string record_file,
+                         int record_capacity,
+                         std::string replay_file)
   :port_name_(port_name),
    port_namespace_(port_namespace),
    baud_rate_(baud_rate),
@@ -46,10 +204,23 @@ SerialProxy::SerialProxy(std::string port_name,
    diagnostics_rate_(diagnostics_rate),
    error_level_temp_(error_level_temp),
    warn_level_temp_(warn_level_temp),
+   protocol_(protocol),
+   port_options_(port_options),
+   realtime_priority_(realtime_priority),
+   cpu_affinity_(cpu_affinity),
+   slow_update_rate_(slow_update_rate),
+   diagnostics_threshold_(diagnostics_threshold),
+   topology_cache_(topology_cache),
+   scan_timeout_(scan_timeout),
+   record_file_(record_file),
+   record_capacity_(record_capacity),
+   replay_file_(replay_file),
+   feedback_thread_(NULL),
+   diagnostics_thread_(NULL),
+   overruns_(0),
+   dxl_io_(NULL),
    freq_status_(diagnostic_updater::FrequencyStatusParam(&update_rate_, &update_rate_, 0.1, 25))
 {
-  current_state_ = MotorStateListPtr(new MotorStateList);
-
   motor_states_pub_ = nh_.advertise<MotorStateList>("motor_states/" + port_namespace_, 1000);
   diagnostics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1000);
 }
@@ -76,15 +247,19 @@ SerialProxy::~SerialProxy()
     delete diagnostics_thread_;
   }
 
+  bus_statistics_srv_.shutdown();
+  bus_scheduler_.stop();
   delete dxl_io_;
 }
 
 bool SerialProxy::connect()
 {
+  if (!replay_file_.empty()) { return startReplay(); }
+
   try
   {
-    ROS_DEBUG("Constructing serial_proxy with %s at %s baud", port_name_.c_str(), baud_rate_.c_str());
-    dxl_io_ = new DynamixelIO(port_name_, baud_rate_);
+    ROS_DEBUG("Constructing serial_proxy with %s at %s baud, protocol %d", port_name_.c_str(), baud_rate_.c_str(), protocol_);
+    dxl_io_ = new DynamixelIO(port_name_, baud_rate_, protocol_, port_options_);
     if (!findMotors()) { return false; }
   }
   catch (flexiport::PortException pex)
@@ -93,6 +268,25 @@ bool SerialProxy::connect()
     return false;
   }
 
+  if (!record_file_.empty() && recorder_.open(record_file_, record_capacity_))
+  {
+    ROS_INFO("%s: Recording motor states to %s", port_namespace_.c_str(), record_file_.c_str());
+  }
+
+  // scanning for motors times out on every unused ID, start counting afresh
+  dxl_io_->getStatistics().reset();
+  bus_statistics_srv_ = nh_.advertiseService("bus_statistics/" + port_namespace_, &SerialProxy::processGetBusStatistics, this);
+
+  bus_scheduler_.start();
+
+  // the bus thread does the actual talking to the servos, so it needs the
+  // same treatment as the feedback loop waiting on it
+  boost::function<bool ()> apply = boost::bind(&SerialProxy::applyThreadSettings, this, "bus");
+  bus_scheduler_.submit(BusScheduler::HOUSEKEEPING, apply).get();
+
+  wakeup_jitter_.clear();
+  cycle_time_.clear();
+
   if (update_rate_ > 0)
   {
     terminate_feedback_ = false;
@@ -116,85 +310,212 @@ bool SerialProxy::connect()
   return true;
 }
 
+bool SerialProxy::startReplay()
+{
+  if (!replay_.open(replay_file_)) { return false; }
+
+  // the motors are whichever ones the recording has states of
+  std::vector<bool> recorded(256, false);
+
+  for (size_t i = 0; i < replay_.size(); ++i)
+  {
+    recorded[replay_[i].motor_id & 0xFF] = true;
+  }
+
+  motors_.clear();
+
+  for (int id = 0; id < 256; ++id)
+  {
+    if (recorded[id]) { motors_.push_back(id); }
+  }
+
+  if (motors_.empty())
+  {
+    ROS_WARN("%s: %s has no motor states to replay", port_namespace_.c_str(), replay_file_.c_str());
+    return false;
+  }
+
+  ROS_INFO("%s: Replaying %d motor states of %d motors from %s, the serial port is left alone",
+           port_namespace_.c_str(), (int) replay_.size(), (int) motors_.size(), replay_file_.c_str());
+
+  // there is no bus to diagnose, only the motor_states topic and the state
+  // table are fed
+  terminate_feedback_ = false;
+  feedback_thread_ = new boost::thread(boost::bind(&SerialProxy::replayMotorStates, this));
+
+  return true;
+}
+
 DynamixelIO* SerialProxy::getSerialPort()
 {
   return dxl_io_;
 }
 
-void SerialProxy::fillMotorParameters(const DynamixelData* motor_data)
+BusScheduler* SerialProxy::getBusScheduler()
 {
-  int motor_id = motor_data->id;
-  int model_number = motor_data->model_number;
+  return &bus_scheduler_;
+}
 
-  float voltage;
-  dxl_io_->getVoltage(motor_id, voltage);
+MotorStateTable* SerialProxy::getMotorStateTable()
+{
+  return &state_table_;
+}
 
-  std::stringstream ss;
-  ss << "dynamixel/" << port_namespace_ << "/" << motor_id << "/";
-  std::string prefix = ss.str();
+void SerialProxy::fillMotorParameters(const DynamixelData* motor_data, XmlRpc::XmlRpcValue& params)
+{
+  int model_number = motor_data->model_number;
+  double voltage = motor_data->voltage / 10.0;
 
-  nh_.setParam(prefix + "model_number", model_number);
-  nh_.setParam(prefix + "model_name", getMotorModelName(model_number));
-  nh_.setParam(prefix + "min_angle", motor_data->cw_angle_limit);
-  nh_.setParam(prefix + "max_angle", motor_data->ccw_angle_limit);
+  params["model_number"] = model_number;
+  params["model_name"] = getMotorModelName(model_number);
+  params["min_angle"] = (int) motor_data->cw_angle_limit;
+  params["max_angle"] = (int) motor_data->ccw_angle_limit;
 
   double torque_per_volt = getMotorModelParams(model_number, TORQUE_PER_VOLT);
-  nh_.setParam(prefix + "torque_per_volt", torque_per_volt);
-  nh_.setParam(prefix + "max_torque", torque_per_volt * voltage);
+  params["torque_per_volt"] = torque_per_volt;
+  params["max_torque"] = torque_per_volt * voltage;
 
   double velocity_per_volt = getMotorModelParams(model_number, VELOCITY_PER_VOLT);
-  nh_.setParam(prefix + "velocity_per_volt", velocity_per_volt);
-  nh_.setParam(prefix + "max_velocity", velocity_per_volt * voltage);
-  nh_.setParam(prefix + "radians_second_per_encoder_tick", velocity_per_volt * voltage / DXL_MAX_VELOCITY_ENCODER);
+  params["velocity_per_volt"] = velocity_per_volt;
+  params["max_velocity"] = velocity_per_volt * voltage;
+  params["radians_second_per_encoder_tick"] = velocity_per_volt * voltage / DXL_MAX_VELOCITY_ENCODER;
 
   int encoder_resolution = (int) getMotorModelParams(model_number, ENCODER_RESOLUTION);
   double range_degrees = getMotorModelParams(model_number, RANGE_DEGREES);
   double range_radians = range_degrees * M_PI / 180.0;
 
-  nh_.setParam(prefix + "encoder_resolution", encoder_resolution);
-  nh_.setParam(prefix + "range_degrees", range_degrees);
-  nh_.setParam(prefix + "range_radians", range_radians);
-  nh_.setParam(prefix + "encoder_ticks_per_degree", encoder_resolution / range_degrees);
-  nh_.setParam(prefix + "encoder_ticks_per_radian", encoder_resolution / range_radians);
-  nh_.setParam(prefix + "degrees_per_encoder_tick", range_degrees / encoder_resolution);
-  nh_.setParam(prefix + "radians_per_encoder_tick", range_radians / encoder_resolution);
+  params["encoder_resolution"] = encoder_resolution;
+  params["range_degrees"] = range_degrees;
+  params["range_radians"] = range_radians;
+  params["encoder_ticks_per_degree"] = encoder_resolution / range_degrees;
+  params["encoder_ticks_per_radian"] = encoder_resolution / range_radians;
+  params["degrees_per_encoder_tick"] = range_degrees / encoder_resolution;
+  params["radians_per_encoder_tick"] = range_radians / encoder_resolution;
+}
+
+// The cache is a text file with a "range <min id> <max id>" line followed by
+// a "motor <id> <model number>" line for every motor found last time.
+bool SerialProxy::readTopologyCache(std::map<int, int>& models)
+{
+  if (topology_cache_.empty()) { return false; }
+
+  std::ifstream cache(topology_cache_.c_str());
+  if (!cache) { return false; }
+
+  std::string keyword;
+  int min_id = -1;
+  int max_id = -1;
+
+  if (!(cache >> keyword >> min_id >> max_id) || keyword != "range" ||
+      min_id != min_motor_id_ || max_id != max_motor_id_)
+  {
+    ROS_INFO("%s: Ignoring topology cache %s, it is for a different range of motor IDs",
+             port_namespace_.c_str(), topology_cache_.c_str());
+    return false;
+  }
+
+  int motor_id;
+  int model_number;
+
+  while (cache >> keyword >> motor_id >> model_number && keyword == "motor")
+  {
+    models[motor_id] = model_number;
+  }
+
+  return !models.empty();
+}
+
+void SerialProxy::writeTopologyCache()
+{
+  if (topology_cache_.empty()) { return; }
+
+  std::ofstream cache(topology_cache_.c_str());
+  cache << "range " << min_motor_id_ << " " << max_motor_id_ << "\n";
+
+  for (size_t i = 0; i < motors_.size(); ++i)
+  {
+    cache << "motor " << motors_[i] << " " << motor_static_info_[motors_[i]]->model_number << "\n";
+  }
+
+  if (!cache)
+  {
+    ROS_WARN("%s: Unable to write topology cache %s", port_namespace_.c_str(), topology_cache_.c_str());
+  }
 }
 
 bool SerialProxy::findMotors()
 {
   ROS_INFO("%s: Pinging motor IDs %d through %d...", port_namespace_.c_str(), min_motor_id_, max_motor_id_);
 
-  XmlRpc::XmlRpcValue val;
-  std::map<int, int> counts;
+  std::vector<int> found;
+  std::map<int, int> expected;
+  bool verified = false;
 
-  for (int motor_id = min_motor_id_; motor_id <= max_motor_id_; ++motor_id)
+  // motors found last time get the usual timeout, if every one of them is
+  // still there and still the same model there is nothing left to scan for
+  if (readTopologyCache(expected))
   {
-    if (dxl_io_->ping(motor_id))
+    std::vector<int> expected_ids;
+    for (std::map<int, int>::iterator it = expected.begin(); it != expected.end(); ++it)
     {
-      const DynamixelData* motor_data;
+      expected_ids.push_back(it->first);
+    }
 
-      if ((motor_data = dxl_io_->getCachedParameters(motor_id)) == NULL)
-      {
-        ROS_ERROR("Unable to retrieve cached paramaters for motor %d on port %s after successfull ping", motor_id, port_namespace_.c_str());
-        continue;
-      }
+    dxl_io_->discover(expected_ids, 50000, found);
+    verified = (found.size() == expected_ids.size());
 
-      counts[motor_data->model_number] += 1;
-      motor_static_info_[motor_id] = motor_data;
-      fillMotorParameters(motor_data);
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+      verified &= (dxl_io_->getKnownParameters(found[i])->model_number == expected[found[i]]);
+    }
 
-      motors_.push_back(motor_id);
-      val[motors_.size()-1] = motor_id;
+    if (!verified)
+    {
+      ROS_INFO("%s: Motors differ from topology cache %s, scanning", port_namespace_.c_str(), topology_cache_.c_str());
     }
   }
 
+  if (!verified)
+  {
+    // an unused ID costs the scan timeout, not the usual 50 ms
+    std::vector<int> candidates;
+    for (int motor_id = min_motor_id_; motor_id <= max_motor_id_; ++motor_id)
+    {
+      if (std::find(found.begin(), found.end(), motor_id) == found.end()) { candidates.push_back(motor_id); }
+    }
+
+    dxl_io_->discover(candidates, (int) (scan_timeout_ * 1.0e6), found);
+    std::sort(found.begin(), found.end());
+  }
+
+  // everything goes up to the parameter server in one call
+  XmlRpc::XmlRpcValue port_params;
+  XmlRpc::XmlRpcValue val;
+  std::map<int, int> counts;
+
+  for (size_t i = 0; i < found.size(); ++i)
+  {
+    int motor_id = found[i];
+    const DynamixelData* motor_data = dxl_io_->getKnownParameters(motor_id);
+
+    counts[motor_data->model_number] += 1;
+    motor_static_info_[motor_id] = motor_data;
+    fillMotorParameters(motor_data, port_params[boost::lexical_cast<std::string>(motor_id)]);
+
+    motors_.push_back(motor_id);
+    val[motors_.size()-1] = motor_id;
+  }
+
   if (motors_.empty())
   {
     ROS_WARN("%s: No motors found.", port_namespace_.c_str());
     return false;
   }
 
-  nh_.setParam("dynamixel/" + port_namespace_ + "/connected_ids", val);
+  port_params["connected_ids"] = val;
+  nh_.setParam("dynamixel/" + port_namespace_, port_params);
+
+  if (!verified) { writeTopologyCache(); }
 
   std::stringstream ss;
   ss << port_namespace_ << ": Found " << motors_.size() << " motors - ";
@@ -223,18 +544,74 @@ bool SerialProxy::findMotors()
   return true;
 }
 
-void SerialProxy::updateMotorStates()
+bool SerialProxy::applyThreadSettings(const char* thread_name)
 {
-  //ros::Rate rate(update_rate_);
-  current_state_->motor_states.resize(motors_.size());
-  dynamixel_hardware_interface::DynamixelStatus status;
+  return applyRealtimeSettings(port_namespace_, thread_name, realtime_priority_, cpu_affinity_);
+}
 
-  double allowed_time_usec = 1.0e6 / update_rate_;
-  int sleep_time_usec = 0;
+bool SerialProxy::probeMotor(int motor_id)
+{
+  // re-reads the control table, so a servo that reset comes back with what
+  // it is set to now
+  std::vector<int> ids(1, motor_id);
+  std::vector<int> found;
+  dxl_io_->discover(ids, (int) (scan_timeout_ * 1.0e6), found);
 
-  struct timespec ts_now;
-  double start_time_usec;
-  double end_time_usec;
+  return !found.empty();
+}
+
+void SerialProxy::updateMotorStates()
+{
+  applyThreadSettings("feedback");
+
+  state_pool_.resize(motors_.size());
+  std::vector<DynamixelStatus> statuses(motors_.size());
+  std::vector<bool> valid(motors_.size());
+  std::vector<MotorStateSample> samples(motors_.size());
+
+  // The first cycle reads everything, after that every cycle reads the fast
+  // registers of all servos and the slow ones of just enough of them, taken
+  // round robin, for each servo to get its slow registers read
+  // slow_update_rate_ times a second.
+  std::vector<int> groups(motors_.size(), DXL_FEEDBACK_ALL);
+  double slow_per_cycle = motors_.size();
+  double slow_credit = 0.0;
+  size_t slow_next = 0;
+
+  if (slow_update_rate_ > 0 && slow_update_rate_ < update_rate_)
+  {
+    slow_per_cycle = motors_.size() * slow_update_rate_ / update_rate_;
+  }
+
+  // A motor that stopped answering would cost every cycle a response timeout
+  // and, in a BULK_READ, silence every motor listed after it. Only motors
+  // that are not dropped are polled, through these, rebuilt whenever the
+  // set changes.
+  std::vector<MotorHealth> health(motors_.size());
+  std::vector<int> poll_ids;
+  std::vector<size_t> poll_index;
+  std::vector<int> poll_groups;
+  std::vector<DynamixelStatus> poll_statuses;
+  std::vector<bool> poll_valid;
+  bool poll_changed = true;
+
+  poll_ids.reserve(motors_.size());
+  poll_index.reserve(motors_.size());
+  poll_groups.reserve(motors_.size());
+  poll_statuses.reserve(motors_.size());
+
+  boost::function<bool ()> poll = boost::bind(&DynamixelIO::getGroupFeedback, dxl_io_, boost::cref(poll_ids),
+                                              boost::cref(poll_groups), boost::ref(poll_statuses),
+                                              boost::ref(poll_valid));
+
+  // every cycle is due a whole period after the previous one, no matter how
+  // long the cycles take, so the rate does not drift
+  const int64_t period_nsec = NSEC_PER_SEC / update_rate_;
+  struct timespec deadline;
+  struct timespec start;
+  struct timespec end;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
 
   while (nh_.ok())
   {
@@ -243,56 +620,209 @@ void SerialProxy::updateMotorStates()
       if (terminate_feedback_) { break; }
     }
 
-    clock_gettime(CLOCK_REALTIME, &ts_now);
-    start_time_usec = ts_now.tv_sec * 1.0e6 + ts_now.tv_nsec / 1.0e3;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t wakeup_nsec = std::max<int64_t>(diffNsec(start, deadline), 0);
+
+    if (poll_changed)
+    {
+      poll_ids.clear();
+      poll_index.clear();
+
+      for (size_t i = 0; i < motors_.size(); ++i)
+      {
+        if (health[i].dropped) { continue; }
+        poll_ids.push_back(motors_[i]);
+        poll_index.push_back(i);
+      }
+
+      poll_groups.resize(poll_ids.size());
+      poll_statuses.resize(poll_ids.size());
+      poll_changed = false;
+    }
+
+    for (size_t j = 0; j < poll_ids.size(); ++j)
+    {
+      poll_groups[j] = groups[poll_index[j]];
+      poll_statuses[j] = statuses[poll_index[j]];
+    }
+
+    // poll the whole bus at once, MX servos answer a single BULK_READ
+    if (!poll_ids.empty()) { bus_scheduler_.submit(BusScheduler::FEEDBACK, poll).get(); }
+
+    valid.assign(motors_.size(), false);
+
+    for (size_t j = 0; j < poll_ids.size(); ++j)
+    {
+      statuses[poll_index[j]] = poll_statuses[j];
+      valid[poll_index[j]] = poll_valid[j];
+    }
 
     for (size_t i = 0; i < motors_.size(); ++i)
     {
       int motor_id = motors_[i];
+      MotorHealth& h = health[i];
 
-      if (dxl_io_->getFeedback(motor_id, status))
+      if (valid[i])
       {
         const DynamixelData* data = motor_static_info_[motor_id];
-        MotorState ms;
-        ms.timestamp = status.timestamp;
-        ms.id = motor_id;
-        ms.target_position = data->target_position;
-        ms.target_velocity = data->target_velocity;
-        ms.position = status.position;
-        ms.velocity = status.velocity;
-        ms.torque_limit = status.torque_limit;
-        ms.load = status.load;
-        ms.moving = status.moving;
-        ms.voltage = status.voltage;
-        ms.temperature = status.temperature;
-        current_state_->motor_states[i] = ms;
-        current_state_->motor_states[i].alive = true; // as long as we are reciving feedback the servo is considered alive
+        samples[i].status = statuses[i];
+        samples[i].target_position = data->target_position;
+        samples[i].target_velocity = data->target_velocity;
+        samples[i].alive = true; // as long as we are reciving feedback the servo is considered alive
+        h.failures = 0;
       }
       else
       {
         ROS_DEBUG("Bad feedback received from motor %d on port %s", motor_id, port_namespace_.c_str());
-        current_state_->motor_states[i].alive = false; // note that data is stale
+        samples[i].alive = false; // note that data is stale
+
+        if (!h.dropped && ++h.failures >= MOTOR_DROP_FAILURES)
+        {
+          ROS_WARN("%s: Motor %d stopped answering, dropping it from the feedback cycle", port_namespace_.c_str(), motor_id);
+          h.dropped = true;
+          h.backoff = PROBE_BACKOFF_MIN;
+          h.next_probe = start.tv_sec + start.tv_nsec / 1.0e9 + h.backoff;
+          poll_changed = true;
+        }
+      }
+    }
+
+    publishMotorStates(samples);
+
+    if (recorder_.isOpen())
+    {
+      uint64_t stamp = start.tv_sec * NSEC_PER_SEC + start.tv_nsec;
+      uint32_t cycle = state_table_.getCycle();
+
+      for (size_t i = 0; i < motors_.size(); ++i)
+      {
+        recorder_.append(stamp, cycle, motors_[i], samples[i]);
       }
     }
 
-    motor_states_pub_.publish(current_state_);
-    freq_status_.tick();
+    // pick the servos whose slow registers are read next cycle
+    std::fill(groups.begin(), groups.end(), DXL_FEEDBACK_FAST);
+    slow_credit = std::min(slow_credit + slow_per_cycle, (double) motors_.size());
 
-    clock_gettime(CLOCK_REALTIME, &ts_now);
-    end_time_usec = ts_now.tv_sec * 1.0e6 + ts_now.tv_nsec / 1.0e3;
+    while (slow_credit >= 1.0)
+    {
+      groups[slow_next] = DXL_FEEDBACK_ALL;
+      slow_next = (slow_next + 1) % motors_.size();
+      slow_credit -= 1.0;
+    }
 
-    sleep_time_usec = allowed_time_usec - (end_time_usec - start_time_usec);
+    // probes run on the bus thread between feedback cycles, the loop only
+    // starts them and picks up the result once it is there
+    double now_sec = start.tv_sec + start.tv_nsec / 1.0e9;
 
-    // do millisecond resolution sleep
-    if (sleep_time_usec >= 1000)
+    for (size_t i = 0; i < motors_.size(); ++i)
     {
-      sleep_time_usec = (sleep_time_usec / 1000) * 1000;
-      usleep(sleep_time_usec);
+      MotorHealth& h = health[i];
+      if (!h.dropped) { continue; }
+
+      if (h.probing)
+      {
+        if (!h.probe.is_ready()) { continue; }
+        h.probing = false;
+
+        if (h.probe.get())
+        {
+          ROS_INFO("%s: Motor %d is answering again, back in the feedback cycle", port_namespace_.c_str(), motors_[i]);
+          h.dropped = false;
+          h.failures = 0;
+          groups[i] = DXL_FEEDBACK_ALL;
+          poll_changed = true;
+          continue;
+        }
+
+        h.next_probe = now_sec + h.backoff;
+        h.backoff = std::min(h.backoff * 2.0, PROBE_BACKOFF_MAX);
+      }
+      else if (now_sec >= h.next_probe)
+      {
+        boost::function<bool ()> probe = boost::bind(&SerialProxy::probeMotor, this, motors_[i]);
+        h.probe = bus_scheduler_.submit(BusScheduler::HOUSEKEEPING, probe);
+        h.probing = true;
+      }
     }
 
-    // ros sleep somehow takes a lot more cpu time
-    //rate.sleep();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t missed = advanceDeadline(deadline, period_nsec, end);
+
+    {
+      boost::mutex::scoped_lock stats_lock(loop_stats_mutex_);
+      wakeup_jitter_.record(wakeup_nsec / 1000);
+      cycle_time_.record(diffNsec(end, start) / 1000);
+      overruns_ += missed;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+  }
+}
+
+void SerialProxy::replayMotorStates()
+{
+  applyThreadSettings("feedback");
+
+  state_pool_.resize(motors_.size());
+  std::vector<MotorStateSample> samples(motors_.size());
+  std::vector<int> index(256, -1);
+
+  for (size_t i = 0; i < motors_.size(); ++i)
+  {
+    index[motors_[i] & 0xFF] = i;
   }
+
+  // cycles are published as far apart as they were recorded, a motor missing
+  // from a cycle keeps its state from the one before
+  struct timespec begin;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  size_t next = 0;
+
+  while (nh_.ok() && next < replay_.size())
+  {
+    {
+      boost::mutex::scoped_lock terminate_lock(terminate_mutex_);
+      if (terminate_feedback_) { break; }
+    }
+
+    uint32_t cycle = replay_[next].cycle;
+    struct timespec deadline = begin;
+    addNsec(deadline, replay_[next].stamp - replay_[0].stamp);
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+
+    for (; next < replay_.size() && replay_[next].cycle == cycle; ++next)
+    {
+      const MotorStateRecord& record = replay_[next];
+      int i = index[record.motor_id & 0xFF];
+      if (i >= 0) { samples[i] = record.sample; }
+    }
+
+    publishMotorStates(samples);
+  }
+
+  ROS_INFO("%s: Replay of %s finished", port_namespace_.c_str(), replay_file_.c_str());
+}
+
+void SerialProxy::publishMotorStates(const std::vector<MotorStateSample>& samples)
+{
+  // nobody else holds this message, it was last filled a few cycles ago
+  MotorStateListPtr state = state_pool_.acquire();
+
+  for (size_t i = 0; i < motors_.size(); ++i)
+  {
+    state_table_.update(motors_[i], samples[i]);
+    copyMotorState(motors_[i], samples[i], state->motor_states[i]);
+  }
+
+  // controllers in this process react before the message goes out
+  state_table_.commit();
+
+  state_pool_.publish(state);
+  motor_states_pub_.publish(state);
+  freq_status_.tick();
 }
 
 void SerialProxy::publishDiagnosticInformation()
@@ -301,6 +831,56 @@ void SerialProxy::publishDiagnosticInformation()
   diagnostic_updater::DiagnosticStatusWrapper bus_status;
   ros::Rate rate(diagnostics_rate_);
 
+  BusStatistics& statistics = dxl_io_->getStatistics();
+  BusStatistics::Counters last_total;
+  BusStatistics::Counters last_instructions[BusStatistics::NUM_INSTRUCTION_CLASSES];
+  std::map<int, BusStatistics::Counters> last_motors;
+  std::map<int, BusStatistics::Counters> motor_windows;
+
+  statistics.getTotal(last_total);
+  for (int i = 0; i < BusStatistics::NUM_INSTRUCTION_CLASSES; ++i)
+  {
+    statistics.getInstruction((BusStatistics::InstructionClass) i, last_instructions[i]);
+  }
+
+  // The message keeps one entry per motor from one period to the next. What
+  // was read at discovery is formatted here once, the rest is updated in
+  // place, and only where it changed.
+  diag_msg.status.resize(1 + motors_.size());
+  std::vector<MotorDiagnostics> motor_diagnostics(motors_.size());
+
+  for (size_t i = 0; i < motors_.size(); ++i)
+  {
+    int motor_id = motors_[i];
+    const DynamixelData* data = motor_static_info_[motor_id];
+    std::string mid_str = boost::lexical_cast<std::string>(motor_id);
+
+    diagnostic_updater::DiagnosticStatusWrapper motor_status;
+
+    motor_status.name = "Robotis Dynamixel Motor " + mid_str + " on port " + port_namespace_;
+    motor_status.hardware_id = "ID " + mid_str + " on port " + port_name_;
+    motor_status.add("Model Name", getMotorModelName(data->model_number).c_str());
+    motor_status.addf("Firmware Version", "%d", data->firmware_version);
+    motor_status.addf("Return Delay Time", "%d", data->return_delay_time);
+    motor_status.addf("Minimum Voltage", "%0.1f", data->voltage_limit_low / 10.0);
+    motor_status.addf("Maximum Voltage", "%0.1f", data->voltage_limit_high / 10.0);
+    motor_status.addf("Maximum Torque", "%d", data->max_torque);
+    motor_status.addf("Minimum Position (CW)", "%d", data->cw_angle_limit);
+    motor_status.addf("Maximum Position (CCW)", "%d", data->ccw_angle_limit);
+    motor_status.addf("Compliance Margin (CW)", "%d", data->cw_compliance_margin);
+    motor_status.addf("Compliance Margin (CCW)", "%d", data->ccw_compliance_margin);
+    motor_status.addf("Compliance Slope (CW)", "%d", data->cw_compliance_slope);
+    motor_status.addf("Compliance Slope (CCW)", "%d", data->ccw_compliance_slope);
+
+    motor_diagnostics[i].first_value = motor_status.values.size();
+    motor_diagnostics[i].formatted = false;
+
+    for (int v = 0; v < NUM_DIAG_VALUES; ++v) { motor_status.add(DIAG_VALUE_KEYS[v], ""); }
+
+    motor_status.summary(motor_status.WARN, "No feedback received yet");
+    diag_msg.status[1 + i] = motor_status;
+  }
+
   while (nh_.ok())
   {
     {
@@ -308,15 +888,103 @@ void SerialProxy::publishDiagnosticInformation()
       if (terminate_diagnostics_) { break; }
     }
 
-    double error_rate = dxl_io_->read_error_count / (double) dxl_io_->read_count;
+    // everything below is about what happened since the previous message
+    BusStatistics::Counters total;
+    statistics.getTotal(total);
+    takeWindow(total, last_total);
+
+    uint64_t transactions = total.outcomes[BusStatistics::RESPONSE] + total.failures();
+    double error_rate = transactions > 0 ? total.failures() / (double) transactions : 0.0;
+
+    // the motor that failed to answer most often is the one to look at first
+    int worst_motor = -1;
+    uint64_t worst_failures = 0;
+
+    for (size_t i = 0; i < motors_.size(); ++i)
+    {
+      BusStatistics::Counters& window = motor_windows[motors_[i]];
+      statistics.getMotor(motors_[i], window);
+      takeWindow(window, last_motors[motors_[i]]);
+
+      if (window.failures() > worst_failures)
+      {
+        worst_motor = motors_[i];
+        worst_failures = window.failures();
+      }
+    }
+
+    LatencyHistogram wakeup_jitter;
+    LatencyHistogram cycle_time;
+    uint64_t overruns;
+
+    {
+      boost::mutex::scoped_lock stats_lock(loop_stats_mutex_);
+      wakeup_jitter = wakeup_jitter_;
+      cycle_time = cycle_time_;
+      overruns = overruns_;
+      wakeup_jitter_.clear();
+      cycle_time_.clear();
+      overruns_ = 0;
+    }
 
     bus_status.clear();
     bus_status.name = "Dynamixel Serial Bus (" + port_namespace_ + ")";
     bus_status.hardware_id = "Dynamixel Serial Bus on port " + port_name_;
     bus_status.add("Baud Rate", baud_rate_);
+    bus_status.add("Protocol", protocol_);
+    if (!port_options_.empty()) { bus_status.add("Port Options", port_options_); }
+    if (realtime_priority_ > 0) { bus_status.add("Realtime Priority", realtime_priority_); }
+    if (cpu_affinity_ >= 0) { bus_status.add("CPU Affinity", cpu_affinity_); }
+    bus_status.add("Slow Update Rate", slow_update_rate_);
     bus_status.add("Min Motor ID", min_motor_id_);
     bus_status.add("Max Motor ID", max_motor_id_);
     bus_status.addf("Error Rate", "%0.5f", error_rate);
+    bus_status.addf("Round Trip Latency", "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                    total.latency.percentile(0.5), total.latency.percentile(0.99), (double) total.latency.max_usec);
+
+    if (cycle_time.count > 0)
+    {
+      bus_status.addf("Wakeup Jitter", "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                      wakeup_jitter.percentile(0.5), wakeup_jitter.percentile(0.99), (double) wakeup_jitter.max_usec);
+      bus_status.addf("Cycle Time", "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                      cycle_time.percentile(0.5), cycle_time.percentile(0.99), (double) cycle_time.max_usec);
+      bus_status.addf("Overruns", "%llu", (unsigned long long) overruns);
+    }
+
+    for (int o = BusStatistics::HEADER_TIMEOUT; o < BusStatistics::NUM_OUTCOMES; ++o)
+    {
+      bus_status.addf(BusStatistics::getOutcomeName((BusStatistics::Outcome) o), "%llu",
+                      (unsigned long long) total.outcomes[o]);
+    }
+
+    if (worst_motor >= 0)
+    {
+      bus_status.addf("Most Failures", "motor %d, %llu", worst_motor, (unsigned long long) worst_failures);
+    }
+
+    for (int i = 0; i < BusStatistics::NUM_INSTRUCTION_CLASSES; ++i)
+    {
+      BusStatistics::InstructionClass instruction = (BusStatistics::InstructionClass) i;
+      BusStatistics::Counters window;
+      statistics.getInstruction(instruction, window);
+      takeWindow(window, last_instructions[i]);
+
+      if (window.latency.count == 0) { continue; }
+
+      bus_status.addf(std::string(BusStatistics::getInstructionName(instruction)) + " Round Trip Latency",
+                      "%0.0f us p50, %0.0f us p99, %0.0f us max",
+                      window.latency.percentile(0.5), window.latency.percentile(0.99), (double) window.latency.max_usec);
+    }
+
+    for (int p = 0; p < BusScheduler::NUM_PRIORITIES; ++p)
+    {
+      BusScheduler::Priority priority = (BusScheduler::Priority) p;
+      BusLatency latency = bus_scheduler_.getLatency(priority, true);
+      bus_status.addf(std::string(BusScheduler::getPriorityName(priority)) + " Queue Latency",
+                      "%0.0f us mean, %0.0f us max over %lu requests",
+                      latency.mean_usec, latency.max_usec, latency.count);
+    }
+
     bus_status.summary(bus_status.OK, "OK");
 
     freq_status_.run(bus_status);
@@ -326,83 +994,95 @@ void SerialProxy::publishDiagnosticInformation()
       bus_status.mergeSummary(bus_status.WARN, "Too many errors while reading/writing to/from Dynamixel bus");
     }
 
-    diag_msg.status.clear();
+    if (overruns > 0)
+    {
+      bus_status.mergeSummary(bus_status.WARN, "Feedback loop is missing its deadlines");
+    }
+
     diag_msg.header.stamp = ros::Time::now();
-    diag_msg.status.push_back(bus_status);
+    diag_msg.status[0] = bus_status;
+
+    // the pool does not touch a message while we hold on to it
+    MotorStateListConstPtr state = state_pool_.latest();
+    size_t motor_count = state ? std::min(state->motor_states.size(), motors_.size()) : 0;
+    diagnostic_updater::DiagnosticStatusWrapper summary;
 
-    for (size_t i = 0; i < current_state_->motor_states.size(); ++i)
+    for (size_t i = 0; i < motor_count; ++i)
     {
-      MotorState motor_state = current_state_->motor_states[i];
+      const MotorState& motor_state = state->motor_states[i];
       int motor_id = motor_state.id;
 
       // check if current motor state was already populated by updateMotorStates thread
       if (motor_state.timestamp == 0.0) { continue; }
 
       const DynamixelData* data = motor_static_info_[motor_id];
-      std::string mid_str = boost::lexical_cast<std::string>(motor_id);
-
-      diagnostic_updater::DiagnosticStatusWrapper motor_status;
-
-      motor_status.name = "Robotis Dynamixel Motor " + mid_str + " on port " + port_namespace_;
-      motor_status.hardware_id = "ID " + mid_str + " on port " + port_name_;
-      motor_status.add("Model Name", getMotorModelName(data->model_number).c_str());
-      motor_status.addf("Firmware Version", "%d", data->firmware_version);
-      motor_status.addf("Return Delay Time", "%d", data->return_delay_time);
-      motor_status.addf("Minimum Voltage", "%0.1f", data->voltage_limit_low / 10.0);
-      motor_status.addf("Maximum Voltage", "%0.1f", data->voltage_limit_high / 10.0);
-      motor_status.addf("Maximum Torque", "%d", data->max_torque);
-      motor_status.addf("Minimum Position (CW)", "%d", data->cw_angle_limit);
-      motor_status.addf("Maximum Position (CCW)", "%d", data->ccw_angle_limit);
-      motor_status.addf("Compliance Margin (CW)", "%d", data->cw_compliance_margin);
-      motor_status.addf("Compliance Margin (CCW)", "%d", data->ccw_compliance_margin);
-      motor_status.addf("Compliance Slope (CW)", "%d", data->cw_compliance_slope);
-      motor_status.addf("Compliance Slope (CCW)", "%d", data->ccw_compliance_slope);
-      motor_status.add("Torque Enabled", data->torque_enabled ? "True" : "False");
-
-      motor_status.add("Moving", motor_state.moving ? "True" : "False");
-      motor_status.addf("Target Position", "%d", motor_state.target_position);
-      motor_status.addf("Target Velocity", "%d", motor_state.target_velocity);
-      motor_status.addf("Position", "%d", motor_state.position);
-      motor_status.addf("Velocity", "%d", motor_state.velocity);
-      motor_status.addf("Position Error", "%d", motor_state.position - motor_state.target_position);
-      motor_status.addf("Velocity Error", "%d", motor_state.velocity != 0 ? motor_state.velocity - motor_state.target_velocity : 0);
-      motor_status.addf("Torque Limit", "%d", motor_state.torque_limit);
-      motor_status.addf("Load", "%d", motor_state.load);
-      motor_status.addf("Voltage", "%0.1f", motor_state.voltage / 10.0);
-      motor_status.addf("Temperature", "%d", motor_state.temperature);
-
-      motor_status.summary(motor_status.OK, "OK");
+      diagnostic_msgs::DiagnosticStatus& motor_status = diag_msg.status[1 + i];
+      MotorDiagnostics& diag = motor_diagnostics[i];
+      int threshold = diagnostics_threshold_;
+
+      int position_error = motor_state.position - motor_state.target_position;
+      int velocity_error = motor_state.velocity != 0 ? motor_state.velocity - motor_state.target_velocity : 0;
+
+      updateValue(motor_status, diag, DIAG_TORQUE_ENABLED, 0, data->torque_enabled ? "True" : "False", data->torque_enabled);
+      updateValue(motor_status, diag, DIAG_MOVING, 0, motor_state.moving ? "True" : "False", motor_state.moving);
+      updateValue(motor_status, diag, DIAG_TARGET_POSITION, threshold, "%d", motor_state.target_position);
+      updateValue(motor_status, diag, DIAG_TARGET_VELOCITY, threshold, "%d", motor_state.target_velocity);
+      updateValue(motor_status, diag, DIAG_POSITION, threshold, "%d", motor_state.position);
+      updateValue(motor_status, diag, DIAG_VELOCITY, threshold, "%d", motor_state.velocity);
+      updateValue(motor_status, diag, DIAG_POSITION_ERROR, threshold, "%d", position_error);
+      updateValue(motor_status, diag, DIAG_VELOCITY_ERROR, threshold, "%d", velocity_error);
+      updateValue(motor_status, diag, DIAG_TORQUE_LIMIT, 0, "%d", motor_state.torque_limit);
+      updateValue(motor_status, diag, DIAG_LOAD, threshold, "%d", motor_state.load);
+      updateValue(motor_status, diag, DIAG_VOLTAGE, 0, "%d.%d", motor_state.voltage / 10, motor_state.voltage % 10);
+      updateValue(motor_status, diag, DIAG_TEMPERATURE, 0, "%d", motor_state.temperature);
+
+      const BusStatistics::Counters& window = motor_windows[motor_id];
+      updateValue(motor_status, diag, DIAG_LATENCY, 0, "%d us p50, %d us p99, %d us max",
+                  (int) window.latency.percentile(0.5), (int) window.latency.percentile(0.99), (int) window.latency.max_usec);
+      updateValue(motor_status, diag, DIAG_FAILURES, 0, "%d of %d requests",
+                  (int) window.failures(), (int) window.requests);
+
+      diag.formatted = true;
+
+      summary.summary(summary.OK, "OK");
 
       if (motor_state.temperature >= error_level_temp_)
       {
-        motor_status.summary(motor_status.ERROR, "Overheating");
+        summary.summary(summary.ERROR, "Overheating");
       }
       else if (motor_state.temperature >= warn_level_temp_)
       {
-        motor_status.summary(motor_status.WARN, "Very hot");
+        summary.summary(summary.WARN, "Very hot");
       }
 
       // if there was an overload or overheating error
       if (data->shutdown_error_time > 0.0)
       {
         ROS_ERROR_THROTTLE(1, "%s: %s", port_namespace_.c_str(), data->error.c_str());
-        motor_status.mergeSummary(motor_status.ERROR, "Overload/Overheating error");
+        summary.mergeSummary(summary.ERROR, "Overload/Overheating error");
 
         // if current motor temperature is under control and
         // we just arbitrarily waited 5 seconds just for kicks
         if (motor_state.temperature < warn_level_temp_ &&
             ros::Time::now().toSec() - data->shutdown_error_time >= 5.0)
         {
-          dxl_io_->resetOverloadError(motor_id);
+          bus_scheduler_.post(BusScheduler::HOUSEKEEPING,
+                              boost::bind(&DynamixelIO::resetOverloadError, dxl_io_, motor_id));
           ROS_WARN("%s: Reset overload/overheating error on motor %d", port_namespace_.c_str(), motor_id);
         }
       }
       else if (motor_state.torque_limit == 0)
       {
-        motor_status.mergeSummary(motor_status.ERROR, "Torque limit is 0");
+        summary.mergeSummary(summary.ERROR, "Torque limit is 0");
       }
 
-      diag_msg.status.push_back(motor_status);
+      if (window.requests > 0 && window.failures() > 0.05 * window.requests)
+      {
+        summary.mergeSummary(summary.WARN, "Not answering reliably");
+      }
+
+      motor_status.level = summary.level;
+      if (motor_status.message != summary.message) { motor_status.message = summary.message; }
     }
 
     diagnostics_pub_.publish(diag_msg);
@@ -410,4 +1090,35 @@ void SerialProxy::publishDiagnosticInformation()
   }
 }
 
+
+bool SerialProxy::processGetBusStatistics(GetBusStatistics::Request& req, GetBusStatistics::Response& res)
+{
+  BusStatistics& statistics = dxl_io_->getStatistics();
+  BusStatistics::Counters counters;
+
+  statistics.getTotal(counters);
+  fillTransactionStatistics(port_namespace_, counters, res.total);
+
+  res.instructions.resize(BusStatistics::NUM_INSTRUCTION_CLASSES);
+
+  for (int i = 0; i < BusStatistics::NUM_INSTRUCTION_CLASSES; ++i)
+  {
+    BusStatistics::InstructionClass instruction = (BusStatistics::InstructionClass) i;
+    statistics.getInstruction(instruction, counters);
+    fillTransactionStatistics(BusStatistics::getInstructionName(instruction), counters, res.instructions[i]);
+  }
+
+  res.motors.resize(motors_.size());
+
+  for (size_t i = 0; i < motors_.size(); ++i)
+  {
+    statistics.getMotor(motors_[i], counters);
+    fillTransactionStatistics(boost::lexical_cast<std::string>(motors_[i]), counters, res.motors[i]);
+  }
+
+  if (req.reset) { statistics.reset(); }
+
+  return true;
+}
+
 }
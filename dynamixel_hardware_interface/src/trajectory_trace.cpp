@@ -0,0 +1,242 @@
+// Author: Antons Rebguns
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <dynamixel_hardware_interface/trajectory_trace.h>
+
+#include <ros/ros.h>
+
+namespace dynamixel_hardware_interface
+{
+
+namespace
+{
+
+const char TRACE_MAGIC[8] = { 'D', 'X', 'L', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t TRACE_VERSION = 1;
+
+// how often the writer wakes up to write out the ring
+const useconds_t WRITE_PERIOD_USEC = 50000;
+
+// Start of the file, followed by the joint names, each ending with a '\0',
+// and then the records
+struct TraceFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t joint_count;
+  uint32_t record_size;
+  uint32_t names_size;
+};
+
+bool writeAll(int fd, const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = ::write(fd, data, size);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) { continue; }
+      return false;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  return true;
+}
+
+}
+
+TrajectoryTrace::TrajectoryTrace()
+  : fd_(-1),
+    joint_count_(0),
+    record_size_(0),
+    capacity_(0),
+    head_(0),
+    tail_(0),
+    sequence_(0),
+    dropped_(0),
+    failed_(false),
+    stopping_(false),
+    writer_thread_(NULL)
+{
+}
+
+TrajectoryTrace::~TrajectoryTrace()
+{
+  close();
+}
+
+bool TrajectoryTrace::open(const std::string& path, const std::vector<std::string>& joint_names, size_t capacity)
+{
+  close();
+
+  if (capacity == 0 || joint_names.empty()) { return false; }
+
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+  if (fd_ < 0)
+  {
+    ROS_ERROR("Unable to create trajectory trace %s: %s", path.c_str(), strerror(errno));
+    return false;
+  }
+
+  std::string names;
+  for (size_t j = 0; j < joint_names.size(); ++j)
+  {
+    names += joint_names[j];
+    names += '\0';
+  }
+
+  joint_count_ = joint_names.size();
+  record_size_ = sizeof(TraceRecordHeader) + 3 * joint_count_ * sizeof(double);
+
+  TraceFileHeader header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.joint_count = joint_count_;
+  header.record_size = record_size_;
+  header.names_size = names.size();
+
+  if (!writeAll(fd_, reinterpret_cast<const char*>(&header), sizeof(header)) ||
+      !writeAll(fd_, names.data(), names.size()))
+  {
+    ROS_ERROR("Unable to write trajectory trace %s: %s", path.c_str(), strerror(errno));
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+
+  // the whole ring is allocated and touched now, pushing a record never faults a page in
+  ring_.assign(capacity * record_size_, 0);
+
+  path_ = path;
+  capacity_ = capacity;
+  head_ = 0;
+  tail_ = 0;
+  sequence_ = 0;
+  dropped_ = 0;
+  failed_ = false;
+  stopping_ = false;
+
+  writer_thread_ = new boost::thread(boost::bind(&TrajectoryTrace::drain, this));
+
+  return true;
+}
+
+void TrajectoryTrace::close()
+{
+  if (writer_thread_)
+  {
+    stopping_ = true;
+    writer_thread_->join();
+    delete writer_thread_;
+    writer_thread_ = NULL;
+  }
+
+  if (fd_ >= 0)
+  {
+    ::close(fd_);
+    fd_ = -1;
+  }
+
+  std::vector<char>().swap(ring_);
+}
+
+bool TrajectoryTrace::isOpen() const
+{
+  return writer_thread_ != NULL;
+}
+
+bool TrajectoryTrace::push(uint64_t stamp, const double* desired, const double* actual)
+{
+  uint64_t head = head_;
+  uint64_t sequence = sequence_++;
+
+  if (head - tail_ >= capacity_)
+  {
+    dropped_ = dropped_ + 1;
+    return false;
+  }
+
+  TraceRecordHeader* record = reinterpret_cast<TraceRecordHeader*>(&ring_[(head % capacity_) * record_size_]);
+  record->stamp = stamp;
+  record->sequence = sequence;
+
+  double* values = reinterpret_cast<double*>(record + 1);
+
+  for (size_t j = 0; j < joint_count_; ++j)
+  {
+    values[3 * j] = desired[j];
+    values[3 * j + 1] = actual[j];
+    values[3 * j + 2] = actual[j] - desired[j];
+  }
+
+  // the record is complete before the writer can see it
+  __sync_synchronize();
+  head_ = head + 1;
+
+  return true;
+}
+
+uint64_t TrajectoryTrace::getDropped() const
+{
+  return dropped_;
+}
+
+// Writes every record pushed so far, in at most two pieces when they wrap around the end of the ring
+void TrajectoryTrace::writeRecords()
+{
+  uint64_t head = head_;
+  uint64_t tail = tail_;
+
+  // records up to head are complete
+  __sync_synchronize();
+
+  while (tail < head)
+  {
+    size_t slot = tail % capacity_;
+    size_t count = std::min<uint64_t>(head - tail, capacity_ - slot);
+
+    if (!failed_ && !writeAll(fd_, &ring_[slot * record_size_], count * record_size_))
+    {
+      ROS_ERROR("Unable to write trajectory trace %s, the rest of it is discarded: %s",
+                path_.c_str(), strerror(errno));
+      failed_ = true;
+    }
+
+    tail += count;
+  }
+
+  // done with the slots before the control loop can reuse them
+  __sync_synchronize();
+  tail_ = tail;
+}
+
+void TrajectoryTrace::drain()
+{
+  while (!stopping_)
+  {
+    writeRecords();
+    usleep(WRITE_PERIOD_USEC);
+  }
+
+  writeRecords();
+}
+
+}
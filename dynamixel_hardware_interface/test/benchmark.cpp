@@ -0,0 +1,747 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+#include <clam/gearbox/flexiport/flexiport.h>
+
+#include <dynamixel_hardware_interface/bus_scheduler.h>
+#include <dynamixel_hardware_interface/dynamixel_const.h>
+#include <dynamixel_hardware_interface/dynamixel_io.h>
+#include <dynamixel_hardware_interface/dynamixel_packet.h>
+#include <dynamixel_hardware_interface/motor_state_recorder.h>
+#include <dynamixel_hardware_interface/motor_state_table.h>
+#include <dynamixel_hardware_interface/trajectory_trace.h>
+#include <dynamixel_hardware_interface/MotorStateList.h>
+
+// Every heap allocation made by the process goes through here, so that each
+// benchmark can report how many allocations one iteration costs.
+static unsigned long long allocation_count = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+    ++allocation_count;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) { throw std::bad_alloc(); }
+    return p;
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+    ++allocation_count;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) { throw std::bad_alloc(); }
+    return p;
+}
+
+void operator delete(void* p) throw() { free(p); }
+void operator delete[](void* p) throw() { free(p); }
+
+using namespace dynamixel_hardware_interface;
+
+namespace
+{
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+struct Result
+{
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+template <class F>
+Result run(F& f, int iterations)
+{
+    f();    // warm up, lets output vectors reach their final size
+
+    unsigned long long start_allocs = allocation_count;
+    double start = now();
+
+    for (int i = 0; i < iterations; ++i) { f(); }
+
+    double elapsed = now() - start;
+
+    Result r;
+    r.ns_per_op = elapsed * 1.0e9 / iterations;
+    r.allocs_per_op = (allocation_count - start_allocs) / (double) iterations;
+    return r;
+}
+
+void report(const std::string& name, const Result& r)
+{
+    printf("%-50s %12.0f ns/op %8.2f allocs/op %10.0f Hz\n",
+           name.c_str(), r.ns_per_op, r.allocs_per_op, 1.0e9 / r.ns_per_op);
+}
+
+std::string label(const char* name, size_t servos)
+{
+    std::ostringstream ss;
+    ss << name << ", " << servos << (servos == 1 ? " servo" : " servos");
+    return ss.str();
+}
+
+struct Checksum
+{
+    DynamixelPacket packet;
+    volatile uint8_t sink;
+
+    Checksum()
+    {
+        packet.begin(1, 0);
+        for (int i = 0; i < 250; ++i) { packet.append(i); }
+        packet.finish();
+    }
+
+    void operator()() { sink = computeChecksum(packet.data, packet.size); }
+};
+
+struct EncodeSyncWrite
+{
+    DynamixelGoal goals[DXL_MAX_SERVOS];
+    size_t count;
+    volatile uint8_t sink;
+
+    EncodeSyncWrite(size_t servos) : count(servos)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            goals[i].id = i + 1;
+            goals[i].position = 512 + i;
+            goals[i].velocity = -100 + i;
+        }
+    }
+
+    void operator()()
+    {
+        DynamixelPacket packet;
+        packet.beginSyncWrite(DXL_GOAL_POSITION_L, 4);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            packet.append(goals[i].id);
+            packet.appendRegister<DxlGoalPosition>(goals[i].position);
+            packet.appendRegister<DxlGoalSpeed>(goals[i].velocity);
+        }
+
+        packet.finish();
+        sink = packet.data[packet.size-1];
+    }
+};
+
+struct DecodeFeedback
+{
+    DynamixelPacket response;
+    volatile int sink;
+
+    DecodeFeedback()
+    {
+        response.begin(1, 0);
+        for (int i = 0; i < 13; ++i) { response.append(i * 17); }
+        response.finish();
+    }
+
+    void operator()()
+    {
+        const uint8_t* p = response.params();
+        int sum = 0;
+
+        if (response.checksumValid())
+        {
+            sum += decodeRegisterAt<DxlTorqueLimit, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlPresentPosition, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlPresentSpeed, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlPresentLoad, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlPresentVoltage, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlPresentTemperature, DXL_TORQUE_LIMIT_L>(p);
+            sum += decodeRegisterAt<DxlMoving, DXL_TORQUE_LIMIT_L>(p);
+        }
+
+        sink = sum;
+    }
+};
+
+struct Feedback
+{
+    DynamixelIO* dxl_io;
+    int id;
+    DynamixelStatus status;
+
+    Feedback(DynamixelIO* io, int motor_id) : dxl_io(io), id(motor_id) {}
+    void operator()() { dxl_io->getFeedback(id, status); }
+};
+
+struct MultiFeedback
+{
+    DynamixelIO* dxl_io;
+    const std::vector<int>& ids;
+    std::vector<DynamixelStatus> status;
+    std::vector<bool> valid;
+
+    MultiFeedback(DynamixelIO* io, const std::vector<int>& motor_ids) : dxl_io(io), ids(motor_ids) {}
+    void operator()() { dxl_io->getMultiFeedback(ids, status, valid); }
+};
+
+struct TypedSyncWrite
+{
+    DynamixelIO* dxl_io;
+    std::vector<DynamixelGoal> goals;
+
+    TypedSyncWrite(DynamixelIO* io, const std::vector<int>& ids) : dxl_io(io), goals(ids.size())
+    {
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            goals[i].id = ids[i];
+            goals[i].position = 512;
+            goals[i].velocity = 64;
+        }
+    }
+
+    void operator()()
+    {
+        // unchanged goals never leave the shadow, so keep them moving
+        for (size_t i = 0; i < goals.size(); ++i) { goals[i].position ^= 1; }
+        dxl_io->setMultiPositionVelocity(&goals[0], goals.size());
+    }
+};
+
+// A trajectory controller's tick, goals already in encoder units committed to
+// two ports at once. Both schedulers drive the same bus here, so the writes
+// take turns, what is measured is the handoff and whether it allocates.
+struct GoalCommit
+{
+    BusScheduler* first;
+    BusScheduler* second;
+    DynamixelIO* dxl_io;
+    std::vector<DynamixelGoal> goals;
+    BusCommit commit;
+
+    GoalCommit(DynamixelIO* io, BusScheduler* a, BusScheduler* b, const std::vector<int>& ids)
+        : first(a), second(b), dxl_io(io), goals(ids.size())
+    {
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            goals[i].id = ids[i];
+            goals[i].position = 512;
+            goals[i].velocity = 64;
+        }
+    }
+
+    void operator()()
+    {
+        size_t half = goals.size() / 2;
+        commit.addGoals(first, dxl_io, &goals[0], half);
+        commit.addGoals(second, dxl_io, &goals[half], goals.size() - half);
+        commit.commit();
+    }
+};
+
+// One iteration of the SerialProxy feedback loop followed by the setpoint a
+// controller would send in response, both through the bus scheduler.
+// Publishing is left out, it needs a running master.
+struct StateCycle
+{
+    DynamixelIO* dxl_io;
+    BusScheduler& scheduler;
+    const std::vector<int>& ids;
+    std::vector<DynamixelStatus> status;
+    std::vector<bool> valid;
+    MotorStateListPtr state;
+    TypedSyncWrite setpoint;
+    boost::function<bool ()> poll;
+    boost::function<bool ()> command;
+
+    StateCycle(DynamixelIO* io, BusScheduler& bus, const std::vector<int>& motor_ids)
+        : dxl_io(io), scheduler(bus), ids(motor_ids), status(motor_ids.size()), valid(motor_ids.size()),
+          state(new MotorStateList), setpoint(io, motor_ids)
+    {
+        state->motor_states.resize(ids.size());
+        poll = boost::bind(&DynamixelIO::getMultiFeedback, dxl_io, boost::cref(ids),
+                           boost::ref(status), boost::ref(valid));
+        command = boost::bind(&StateCycle::sendSetpoint, this);
+    }
+
+    bool sendSetpoint() { setpoint(); return true; }
+
+    void operator()()
+    {
+        scheduler.submit(BusScheduler::FEEDBACK, poll).get();
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            MotorState& ms = state->motor_states[i];
+            ms.alive = valid[i];
+            if (!valid[i]) { continue; }
+
+            ms.timestamp = status[i].timestamp;
+            ms.id = ids[i];
+            ms.position = status[i].position;
+            ms.velocity = status[i].velocity;
+            ms.torque_limit = status[i].torque_limit;
+            ms.load = status[i].load;
+            ms.moving = status[i].moving;
+            ms.voltage = status[i].voltage;
+            ms.temperature = status[i].temperature;
+        }
+
+        scheduler.submit(BusScheduler::SETPOINT, command).get();
+    }
+};
+
+// Feedback loop side of the motor_states topic, fills a pooled message and
+// hands it off while another thread keeps reading the latest one, the way the
+// diagnostics thread and in-process subscribers do. Every field of a message
+// gets the same cycle number, a reader that finds two different ones saw the
+// message change under it.
+struct StatePublish
+{
+    MotorStatePool pool;
+    size_t count;
+    int cycle;
+    volatile bool done;
+    unsigned long long reads;
+    unsigned long long torn;
+
+    StatePublish(size_t motors) : count(motors), cycle(0), done(false), reads(0), torn(0)
+    {
+        pool.resize(count);
+    }
+
+    void operator()()
+    {
+        MotorStateListPtr state = pool.acquire();
+        ++cycle;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            MotorState& ms = state->motor_states[i];
+            ms.timestamp = cycle;
+            ms.position = cycle;
+            ms.velocity = cycle;
+            ms.load = cycle;
+            ms.temperature = cycle;
+        }
+
+        pool.publish(state);
+    }
+
+    void read()
+    {
+        while (!done)
+        {
+            MotorStateListConstPtr state = pool.latest();
+            if (!state) { continue; }
+
+            int expected = state->motor_states[0].position;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const MotorState& ms = state->motor_states[i];
+                if (ms.timestamp != expected || ms.position != expected || ms.velocity != expected ||
+                    ms.load != expected || ms.temperature != expected)
+                {
+                    ++torn;
+                    break;
+                }
+            }
+
+            ++reads;
+        }
+    }
+};
+
+// What recording a feedback cycle adds to it, one record per motor appended
+// to a ring file that wraps many times over during the run
+struct StateRecord
+{
+    MotorStateRecorder* recorder;
+    std::vector<MotorStateSample> samples;
+    uint32_t cycle;
+
+    StateRecord(MotorStateRecorder* r, size_t motors) : recorder(r), samples(motors), cycle(0) {}
+
+    void operator()()
+    {
+        ++cycle;
+
+        for (size_t i = 0; i < samples.size(); ++i)
+        {
+            samples[i].status.position = cycle;
+            recorder->append(cycle, cycle, i + 1, samples[i]);
+        }
+    }
+};
+
+// What tracing adds to a trajectory controller tick, one record with every
+// joint pushed to the ring while its writer drains it to a file
+struct TracePush
+{
+    TrajectoryTrace* trace;
+    std::vector<double> desired;
+    std::vector<double> actual;
+    uint64_t tick;
+
+    TracePush(TrajectoryTrace* t, size_t joints) : trace(t), desired(joints), actual(joints), tick(0) {}
+
+    void operator()()
+    {
+        ++tick;
+        desired[0] = tick;
+        actual[0] = tick + 0.5;
+        trace->push(tick, &desired[0], &actual[0]);
+    }
+};
+
+// Far end of a pty, answers every 8 byte request with a 19 byte reply, the
+// sizes of a 13 byte feedback READ_DATA, so that a round trip shows what the
+// serial layer and its settings add on top of the wire time
+struct PtyServo
+{
+    int master;
+    volatile bool done;
+
+    PtyServo(int fd) : master(fd), done(false) {}
+
+    void run()
+    {
+        uint8_t request[8];
+        uint8_t reply[19] = { 0xFF, 0xFF, 1, 15 };
+        size_t have = 0;
+        struct pollfd pfd = { master, POLLIN, 0 };
+
+        while (!done)
+        {
+            if (poll(&pfd, 1, 10) <= 0) { continue; }
+
+            ssize_t n = read(master, request + have, sizeof(request) - have);
+            if (n > 0) { have += n; }
+
+            if (have == sizeof(request))
+            {
+                have = 0;
+                if (write(master, reply, sizeof(reply)) != (ssize_t) sizeof(reply)) { break; }
+            }
+        }
+    }
+};
+
+struct RoundTrip
+{
+    flexiport::Port* port;
+    uint8_t request[8];
+    uint8_t reply[19];
+
+    RoundTrip(flexiport::Port* p) : port(p) { memset(request, 0, sizeof(request)); }
+
+    void operator()()
+    {
+        port->Write(request, sizeof(request));
+        port->ReadFull(reply, sizeof(reply));
+    }
+};
+
+void benchmarkRoundTrip()
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+    {
+        printf("Skipping round trip benchmarks, no pty available\n");
+        return;
+    }
+
+    std::string slave = ptsname(master);
+    PtyServo servo(master);
+    boost::thread servo_thread(boost::bind(&PtyServo::run, &servo));
+
+    // a pty keeps whatever rate it is set to without generating it, these
+    // check that non-standard rates are accepted and show the cost of the
+    // settings, an FTDI adapter adds its latency timer on top
+    const char* bauds[] = { "1000000", "2250000", "3000000", "4500000" };
+    const char* latencies[] = { "", " lowlatency" };
+
+    for (size_t b = 0; b < sizeof(bauds) / sizeof(bauds[0]); ++b)
+    {
+        for (size_t l = 0; l < 2; ++l)
+        {
+            std::string options = "type=serial device=" + slave + " baud=" + bauds[b] + " timeout=1" + latencies[l];
+
+            try
+            {
+                flexiport::Port* port = flexiport::CreatePort(options);
+                port->Open();
+
+                RoundTrip round_trip(port);
+                report(std::string("8/19 byte round trip, ") + bauds[b] + " baud" + latencies[l], run(round_trip, 10000));
+
+                delete port;
+            }
+            catch (flexiport::PortException pex)
+            {
+                printf("%s baud%s: %s\n", bauds[b], latencies[l], pex.what());
+            }
+        }
+    }
+
+    servo.done = true;
+    servo_thread.join();
+    close(master);
+}
+
+void benchmarkBus(DynamixelIO* dxl_io, const std::vector<int>& ids, int iterations)
+{
+    size_t n = ids.size();
+
+    Feedback single(dxl_io, ids[0]);
+    report(label("getFeedback", 1), run(single, iterations));
+
+    MultiFeedback feedback(dxl_io, ids);
+    report(label("getMultiFeedback", n), run(feedback, iterations));
+
+    TypedSyncWrite typed(dxl_io, ids);
+    report(label("setMultiPositionVelocity(DynamixelGoal*)", n), run(typed, iterations));
+
+    BusScheduler scheduler;
+    scheduler.start();
+    StateCycle cycle(dxl_io, scheduler, ids);
+    report(label("state cycle (feedback + setpoint)", n), run(cycle, iterations));
+
+    BusScheduler other;
+    other.start();
+    GoalCommit commit(dxl_io, &scheduler, &other, ids);
+    report(label("BusCommit of goals to 2 schedulers", n), run(commit, iterations));
+    other.stop();
+    scheduler.stop();
+}
+
+struct VectorSyncWrite
+{
+    DynamixelIO* dxl_io;
+    const std::vector<int>& ids;
+
+    int toggle;
+
+    VectorSyncWrite(DynamixelIO* io, const std::vector<int>& motor_ids) : dxl_io(io), ids(motor_ids), toggle(0) {}
+
+    void operator()()
+    {
+        ++toggle;
+
+        // what the controllers did before DynamixelGoal existed
+        std::vector<std::vector<int> > value_tuples;
+
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            std::vector<int> value_tuple;
+            value_tuple.push_back(ids[i]);
+            value_tuple.push_back(512 + (toggle & 1));
+            value_tuple.push_back(64);
+            value_tuples.push_back(value_tuple);
+        }
+
+        dxl_io->setMultiPositionVelocity(value_tuples);
+    }
+};
+
+// READ_DATA one servo at a time against pipelined bursts of them, on AX-12s
+// that have no BULK_READ. The factory return delay of 500 us leaves room for
+// several requests in a burst, the depth comes from the delay read back here.
+void benchmarkPipelinedReads(const std::string& baud)
+{
+    const size_t servo_counts[] = { 2, 6, 12 };
+
+    for (size_t c = 0; c < sizeof(servo_counts) / sizeof(servo_counts[0]); ++c)
+    {
+        std::ostringstream options;
+        options << "type=dxlsim servos=1-" << servo_counts[c] << ":12";
+
+        try
+        {
+            DynamixelIO sim_io("dxlsim", baud, DXL_PROTOCOL_1, options.str());
+            std::vector<int> ids;
+            uint8_t return_delay;
+
+            for (size_t id = 1; id <= servo_counts[c]; ++id)
+            {
+                if (sim_io.getReturnDelayTime(id, return_delay)) { ids.push_back(id); }
+            }
+
+            MultiFeedback feedback(&sim_io, ids);
+
+            sim_io.setPipelinedReads(false);
+            report(label("getMultiFeedback, one READ at a time", ids.size()), run(feedback, 200));
+
+            sim_io.setPipelinedReads(true);
+            report(label("getMultiFeedback, pipelined READs", ids.size()), run(feedback, 200));
+        }
+        catch (flexiport::PortException pex)
+        {
+            printf("Skipping pipelined read benchmarks: %s\n", pex.what());
+            return;
+        }
+    }
+}
+
+}
+
+// usage: dynamixel_benchmark [device [baud [min_id [max_id [port_options]]]]]
+//
+// The codec and simulated bus benchmarks need no hardware. The bus ones run
+// against a flexiport "dxlsim" port with 1 to 32 MX-28s and zero return delay,
+// the rest against whatever answers on device.
+int main(int argc, char** argv)
+{
+    std::string device = argc > 1 ? argv[1] : "/dev/ttyUSB0";
+    std::string baud = argc > 2 ? argv[2] : "1000000";
+    int min_id = argc > 3 ? atoi(argv[3]) : 1;
+    int max_id = argc > 4 ? atoi(argv[4]) : 25;
+    std::string port_options = argc > 5 ? argv[5] : "";
+
+    printf("Packet codec\n");
+
+    Checksum checksum;
+    report("checksum 255 byte packet", run(checksum, 1000000));
+
+    const size_t servo_counts[] = { 1, 2, 4, 8, 16, 32 };
+    const size_t n_counts = sizeof(servo_counts) / sizeof(servo_counts[0]);
+
+    for (size_t c = 0; c < n_counts; ++c)
+    {
+        EncodeSyncWrite encode(servo_counts[c]);
+        report(label("encode SYNC_WRITE position+speed", servo_counts[c]), run(encode, 1000000));
+    }
+
+    DecodeFeedback decode;
+    report("decode 13 byte feedback", run(decode, 1000000));
+
+    printf("\nMotor state handoff\n");
+
+    for (size_t c = 0; c < n_counts; ++c)
+    {
+        StatePublish publish(servo_counts[c]);
+        boost::thread reader(boost::bind(&StatePublish::read, &publish));
+
+        Result r = run(publish, 1000000);
+        publish.done = true;
+        reader.join();
+
+        report(label("pooled MotorStateList publish", servo_counts[c]), r);
+        printf("    %llu concurrent reads, %llu torn, %zu buffers\n",
+               publish.reads, publish.torn, publish.pool.getBufferCount());
+    }
+
+    MotorStateRecorder recorder;
+
+    if (recorder.open("/tmp/dynamixel_benchmark_recording", 10000))
+    {
+        for (size_t c = 0; c < n_counts; ++c)
+        {
+            StateRecord record(&recorder, servo_counts[c]);
+            report(label("record cycle to ring file", servo_counts[c]), run(record, 100000));
+        }
+
+        recorder.close();
+        remove("/tmp/dynamixel_benchmark_recording");
+    }
+
+    for (size_t c = 0; c < n_counts; ++c)
+    {
+        std::vector<std::string> joints(servo_counts[c], "joint");
+        TrajectoryTrace trace;
+
+        if (trace.open("/tmp/dynamixel_benchmark_trace", joints, 20000))
+        {
+            TracePush push(&trace, servo_counts[c]);
+            Result r = run(push, 10000);
+            trace.close();
+
+            report(label("trace tick to SPSC ring", servo_counts[c]), r);
+            printf("    %llu records dropped\n", (unsigned long long) trace.getDropped());
+        }
+
+        remove("/tmp/dynamixel_benchmark_trace");
+    }
+
+    printf("\nSerial round trip over a pty\n");
+    benchmarkRoundTrip();
+
+    for (size_t c = 0; c < n_counts; ++c)
+    {
+        std::ostringstream options;
+        options << "type=dxlsim servos=1-" << servo_counts[c] << ":29 returndelay=0";
+        printf("\nSimulated bus at %s baud, %s\n", baud.c_str(), options.str().c_str());
+
+        try
+        {
+            DynamixelIO sim_io("dxlsim", baud, DXL_PROTOCOL_1, options.str());
+            std::vector<int> sim_ids;
+            for (size_t id = 1; id <= servo_counts[c]; ++id)
+            {
+                if (sim_io.ping(id)) { sim_ids.push_back(id); }
+            }
+
+            benchmarkBus(&sim_io, sim_ids, 200);
+        }
+        catch (flexiport::PortException pex)
+        {
+            printf("Skipping simulated bus benchmarks: %s\n", pex.what());
+            break;
+        }
+    }
+
+    printf("\nPipelined reads, simulated AX-12 bus at %s baud\n", baud.c_str());
+    benchmarkPipelinedReads(baud);
+
+    DynamixelIO* dxl_io;
+
+    try
+    {
+        dxl_io = new DynamixelIO(device, baud, DXL_PROTOCOL_1, port_options);
+    }
+    catch (flexiport::PortException pex)
+    {
+        printf("\nSkipping bus benchmarks, unable to open %s: %s\n", device.c_str(), pex.what());
+        return 0;
+    }
+
+    std::vector<int> ids;
+    for (int id = min_id; id <= max_id; ++id)
+    {
+        if (dxl_io->ping(id)) { ids.push_back(id); }
+    }
+
+    if (ids.empty())
+    {
+        printf("\nSkipping bus benchmarks, no servos found on %s\n", device.c_str());
+        delete dxl_io;
+        return 0;
+    }
+
+    printf("\nBus %s at %s baud, %zu servos\n", device.c_str(), baud.c_str(), ids.size());
+
+    benchmarkBus(dxl_io, ids, 1000);
+
+    VectorSyncWrite nested(dxl_io, ids);
+    report(label("setMultiPositionVelocity(vector<vector<int>>)", ids.size()), run(nested, 1000));
+
+    delete dxl_io;
+    return 0;
+}
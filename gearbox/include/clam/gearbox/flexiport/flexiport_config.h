@@ -4,4 +4,5 @@
 #define FLEXIPORT_INCLUDE_TCP 1
 #define FLEXIPORT_INCLUDE_UDP 1
 #define FLEXIPORT_INCLUDE_LOGGING 1
+#define FLEXIPORT_INCLUDE_DXLSIM 1
 #define FLEXIPORT_HAVE_GETADDRINFO 1
@@ -78,6 +78,17 @@ class FLEXIPORT_EXPORT Timeout
 		int _usec;
 };
 
+/** @brief Get the time left until an absolute deadline.
+
+The deadline is measured against the monotonic clock (CLOCK_MONOTONIC where available), so it is
+not affected by changes to the system time.
+
+@return false if the deadline has already passed, in which case @ref remaining is set to zero. */
+FLEXIPORT_EXPORT bool TimeUntilDeadline (const struct timespec &deadline, struct timespec &remaining);
+
+/** @brief Get an absolute deadline @ref timeout from now, for use with @ref TimeUntilDeadline. */
+FLEXIPORT_EXPORT void DeadlineFromNow (const Timeout &timeout, struct timespec &deadline);
+
 } // namespace flexiport
 
 /** @} */
@@ -0,0 +1,785 @@
+/*
+ * GearBox Project: Peer-Reviewed Open-Source Libraries for Robotics
+ *               http://gearbox.sf.net/
+ * Copyright (c) 2008 Geoffrey Biggs
+ *
+ * flexiport flexible hardware data communications library.
+ *
+ * This distribution is licensed to you under the terms described in the LICENSE file included in
+ * this distribution.
+ *
+ * This work is a product of the National Institute of Advanced Industrial Science and Technology,
+ * Japan. Registration number: H20PRO-881
+ *
+ * This file is part of flexiport.
+ *
+ * flexiport is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * Lesser General Public License as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * flexiport is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with flexiport.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flexiport.h"
+#include "dxlsimport.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sstream>
+#include <iostream>
+using namespace std;
+
+namespace flexiport
+{
+
+// Protocol 1.0 bits and pieces, kept local so that flexiport does not depend on the servo driver
+enum
+{
+	DXL_PING = 1,
+	DXL_READ_DATA = 2,
+	DXL_WRITE_DATA = 3,
+	DXL_REG_WRITE = 4,
+	DXL_ACTION = 5,
+	DXL_RESET = 6,
+	DXL_SYNC_WRITE = 131,
+	DXL_BULK_READ = 146,
+
+	DXL_BROADCAST = 254,
+
+	DXL_CHECKSUM_ERROR = 16,
+	DXL_INSTRUCTION_ERROR = 64,
+
+	DXL_ID = 3,
+	DXL_RETURN_DELAY_TIME = 5,
+	DXL_RETURN_LEVEL = 16,
+	DXL_TORQUE_ENABLE = 24,
+	DXL_GOAL_POSITION_L = 30,
+	DXL_PRESENT_POSITION_L = 36,
+	DXL_REGISTERED_INSTRUCTION = 44,
+	DXL_MOVING = 46,
+	DXL_LOCK = 47
+};
+
+static int64_t MonotonicNs ()
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return static_cast<int64_t> (now.tv_sec) * 1000000000LL + now.tv_nsec;
+}
+
+static int64_t ToNs (const struct timespec &ts)
+{
+	return static_cast<int64_t> (ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t Checksum (const uint8_t *data, size_t size)
+{
+	unsigned int sum = 0;
+	for (size_t ii = 0; ii < size; ii++)
+		sum += data[ii];
+	return ~sum & 0xFF;
+}
+
+// The MX series has 12 bit positions and understands BULK_READ
+static bool IsMX (int model)
+{
+	return model == 29 || model == 310 || model == 320;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Constructor/destructor
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DxlSimPort::DxlSimPort (map<string, string> options)
+	: Port (), _rxHead (0), _heard (0), _txEnd (0), _repliesEnd (0), _busFree (0), _baud (1000000), _returnDelay (250), _dropRate (0.0),
+	_corruptRate (0.0), _seed (1), _open (false)
+{
+	_type = "dxlsim";
+
+	// Options are applied in no particular order, so the servos are created once all of them are in
+	map<string, string>::iterator servos = options.find ("servos");
+	string servoList = "1:29";
+	if (servos != options.end ())
+	{
+		servoList = servos->second;
+		options.erase (servos);
+	}
+	ProcessOptions (options);
+	AddServos (servoList);
+
+	if (_alwaysOpen)
+		Open ();
+}
+
+DxlSimPort::~DxlSimPort ()
+{
+	Close ();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Port management
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DxlSimPort::Open ()
+{
+	if (_open)
+		throw PortException ("Attempt to open already-opened port.");
+
+	_rxQueue.clear ();
+	_rxHead = 0;
+	_txBuffer.clear ();
+	_busFree = MonotonicNs ();
+	_heard = _txEnd = _repliesEnd = _busFree;
+	_open = true;
+
+	if (_debug >= 2)
+		cerr << "DxlSimPort::" << __func__ << "() Port is open" << endl;
+}
+
+void DxlSimPort::Close ()
+{
+	if (_debug >= 2)
+		cerr << "DxlSimPort::" << __func__ << "() Closing port" << endl;
+
+	_open = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Read functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ssize_t DxlSimPort::Read (void * const buffer, size_t count)
+{
+	CheckPort (true);
+
+	if (_debug >= 2)
+		cerr << "DxlSimPort::" << __func__ << "() Going to read " << count << " bytes" << endl;
+
+	if (BytesArrived () == 0)
+	{
+		if (_timeout._sec == -1)
+		{
+			// Nothing else can put data on the bus while we block
+			if (InFlight () == 0)
+				throw PortException ("DxlSimPort::Read() Blocking read with no reply due.");
+			SleepUntil (_rxQueue[_rxHead].due);
+		}
+		else
+		{
+			int64_t deadline = MonotonicNs () + _timeout._sec * 1000000000LL +
+				_timeout._usec * 1000LL;
+			if (InFlight () == 0 || _rxQueue[_rxHead].due > deadline)
+			{
+				SleepUntil (deadline);
+				return -1;
+			}
+			SleepUntil (_rxQueue[_rxHead].due);
+		}
+	}
+
+	return TakeBytes (buffer, count);
+}
+
+ssize_t DxlSimPort::ReadFull (void * const buffer, size_t count)
+{
+	CheckPort (true);
+
+	if (InFlight () < count)
+	{
+		stringstream ss;
+		ss << "DxlSimPort::" << __func__ << "() Only " << InFlight () <<
+			" bytes will ever arrive, can not read " << count;
+		throw PortException (ss.str ());
+	}
+
+	if (count > 0)
+		SleepUntil (_rxQueue[_rxHead + count - 1].due);
+	return TakeBytes (buffer, count);
+}
+
+ssize_t DxlSimPort::ReadFullDeadline (void * const buffer, size_t count,
+		const struct timespec &deadline)
+{
+	CheckPort (true);
+
+	// Sleep once, straight to the last byte we need or the deadline, whichever is first
+	int64_t wakeup = ToNs (deadline);
+	if (count > 0 && count <= InFlight () && _rxQueue[_rxHead + count - 1].due < wakeup)
+		wakeup = _rxQueue[_rxHead + count - 1].due;
+	SleepUntil (wakeup);
+
+	return TakeBytes (buffer, count);
+}
+
+ssize_t DxlSimPort::BytesAvailable ()
+{
+	CheckPort (true);
+	return BytesArrived ();
+}
+
+ssize_t DxlSimPort::BytesAvailableWait ()
+{
+	CheckPort (true);
+
+	if (BytesArrived () == 0 && InFlight () != 0)
+	{
+		int64_t due = _rxQueue[_rxHead].due;
+		if (_timeout._sec != -1)
+		{
+			int64_t deadline = MonotonicNs () + _timeout._sec * 1000000000LL +
+				_timeout._usec * 1000LL;
+			if (deadline < due)
+				due = deadline;
+		}
+		SleepUntil (due);
+	}
+
+	return BytesArrived ();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Write functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+ssize_t DxlSimPort::Write (const void * const buffer, size_t count)
+{
+	CheckPort (false);
+
+	if (_debug >= 2)
+		cerr << "DxlSimPort::" << __func__ << "() Writing " << count << " bytes" << endl;
+
+	const uint8_t *data = reinterpret_cast<const uint8_t*> (buffer);
+	size_t carried = _txBuffer.size ();   // start of a packet that went out with an earlier write
+	_txBuffer.insert (_txBuffer.end (), data, data + count);
+
+	// Every byte written goes out back to back, padding included, after whatever else is on the
+	// bus now. The servos hear a packet once its last byte is on the wire.
+	int64_t byteTime = ByteTime ();
+	int64_t start = MonotonicNs ();
+	if (start < _busFree)
+		start = _busFree;
+	_txEnd = start + count * byteTime;
+
+	size_t used = 0;
+	while (_txBuffer.size () - used >= 4)
+	{
+		const uint8_t *packet = &_txBuffer[used];
+		if (packet[0] != 0xFF || packet[1] != 0xFF)
+		{
+			used++;
+			continue;
+		}
+
+		size_t size = 4 + packet[3];
+		if (_txBuffer.size () - used < size)
+			break;
+
+		ProcessPacket (packet, size, start + (used + size - carried) * byteTime);
+		used += size;
+	}
+	_txBuffer.erase (_txBuffer.begin (), _txBuffer.begin () + used);
+
+	if (_busFree < _txEnd)
+		_busFree = _txEnd;
+
+	return count;
+}
+
+void DxlSimPort::Flush ()
+{
+	CheckPort (true);
+	_rxQueue.clear ();
+	_rxHead = 0;
+	_txBuffer.clear ();
+}
+
+void DxlSimPort::Drain ()
+{
+	CheckPort (false);
+	// Everything written is on the bus once the bus is quiet, replies and all
+	SleepUntil (_busFree);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Other public API functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string DxlSimPort::GetStatus () const
+{
+	stringstream status;
+
+	status << "DxlSim-specific status:" << endl;
+	status << (_open ? "Port is open" : "Port is closed") << endl;
+	status << "Baud rate is " << _baud << ", " << InFlight () << " bytes in flight" << endl;
+	status << "Dropping " << _dropRate * 100.0 << "% and corrupting " << _corruptRate * 100.0 <<
+		"% of replies" << endl;
+	for (map<int, Servo>::const_iterator ii = _servos.begin (); ii != _servos.end (); ii++)
+	{
+		status << "Servo " << ii->first << ": model " <<
+			(ii->second.table[0] | (ii->second.table[1] << 8)) << ", return delay " <<
+			ii->second.table[DXL_RETURN_DELAY_TIME] * 2 << "us" << endl;
+	}
+
+	return Port::GetStatus () + status.str ();
+}
+
+void DxlSimPort::SetTimeout (Timeout timeout)
+{
+	_timeout = timeout;
+}
+
+void DxlSimPort::SetCanRead (bool canRead)
+{
+	_canRead = canRead;
+}
+
+void DxlSimPort::SetCanWrite (bool canWrite)
+{
+	_canWrite = canWrite;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+// Internal functions
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool DxlSimPort::ProcessOption (const std::string &option, const std::string &value)
+{
+	char c = '\0';
+
+	// Check if the parent class can handle this option
+	if (Port::ProcessOption (option, value))
+		return true;
+
+	if (option == "baud")
+	{
+		istringstream is (value);
+		if (!(is >> _baud) || is.get (c) || _baud == 0)
+			throw PortException ("Bad baud rate: " + value);
+		return true;
+	}
+	else if (option == "returndelay")
+	{
+		istringstream is (value);
+		if (!(is >> _returnDelay) || is.get (c) || _returnDelay < 0 || _returnDelay > 254)
+			throw PortException ("Bad return delay: " + value);
+		return true;
+	}
+	else if (option == "droprate")
+	{
+		istringstream is (value);
+		if (!(is >> _dropRate) || is.get (c) || _dropRate < 0.0 || _dropRate > 1.0)
+			throw PortException ("Bad drop rate: " + value);
+		return true;
+	}
+	else if (option == "corruptrate")
+	{
+		istringstream is (value);
+		if (!(is >> _corruptRate) || is.get (c) || _corruptRate < 0.0 || _corruptRate > 1.0)
+			throw PortException ("Bad corrupt rate: " + value);
+		return true;
+	}
+	else if (option == "seed")
+	{
+		istringstream is (value);
+		if (!(is >> _seed) || is.get (c))
+			throw PortException ("Bad seed: " + value);
+		return true;
+	}
+	else if (option == "device")
+	{
+		return true;
+	}
+
+	return false;
+}
+
+void DxlSimPort::AddServos (const std::string &value)
+{
+	string::size_type start = 0;
+	while (start < value.length ())
+	{
+		string::size_type end = value.find (';', start);
+		if (end == string::npos)
+			end = value.length ();
+		string entry = value.substr (start, end - start);
+		start = end + 1;
+		if (entry.empty ())
+			continue;
+
+		int first, last, model;
+		char c = '\0';
+		istringstream is (entry);
+		if (!(is >> first))
+			throw PortException ("Bad servo entry: " + entry);
+		last = first;
+		if (is.peek () == '-')
+		{
+			is.get (c);
+			if (!(is >> last))
+				throw PortException ("Bad servo entry: " + entry);
+		}
+		if (!is.get (c) || c != ':' || !(is >> model) || is.get (c) ||
+			first < 0 || last >= DXL_BROADCAST || first > last || model < 0 || model > 0xFFFF)
+		{
+			throw PortException ("Bad servo entry: " + entry);
+		}
+
+		for (int id = first; id <= last; id++)
+		{
+			ResetServo (_servos[id], id, model);
+			_servos[id].table[DXL_RETURN_DELAY_TIME] = _returnDelay;
+		}
+	}
+}
+
+void DxlSimPort::ResetServo (Servo &servo, int id, int model) const
+{
+	uint8_t *t = servo.table;
+	int maxPosition = IsMX (model) ? 4095 : 1023;
+
+	memset (t, 0, TABLE_SIZE);
+	t[0] = model & 0xFF;
+	t[1] = model >> 8;
+	t[2] = IsMX (model) ? 36 : 24;        // firmware version
+	t[3] = id;
+	t[4] = 2000000 / _baud - 1;           // baud rate register, informational only
+	t[5] = 250;                           // return delay time
+	t[8] = maxPosition & 0xFF;            // CCW angle limit
+	t[9] = maxPosition >> 8;
+	t[11] = IsMX (model) ? 80 : 70;       // temperature limit
+	t[12] = 60;                           // voltage limits
+	t[13] = 140;
+	t[14] = 0xFF;                         // max torque
+	t[15] = 0x03;
+	t[16] = 2;                            // status return level
+	t[17] = 36;                           // alarm LED and shutdown
+	t[18] = 36;
+	if (IsMX (model))
+	{
+		t[28] = 32;                       // P gain
+	}
+	else
+	{
+		t[26] = 1;                        // compliance margins and slopes
+		t[27] = 1;
+		t[28] = 32;
+		t[29] = 32;
+	}
+	t[30] = t[36] = (maxPosition / 2 + 1) & 0xFF;  // goal and present position in the middle
+	t[31] = t[37] = (maxPosition / 2 + 1) >> 8;
+	t[34] = 0xFF;                         // torque limit
+	t[35] = 0x03;
+	t[42] = 120;                          // present voltage
+	t[43] = 40;                           // present temperature
+	t[48] = 32;                           // punch
+	servo.registered.clear ();
+}
+
+int64_t DxlSimPort::ByteTime () const
+{
+	// 1 start bit, 8 data bits, 1 stop bit
+	return 10000000000LL / _baud;
+}
+
+void DxlSimPort::ProcessPacket (const uint8_t *packet, size_t size, int64_t sent)
+{
+	// A packet too short to hold an instruction and a checksum is line noise to the servos
+	if (size < 6)
+		return;
+
+	int id = packet[2];
+	int instruction = packet[4];
+	const uint8_t *params = packet + 5;
+	size_t paramCount = size - 6;
+
+	// Replies can only start once the instruction is completely on the bus
+	_heard = sent;
+
+	map<int, Servo>::iterator servo = _servos.find (id);
+	bool addressed = (servo != _servos.end ());
+	int level = addressed ? servo->second.table[DXL_RETURN_LEVEL] : 0;
+
+	if (_debug >= 2)
+	{
+		cerr << "DxlSimPort::" << __func__ << "() Instruction " << instruction << " for servo " <<
+			id << " with " << paramCount << " parameters" << endl;
+	}
+
+	if (Checksum (packet + 2, size - 3) != packet[size - 1])
+	{
+		if (addressed)
+			Reply (id, DXL_CHECKSUM_ERROR, NULL, 0);
+		return;
+	}
+
+	switch (instruction)
+	{
+		case DXL_PING:
+			if (addressed)
+				Reply (id, 0, NULL, 0);
+			break;
+
+		case DXL_READ_DATA:
+			if (!addressed || level < 1)
+				break;
+			if (paramCount != 2 || params[0] + params[1] > (int) TABLE_SIZE)
+				Reply (id, DXL_INSTRUCTION_ERROR, NULL, 0);
+			else
+				Reply (id, 0, servo->second.table + params[0], params[1]);
+			break;
+
+		case DXL_WRITE_DATA:
+		case DXL_REG_WRITE:
+		case DXL_ACTION:
+		{
+			if (!addressed && id != DXL_BROADCAST)
+				break;
+			if (instruction != DXL_ACTION &&
+				(paramCount < 2 || params[0] + paramCount - 1 > TABLE_SIZE))
+			{
+				if (addressed && level >= 2)
+					Reply (id, DXL_INSTRUCTION_ERROR, NULL, 0);
+				break;
+			}
+			if (addressed && level >= 2)
+				Reply (id, 0, NULL, 0);
+
+			// Collect the ids first, writing the ID register moves a servo around in the map
+			vector<int> targets;
+			if (addressed)
+				targets.push_back (id);
+			else
+			{
+				for (map<int, Servo>::iterator ii = _servos.begin (); ii != _servos.end (); ii++)
+					targets.push_back (ii->first);
+			}
+
+			for (size_t ii = 0; ii < targets.size (); ii++)
+			{
+				Servo &target = _servos[targets[ii]];
+				if (instruction == DXL_WRITE_DATA)
+				{
+					WriteTable (targets[ii], params[0], params + 1, paramCount - 1);
+				}
+				else if (instruction == DXL_REG_WRITE)
+				{
+					target.registered.assign (params, params + paramCount);
+					target.table[DXL_REGISTERED_INSTRUCTION] = 1;
+				}
+				else if (!target.registered.empty ())
+				{
+					vector<uint8_t> registered;
+					registered.swap (target.registered);
+					target.table[DXL_REGISTERED_INSTRUCTION] = 0;
+					WriteTable (targets[ii], registered[0], &registered[1], registered.size () - 1);
+				}
+			}
+			break;
+		}
+
+		case DXL_RESET:
+			if (!addressed)
+				break;
+			if (level >= 2)
+				Reply (id, 0, NULL, 0);
+			{
+				Servo reset;
+				ResetServo (reset, 1, servo->second.table[0] | (servo->second.table[1] << 8));
+				_servos.erase (servo);
+				_servos[1] = reset;
+			}
+			break;
+
+		case DXL_SYNC_WRITE:
+		{
+			// ADDRESS LENGTH (ID DATA...)...
+			if (paramCount < 2 || params[1] == 0)
+				break;
+			size_t length = params[1];
+			for (size_t ii = 2; ii + length + 1 <= paramCount; ii += length + 1)
+			{
+				if (_servos.count (params[ii]) && params[0] + length <= TABLE_SIZE)
+					WriteTable (params[ii], params[0], params + ii + 1, length);
+			}
+			break;
+		}
+
+		case DXL_BULK_READ:
+			// 0x00 (LENGTH ID ADDRESS)... Each servo answers after the one before it in the list,
+			// so one that stays quiet silences everyone behind it, as on the real bus.
+			for (size_t ii = 1; ii + 3 <= paramCount; ii += 3)
+			{
+				map<int, Servo>::iterator target = _servos.find (params[ii + 1]);
+				if (target == _servos.end () ||
+					!IsMX (target->second.table[0] | (target->second.table[1] << 8)) ||
+					params[ii + 2] + params[ii] > (int) TABLE_SIZE)
+				{
+					break;
+				}
+				size_t queued = InFlight ();
+				Reply (target->first, 0, target->second.table + params[ii + 2], params[ii]);
+				if (InFlight () == queued)
+					break;
+				_heard = _repliesEnd;
+			}
+			break;
+
+		default:
+			if (addressed && level >= 2)
+				Reply (id, DXL_INSTRUCTION_ERROR, NULL, 0);
+			break;
+	}
+}
+
+void DxlSimPort::WriteTable (int id, int address, const uint8_t *data, size_t size)
+{
+	Servo &servo = _servos[id];
+	uint8_t *t = servo.table;
+	bool locked = t[DXL_LOCK] != 0;
+
+	for (size_t ii = 0; ii < size; ii++)
+	{
+		int a = address + ii;
+		// model and firmware, present values and the registered flag are read only, and a lock
+		// protects the EEPROM area until the next power cycle
+		if (a < DXL_ID || (a >= DXL_PRESENT_POSITION_L && a <= DXL_MOVING) ||
+			(locked && a < DXL_TORQUE_ENABLE) || a >= (int) TABLE_SIZE)
+		{
+			continue;
+		}
+		t[a] = data[ii];
+	}
+
+	// No dynamics, the servo is wherever it was last told to go
+	if (address <= DXL_GOAL_POSITION_L + 1 && address + (int) size > DXL_GOAL_POSITION_L)
+	{
+		t[DXL_PRESENT_POSITION_L] = t[DXL_GOAL_POSITION_L];
+		t[DXL_PRESENT_POSITION_L + 1] = t[DXL_GOAL_POSITION_L + 1];
+		t[DXL_TORQUE_ENABLE] = 1;
+	}
+
+	if (t[DXL_ID] != id && t[DXL_ID] < DXL_BROADCAST)
+	{
+		Servo moved = servo;
+		_servos.erase (id);
+		_servos[moved.table[DXL_ID]] = moved;
+	}
+	else
+	{
+		t[DXL_ID] = id;
+	}
+}
+
+void DxlSimPort::Reply (int id, uint8_t error, const uint8_t *params, size_t count)
+{
+	if (Chance (_dropRate))
+	{
+		if (_debug >= 2)
+			cerr << "DxlSimPort::" << __func__ << "() Dropping reply of servo " << id << endl;
+		return;
+	}
+
+	// FF FF ID LENGTH ERROR PARAMS... CHECKSUM, on the stack so that the port does not show up
+	// in allocation counts of the code under test
+	uint8_t reply[6 + TABLE_SIZE];
+	reply[0] = 0xFF;
+	reply[1] = 0xFF;
+	reply[2] = id;
+	reply[3] = count + 2;
+	reply[4] = error;
+	if (count > 0)
+		memcpy (&reply[5], params, count);
+	reply[5 + count] = Checksum (&reply[2], count + 3);
+
+	// The servo answers its return delay time after it heard the instruction, replies that would
+	// overlap go out back to back. One that starts while we are still sending collides with our
+	// bytes and arrives garbled.
+	int64_t due = _heard + _servos[id].table[DXL_RETURN_DELAY_TIME] * 2000LL;
+	if (due < _repliesEnd)
+		due = _repliesEnd;
+	if (Chance (_corruptRate) || due < _txEnd)
+		reply[5 + count] ^= 0x5A;
+
+	int64_t byteTime = ByteTime ();
+	for (size_t ii = 0; ii < 6 + count; ii++)
+	{
+		RxByte b;
+		due += byteTime;
+		b.due = due;
+		b.data = reply[ii];
+		_rxQueue.push_back (b);
+	}
+	_repliesEnd = due;
+	if (_busFree < due)
+		_busFree = due;
+}
+
+bool DxlSimPort::Chance (double probability)
+{
+	if (probability <= 0.0)
+		return false;
+	return rand_r (&_seed) < probability * (RAND_MAX + 1.0);
+}
+
+size_t DxlSimPort::BytesArrived () const
+{
+	int64_t now = MonotonicNs ();
+	size_t arrived = 0;
+	while (arrived < InFlight () && _rxQueue[_rxHead + arrived].due <= now)
+		arrived++;
+	return arrived;
+}
+
+void DxlSimPort::SleepUntil (int64_t due) const
+{
+	struct timespec ts;
+	ts.tv_sec = due / 1000000000LL;
+	ts.tv_nsec = due % 1000000000LL;
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+ssize_t DxlSimPort::TakeBytes (void * const buffer, size_t count)
+{
+	size_t arrived = BytesArrived ();
+	if (count > arrived)
+		count = arrived;
+
+	uint8_t *data = reinterpret_cast<uint8_t*> (buffer);
+	for (size_t ii = 0; ii < count; ii++)
+		data[ii] = _rxQueue[_rxHead + ii].data;
+	_rxHead += count;
+
+	// Start over at the front once everything is read, keeping the capacity
+	if (_rxHead == _rxQueue.size ())
+	{
+		_rxQueue.clear ();
+		_rxHead = 0;
+	}
+
+	if (_debug >= 2)
+		cerr << "DxlSimPort::" << __func__ << "() Read " << count << " bytes" << endl;
+
+	return count;
+}
+
+void DxlSimPort::CheckPort (bool read)
+{
+	if (!_open)
+		throw PortException ("Port is not open.");
+
+	if (read && !_canRead)
+		throw PortException ("Cannot read from write-only port.");
+
+	if (!read && !_canWrite)
+		throw PortException ("Cannot write to read-only port.");
+}
+
+} // namespace flexiport
@@ -0,0 +1,184 @@
+/*
+ * GearBox Project: Peer-Reviewed Open-Source Libraries for Robotics
+ *               http://gearbox.sf.net/
+ * Copyright (c) 2008 Geoffrey Biggs
+ *
+ * flexiport flexible hardware data communications library.
+ *
+ * This distribution is licensed to you under the terms described in the LICENSE file included in
+ * this distribution.
+ *
+ * This work is a product of the National Institute of Advanced Industrial Science and Technology,
+ * Japan. Registration number: H20PRO-881
+ *
+ * This file is part of flexiport.
+ *
+ * flexiport is free software: you can redistribute it and/or modify it under the terms of the GNU
+ * Lesser General Public License as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * flexiport is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License along with flexiport.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DXLSIMPORT_H
+#define __DXLSIMPORT_H
+
+#include "port.h"
+#include "flexiport_config.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/** @ingroup gbx_library_flexiport
+@{
+*/
+
+namespace flexiport
+{
+
+/** @brief Simulated Dynamixel bus.
+
+Emulates a bus of Dynamixel servos speaking Protocol 1.0 inside the process, so that code talking
+to servos through a @ref Port can be run and benchmarked without any hardware. Every servo has a
+full control table, answers PING, READ, WRITE, REG_WRITE, ACTION, RESET and SYNC_WRITE, and MX
+series servos also answer BULK_READ. Present position follows the goal position as soon as it is
+written.
+
+Replies become readable when they would have arrived on a real bus: every byte written, padding
+included, and every reply take 10 bit times per byte at the configured baud rate, and each servo
+waits its return delay time (control table address 5, 2 usec per unit) after hearing its
+instruction before answering. The bytes of one write go out back to back, so several requests
+written at once are answered while the later ones are still arriving, the way pipelined reads
+work. A reply that starts before the last byte of that write is out collides with it and arrives
+with a bad checksum. The bus is half duplex, so a write made while replies are still due is only
+sent after them.
+
+Faults can be injected: a servo can stay silent (the reader times out) or send a reply with a bad
+checksum, each with a configurable probability.
+
+@note Only available on POSIX systems. Like the other ports, it is not thread safe.
+
+See the @ref Port class documentation for how to use the common API.
+
+@par Options
+ - servos <string>
+   - Servos on the bus, as a list of id:model entries separated by semicolons. The id may be a
+     range, so "1-6:29;10:12" is six MX-28s with ids 1 to 6 and an AX-12 with id 10.
+   - Default: 1:29
+ - baud <integer>
+   - Baud rate of the simulated bus.
+   - Default: 1000000
+ - returndelay <integer>
+   - Return delay time register value of every servo, in units of 2 usec.
+   - Default: 250 (the factory setting)
+ - droprate <float>
+   - Probability, from 0 to 1, that a servo does not send a reply it owes.
+   - Default: 0
+ - corruptrate <float>
+   - Probability, from 0 to 1, that a reply is sent with a bad checksum.
+   - Default: 0
+ - seed <integer>
+   - Seed for fault injection, so that failing runs can be repeated.
+   - Default: 1
+ - device <string>
+   - Ignored, accepted so that serial port options can be reused.
+
+A RESET returns a servo to the factory table, including id 1, as on the real hardware. */
+class FLEXIPORT_EXPORT DxlSimPort : public Port
+{
+	public:
+		DxlSimPort (std::map<std::string, std::string> options);
+		~DxlSimPort ();
+
+		/// @brief Open the port.
+		void Open ();
+		/// @brief Close the port.
+		void Close ();
+		/// @brief Read from the port.
+		ssize_t Read (void * const buffer, size_t count);
+		/// @brief Read the requested quantity of data from the port.
+		ssize_t ReadFull (void * const buffer, size_t count);
+		/// @brief Read the requested quantity of data from the port, giving up at a deadline.
+		ssize_t ReadFullDeadline (void * const buffer, size_t count,
+				const struct timespec &deadline);
+		/// @brief Get the number of bytes waiting to be read at the port. Returns immediatly.
+		ssize_t BytesAvailable ();
+		/// @brief Get the number of bytes waiting after blocking for the timeout.
+		ssize_t BytesAvailableWait ();
+		/// @brief Write data to the port.
+		ssize_t Write (const void * const buffer, size_t count);
+		/// @brief Flush the port's input and output buffers, discarding all data.
+		void Flush ();
+		/// @brief Drain the port's input and output buffers.
+		void Drain ();
+		/// @brief Get the status of the port (type, device, etc).
+		std::string GetStatus () const;
+		/// @brief Set the timeout value in milliseconds.
+		void SetTimeout (Timeout timeout);
+		/// @brief Set the read permissions of the port.
+		void SetCanRead (bool canRead);
+		/// @brief Set the write permissions of the port.
+		void SetCanWrite (bool canWrite);
+		/// @brief Check if the port is open
+		bool IsOpen () const                        { return _open; }
+
+	private:
+		// Control table of one servo, big enough for the MX series
+		enum { TABLE_SIZE = 74 };
+		struct Servo
+		{
+			uint8_t table[TABLE_SIZE];
+			std::vector<uint8_t> registered;  // address and data of a pending REG_WRITE
+		};
+
+		// A byte on its way to us and the monotonic time (in ns) it will have arrived
+		struct RxByte
+		{
+			int64_t due;
+			uint8_t data;
+		};
+
+		std::map<int, Servo> _servos;
+		std::vector<RxByte> _rxQueue;     // bytes before _rxHead have been read already
+		size_t _rxHead;
+		std::vector<uint8_t> _txBuffer;   // written bytes not yet forming a whole packet
+		int64_t _heard;                   // when the instruction being answered was received
+		int64_t _txEnd;                   // when the last byte written is off the bus
+		int64_t _repliesEnd;              // when the last reply queued is off the bus
+		int64_t _busFree;                 // when the last instruction or reply is off the bus
+
+		unsigned int _baud;
+		int _returnDelay;
+		double _dropRate;
+		double _corruptRate;
+		unsigned int _seed;
+		bool _open;
+
+		void CheckPort (bool read);
+		bool ProcessOption (const std::string &option, const std::string &value);
+		void AddServos (const std::string &value);
+		void ResetServo (Servo &servo, int id, int model) const;
+
+		int64_t ByteTime () const;
+		void ProcessPacket (const uint8_t *packet, size_t size, int64_t sent);
+		void WriteTable (int id, int address, const uint8_t *data, size_t size);
+		void Reply (int id, uint8_t error, const uint8_t *params, size_t count);
+		bool Chance (double probability);
+
+		size_t InFlight () const                    { return _rxQueue.size () - _rxHead; }
+		size_t BytesArrived () const;
+		void SleepUntil (int64_t due) const;
+		ssize_t TakeBytes (void * const buffer, size_t count);
+};
+
+} // namespace flexiport
+
+/** @} */
+
+#endif // __DXLSIMPORT_H
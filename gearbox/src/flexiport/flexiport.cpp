@@ -32,6 +32,7 @@
 #include "udpport.h"
 #include "logwriterport.h"
 #include "logreaderport.h"
+#include "dxlsimport.h"
 #include "flexiport_config.h"
 
 #include <errno.h>
@@ -114,6 +115,10 @@ Port* CreatePort (map<string, string> options)
 	if (type == "udp")
 		return new UDPPort (options);
 #endif // FLEXIPORT_INCLUDE_UDP
+#ifdef FLEXIPORT_INCLUDE_DXLSIM
+	if (type == "dxlsim")
+		return new DxlSimPort (options);
+#endif // FLEXIPORT_INCLUDE_DXLSIM
 
 #ifdef FLEXIPORT_INCLUDE_LOGGING
 	if (type == "logreader")
@@ -206,6 +206,43 @@ ssize_t Port::ReadLine (char * const buffer, size_t count)
 	return numRead;
 }
 
+ssize_t Port::ReadFullDeadline (void * const buffer, size_t count,
+		const struct timespec &deadline)
+{
+	size_t receivedBytes = 0;
+	Timeout oldTimeout = _timeout;
+	struct timespec remaining;
+
+	CheckPort (true);
+
+	// Keep calling Read() with the timeout set to whatever is left until the deadline
+	while (receivedBytes < count && TimeUntilDeadline (deadline, remaining))
+	{
+		Timeout timeout (0, 0);
+		timeout = remaining;
+		if (timeout._sec == 0 && timeout._usec == 0)
+			timeout._usec = 1; // Less than a microsecond left, but zero would mean non-blocking
+		SetTimeout (timeout);
+
+		ssize_t numReceived = Read (&(reinterpret_cast<uint8_t*> (buffer)[receivedBytes]),
+								count - receivedBytes);
+		if (numReceived < 0)
+			break; // Deadline passed
+		else if (numReceived == 0 && !IsOpen ())
+		{
+			SetTimeout (oldTimeout);
+			stringstream ss;
+			ss << "Port::" << __func__ << "() Port closed while trying to read " << count <<
+				" bytes";
+			throw PortException (ss.str ());
+		}
+		receivedBytes += numReceived;
+	}
+
+	SetTimeout (oldTimeout);
+	return receivedBytes;
+}
+
 ssize_t Port::Skip (size_t count)
 {
 	size_t numRead = 0, numToRead = 0;
@@ -112,6 +112,17 @@ class FLEXIPORT_EXPORT Port
 		shouldn't happen). */
 		virtual ssize_t ReadFull (void * const buffer, size_t count) = 0;
 
+		/** @brief Read the requested quantity of data from the port, giving up at a deadline.
+
+		Reads @ref count bytes from the port into @ref buffer, blocking until either all of them
+		have been received or the absolute time @ref deadline (see @ref DeadlineFromNow) has passed.
+		The timeout setting is ignored. Unlike @ref ReadFull, running out of time is not an error.
+
+		@return The number of bytes actually read, which will be less than @ref count if the
+		deadline passed first. */
+		virtual ssize_t ReadFullDeadline (void * const buffer, size_t count,
+				const struct timespec &deadline);
+
 		/** @brief Read a string.
 
 		A convenience function that reads data from the port and returns it in a string. Behaves
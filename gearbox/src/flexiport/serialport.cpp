@@ -35,6 +35,14 @@
 	#include <termios.h>
 	#include <unistd.h>
 	#include <errno.h>
+	#include <sys/select.h>
+	#include <time.h>
+	#include <limits.h>
+	#include <stdlib.h>
+#endif
+#if defined (__linux__)
+	#include <linux/serial.h>
+	#include <asm/ioctls.h>
 #endif
 
 #include <sys/types.h>
@@ -71,6 +79,30 @@ inline string StrError (int errNo)
 #endif
 }
 
+#if defined (__linux__) && defined (TCGETS2)
+// The kernel's termios2 from <asm/termbits.h>, which can't be included alongside <termios.h>. It
+// carries the baud rate as a number, so a driver can be asked for rates that have no Bxxxx
+// constant.
+struct termios2
+{
+	tcflag_t c_iflag;
+	tcflag_t c_oflag;
+	tcflag_t c_cflag;
+	tcflag_t c_lflag;
+	cc_t c_line;
+	cc_t c_cc[19];
+	speed_t c_ispeed;
+	speed_t c_ospeed;
+};
+
+#if !defined (BOTHER)
+	#define BOTHER 0010000
+#endif
+#if !defined (IBSHIFT)
+	#define IBSHIFT 16
+#endif
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 // Utility functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -179,6 +211,19 @@ int BaudToConstant (int baud)
 	}
 }
 
+bool IsStandardBaud (int baud)
+{
+	try
+	{
+		BaudToConstant (baud);
+	}
+	catch (PortException &)
+	{
+		return false;
+	}
+	return true;
+}
+
 int ConstantToBaud (int constant)
 {
     switch (constant)
@@ -295,7 +340,7 @@ SerialPort::SerialPort (map<string, string> options)
 	_fd (-1),
 #endif
 	_device ("/dev/ttyS0"), _baud (9600), _dataBits (8),
-	_stopBits (1), _parity (PAR_NONE), _hwFlowCtrl (false), _open (false)
+	_stopBits (1), _parity (PAR_NONE), _hwFlowCtrl (false), _lowLatency (false), _open (false)
 {
 	_type = "serial";
 	ProcessOptions (options);
@@ -546,6 +591,60 @@ ssize_t SerialPort::ReadFull (void * const buffer, size_t count)
 	return receivedBytes;
 }
 
+ssize_t SerialPort::ReadFullDeadline (void * const buffer, size_t count,
+		const struct timespec &deadline)
+{
+#if defined (WIN32)
+	return Port::ReadFullDeadline (buffer, count, deadline);
+#else
+	size_t receivedBytes = 0;
+
+	CheckPort (true);
+
+	if (_debug >= 2)
+	{
+		cerr << "SerialPort::" << __func__ << "() Going to read until have " << count <<
+			" bytes or deadline passes" << endl;
+	}
+
+	// Sleep in pselect() until data arrives or the deadline passes, so that waiting for a slow
+	// device does not cost any CPU time. The timeout setting is left untouched.
+	while (receivedBytes < count)
+	{
+		if (WaitForDataOrDeadline (deadline) == TIMED_OUT)
+			break;
+
+		ssize_t numReceived = read (_fd, &(reinterpret_cast<uint8_t*> (buffer)[receivedBytes]),
+								count - receivedBytes);
+		if (numReceived < 0)
+		{
+			if (ErrNo () == EAGAIN || ErrNo () == EINTR)
+				continue;
+			stringstream ss;
+			ss << "SerialPort::" << __func__ << "() read() error: (" <<
+				ErrNo () << ") " << StrError (ErrNo ());
+			throw PortException (ss.str ());
+		}
+		else if (numReceived == 0)
+		{
+			// Port has closed, do the same at this end
+			if (_debug >= 1)
+				cerr << "SerialPort::" << __func__ << "() Port has closed." << endl;
+			Close ();
+			if (_alwaysOpen)
+				Open ();
+			break;
+		}
+		receivedBytes += numReceived;
+	}
+
+	if (_debug >= 2)
+		cerr << "SerialPort::" << __func__ << "() Read " << receivedBytes << " bytes" << endl;
+
+	return receivedBytes;
+#endif
+}
+
 ssize_t SerialPort::BytesAvailable ()
 {
 	ssize_t bytesAvailable = 0;
@@ -769,6 +868,7 @@ std::string SerialPort::GetStatus () const
 			break;
 	}
 	status << "Hardware flow control: " << _hwFlowCtrl << endl;
+	status << "Low latency: " << _lowLatency << endl;
 	status << (_open ? "Port is open" : "Port is closed") << endl;
 
 	return Port::GetStatus () + status.str ();
@@ -814,7 +914,7 @@ void SerialPort::SetBaudRate (unsigned int baud)
 		throw PortException (ss.str ());
 	}
 
-	dcb.BaudRate = BaudToConstant (_baud);
+	dcb.BaudRate = BaudToConstant (baud);
 
 	if (!SetCommState (_fd, &dcb))
 	{
@@ -825,6 +925,14 @@ void SerialPort::SetBaudRate (unsigned int baud)
 		throw PortException (ss.str ());
 	}
 #else
+#if defined (__linux__) && defined (TCGETS2)
+	if (!IsStandardBaud (baud))
+	{
+		SetCustomBaudRate (baud);
+		_baud = baud;
+		return;
+	}
+#endif
 	struct termios tio;
 
 	if (tcgetattr (_fd, &tio) < 0)
@@ -835,7 +943,7 @@ void SerialPort::SetBaudRate (unsigned int baud)
 			StrError (ErrNo ());
 		throw PortException (ss.str ());
 	}
-	if (cfsetispeed (&tio, BaudToConstant (_baud)) < 0)
+	if (cfsetispeed (&tio, BaudToConstant (baud)) < 0)
 	{
 		Close ();
 		stringstream ss;
@@ -844,7 +952,7 @@ void SerialPort::SetBaudRate (unsigned int baud)
 		throw PortException (ss.str ());
 	}
 	// No, this isn't a repeat of the previous if
-	if (cfsetospeed (&tio, BaudToConstant (_baud)) < 0)
+	if (cfsetospeed (&tio, BaudToConstant (baud)) < 0)
 	{
 		Close ();
 		stringstream ss;
@@ -920,6 +1028,11 @@ bool SerialPort::ProcessOption (const std::string &option, const std::string &va
 		_hwFlowCtrl = true;
 		return true;
 	}
+	else if (option == "lowlatency")
+	{
+		_lowLatency = true;
+		return true;
+	}
 
 	return false;
 }
@@ -963,6 +1076,40 @@ SerialPort::WaitStatus SerialPort::WaitForDataOrTimeout ()
 	return DATA_AVAILABLE;
 }
 
+// Checks if data is available, waiting until the absolute deadline if none is available
+SerialPort::WaitStatus SerialPort::WaitForDataOrDeadline (const struct timespec &deadline)
+{
+	fd_set fdSet;
+	struct timespec remaining;
+	int result;
+
+	do
+	{
+		FD_ZERO (&fdSet);
+		FD_SET (_fd, &fdSet);
+		// If the deadline has passed this polls once with a zero timeout, picking up any data
+		// that is already waiting
+		TimeUntilDeadline (deadline, remaining);
+		result = pselect (_fd + 1, &fdSet, NULL, NULL, &remaining, NULL);
+	}
+	while (result < 0 && ErrNo () == EINTR);
+
+	if (result < 0)
+	{
+		stringstream ss;
+		ss << "SerialPort::" << __func__ << "() pselect() error: (" << ErrNo () << ") " <<
+			StrError (ErrNo ());
+		throw PortException (ss.str ());
+	}
+	else if (result == 0)
+	{
+		if (_debug >= 3)
+			cerr << "SerialPort::" << __func__ << "() Deadline passed" << endl;
+		return TIMED_OUT;
+	}
+	return DATA_AVAILABLE;
+}
+
 // Checks if the port can be written to, waiting for the timeout if it can't be written immediately
 SerialPort::WaitStatus SerialPort::WaitForWritableOrTimeout ()
 {
@@ -1093,6 +1240,10 @@ void SerialPort::SetPortSettings ()
 	// flags we may set.
 	cfmakeraw (&tio);
 
+	// A blocking read returns as soon as there is a byte, without waiting on an inter-byte timer
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+
 	tio.c_cflag &= ~CSIZE;
 	switch (_dataBits)
 	{
@@ -1161,6 +1312,93 @@ void SerialPort::SetPortSettings ()
 #endif
 
 	SetBaudRate (_baud);
+
+	if (_lowLatency)
+		SetLowLatency ();
+}
+
+#if defined (__linux__) && defined (TCGETS2)
+void SerialPort::SetCustomBaudRate (unsigned int baud)
+{
+	struct termios2 tio;
+
+	if (ioctl (_fd, TCGETS2, &tio) < 0)
+	{
+		Close ();
+		stringstream ss;
+		ss << "SerialPort::" << __func__ << "() TCGETS2 error: (" << ErrNo () << ") " <<
+			StrError (ErrNo ());
+		throw PortException (ss.str ());
+	}
+
+	tio.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	tio.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	tio.c_ispeed = baud;
+	tio.c_ospeed = baud;
+
+	if (ioctl (_fd, TCSETSF2, &tio) < 0)
+	{
+		Close ();
+		stringstream ss;
+		ss << "SerialPort::" << __func__ << "() Baud rate " << baud << " not supported by device: (" <<
+			ErrNo () << ") " << StrError (ErrNo ());
+		throw PortException (ss.str ());
+	}
+
+	if (_debug >= 1)
+	{
+		if (ioctl (_fd, TCGETS2, &tio) == 0)
+			cerr << "SerialPort::" << __func__ << "() Asked for " << baud << " baud, device runs at " <<
+				tio.c_ospeed << endl;
+	}
+}
+#endif
+
+// Best effort, devices that don't support a setting are left as they are
+void SerialPort::SetLowLatency ()
+{
+#if defined (__linux__)
+	// Have the driver push received bytes to the reader straight away instead of batching them up
+	struct serial_struct serial;
+	if (ioctl (_fd, TIOCGSERIAL, &serial) < 0)
+	{
+		if (_debug >= 1)
+			cerr << "SerialPort::" << __func__ << "() " << _device << " has no low latency flag: (" <<
+				ErrNo () << ") " << StrError (ErrNo ()) << endl;
+	}
+	else
+	{
+		serial.flags |= ASYNC_LOW_LATENCY;
+		if (ioctl (_fd, TIOCSSERIAL, &serial) < 0 && _debug >= 1)
+			cerr << "SerialPort::" << __func__ << "() Failed to set the low latency flag: (" <<
+				ErrNo () << ") " << StrError (ErrNo ()) << endl;
+	}
+
+	// USB-serial adapters (FTDI) hold on to received bytes for up to their latency timer, 16ms by
+	// default, before sending them to the host. Changing it usually needs root or a udev rule.
+	char resolved[PATH_MAX];
+	if (realpath (_device.c_str (), resolved) == NULL)
+		return;
+
+	string name (resolved);
+	name = name.substr (name.rfind ('/') + 1);
+	string timerPath = "/sys/class/tty/" + name + "/device/latency_timer";
+
+	int timerFd = open (timerPath.c_str (), O_WRONLY);
+	if (timerFd < 0 || write (timerFd, "1", 1) != 1)
+	{
+		if (_debug >= 1 && errno != ENOENT)
+			cerr << "SerialPort::" << __func__ << "() Failed to set " << timerPath << ": (" <<
+				ErrNo () << ") " << StrError (ErrNo ()) << endl;
+	}
+	else if (_debug >= 2)
+	{
+		cerr << "SerialPort::" << __func__ << "() Set " << timerPath << " to 1ms" << endl;
+	}
+
+	if (timerFd >= 0)
+		close (timerFd);
+#endif
 }
 
 void SerialPort::SetPortTimeout ()
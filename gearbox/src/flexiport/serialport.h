@@ -59,7 +59,8 @@ will be rounded to the nearest millisecond when used.
    - Default: none
  - baud <integer>
    - Baud rate. Valid values are 50, 75, 110, 134, 150, 200, 300, 600, 1200, 1800, 2400, 4800, 9600,
-     19200, 34800, 57600, 115200, 230400.
+     19200, 34800, 57600, 115200, 230400. Under Linux any other rate the device can generate, such
+     as 2250000 or 4500000, is also accepted.
    - Default: 9600
  - databits <integer>
    - Default: 8
@@ -68,6 +69,11 @@ will be rounded to the nearest millisecond when used.
    - Default: 1
  - hwflowctrl
    - Turn hardware flow control on.
+   - Default: off
+ - lowlatency
+   - Under Linux, set the driver's low latency flag and the latency timer of USB-serial adapters
+     that have one to 1ms, so small replies reach the reader without being held back. Settings
+     the device does not support are skipped.
    - Default: off */
 class FLEXIPORT_EXPORT SerialPort : public Port
 {
@@ -83,6 +89,9 @@ class FLEXIPORT_EXPORT SerialPort : public Port
 		ssize_t Read (void * const buffer, size_t count);
 		/// @brief Read the requested quantity of data from the port.
 		ssize_t ReadFull (void * const buffer, size_t count);
+		/// @brief Read the requested quantity of data from the port, giving up at a deadline.
+		ssize_t ReadFullDeadline (void * const buffer, size_t count,
+				const struct timespec &deadline);
 		/// @brief Get the number of bytes waiting to be read at the port. Returns immediatly.
 		ssize_t BytesAvailable ();
 		/** @brief Get the number of bytes waiting after blocking for the timeout.
@@ -127,6 +136,7 @@ class FLEXIPORT_EXPORT SerialPort : public Port
 		typedef enum {PAR_NONE, PAR_EVEN, PAR_ODD} Parity;
 		Parity _parity;
 		bool _hwFlowCtrl;
+		bool _lowLatency;
 		bool _open;
 
 		void CheckPort (bool read);
@@ -136,10 +146,13 @@ class FLEXIPORT_EXPORT SerialPort : public Port
 #if !defined (WIN32)
 		typedef enum {TIMED_OUT, DATA_AVAILABLE, CAN_WRITE} WaitStatus;
 		WaitStatus WaitForDataOrTimeout ();
+		WaitStatus WaitForDataOrDeadline (const struct timespec &deadline);
 		WaitStatus WaitForWritableOrTimeout ();
 #endif
 		void SetPortSettings ();
 		void SetPortTimeout ();
+		void SetCustomBaudRate (unsigned int baud);
+		void SetLowLatency ();
 };
 
 } // namespace flexiport
@@ -31,6 +31,7 @@
 	#include <winsock2.h>
 #else
 	#include <sys/time.h>
+	#include <time.h>
 #endif
 
 #include "timeout.h"
@@ -86,4 +87,50 @@ Timeout& Timeout::operator= (const struct timespec &rhs)
 	return *this;
 }
 
+static void MonotonicNow (struct timespec &now)
+{
+#if defined (WIN32)
+	DWORD ms = GetTickCount ();
+	now.tv_sec = ms / 1000;
+	now.tv_nsec = (ms % 1000) * 1000000;
+#else
+	clock_gettime (CLOCK_MONOTONIC, &now);
+#endif
+}
+
+bool TimeUntilDeadline (const struct timespec &deadline, struct timespec &remaining)
+{
+	struct timespec now;
+	MonotonicNow (now);
+
+	remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+	remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+	if (remaining.tv_nsec < 0)
+	{
+		remaining.tv_sec -= 1;
+		remaining.tv_nsec += 1000000000;
+	}
+
+	if (remaining.tv_sec < 0 || (remaining.tv_sec == 0 && remaining.tv_nsec == 0))
+	{
+		remaining.tv_sec = 0;
+		remaining.tv_nsec = 0;
+		return false;
+	}
+	return true;
+}
+
+void DeadlineFromNow (const Timeout &timeout, struct timespec &deadline)
+{
+	MonotonicNow (deadline);
+
+	deadline.tv_sec += timeout._sec;
+	deadline.tv_nsec += timeout._usec * 1000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+	}
+}
+
 } // namespace flexiport